@@ -21,18 +21,26 @@ void ofApp::setup()
     // Set the sender email and display name.
     senderEmail = "Christopher Baker <info@christopherbaker.net>";
 
-    // Load credentials and account settings from an xml or json file.
-    // auto settings = ofxSMTP::Settings::loadFromXML("example-smtp-account-settings.xml");
-    auto settings = ofxSMTP::Settings::loadFromJSON("example-smtp-account-settings.json");
+    // Load credentials and account settings from an xml or json file. The
+    // account and any additional relays listed in the file are loaded.
+    // auto relays = ofxSMTP::Settings::loadAllFromXML("example-smtp-account-settings.xml");
+    auto relays = ofxSMTP::Settings::loadAllFromJSON("example-smtp-account-settings.json");
 
     // See ofxSMTP::Settings for extensive configuration options.
 
     // Pass the settings to the client.
-    smtp.setup(settings);
+    smtp.setup(relays);
 
     // Register event callbacks for message delivery (or failure) events
     smtpDeliveryListener = smtp.events.onSMTPDelivery.newListener(this, &ofApp::onSMTPDelivery);
     smtpExceptionListener = smtp.events.onSMTPException.newListener(this, &ofApp::onSMTPException);
+
+    // Failed messages are retried. This reports what finally happened.
+    smtpResultListener = smtp.events.onSMTPResult.newListener(this, &ofApp::onSMTPResult);
+
+    // With "event-dispatch" set to "UPDATE_LOOP" in the settings file, the
+    // events are notified on the main thread, many results at a time.
+    smtpResultBatchListener = smtp.events.onSMTPResultBatch.newListener(this, &ofApp::onSMTPResultBatch);
 }
 
 
@@ -44,7 +52,37 @@ void ofApp::draw()
     std::stringstream ss;
     ss << "         Press <SPACEBAR> to Send Text" << std::endl;
     ss << "           Press <a> to Send an Image" << std::endl;
-    ss << "ofxSMTP: There are " + ofToString(smtp.getOutboxSize()) + " messages in your outbox.";
+    ss << "           Press <u> to Send an Urgent Text" << std::endl;
+    ss << "           Press <b> to Send a Bulk Text" << std::endl;
+    ss << "           Press <r> to Send a Mail Merge" << std::endl;
+    ss << "           Press <t> to Send a Tracked Text" << std::endl;
+    ss << "           Press <m> to Print Metrics" << std::endl;
+    ss << "ofxSMTP: There are " + ofToString(smtp.getOutboxSize()) + " messages in your outbox." << std::endl;
+    ss << "ofxSMTP: There are " + ofToString(smtp.getEventQueueSize()) + " events waiting." << std::endl;
+
+    // Show the depth and wait time of each priority lane.
+    for (int i = 0; i < ofxSMTP::Settings::NUM_PRIORITIES; ++i)
+    {
+        auto priority = ofxSMTP::Settings::Priority(i);
+        auto stats = smtp.getLaneStats(priority);
+
+        ss << std::endl << ofxSMTP::Settings::priorityToString(priority) << ": "
+           << stats.size << " queued, average wait "
+           << std::chrono::duration_cast<std::chrono::milliseconds>(stats.averageWait).count() << " ms, oldest "
+           << std::chrono::duration_cast<std::chrono::milliseconds>(stats.oldestWait).count() << " ms";
+    }
+
+    ss << std::endl;
+
+    // Show the health of each relay.
+    for (const auto& relay: smtp.getRelays())
+    {
+        ss << std::endl << relay->settings().host() << ":" << relay->settings().port() << " "
+           << (relay->isAvailable() ? "up" : "cooling down") << ", latency "
+           << std::chrono::duration_cast<std::chrono::milliseconds>(relay->latency()).count() << " ms, errors "
+           << int(relay->errorRate() * 100) << "%";
+    }
+
     ofDrawBitmapStringHighlight(ss.str(), 10, 20);
 }
 
@@ -59,6 +97,86 @@ void ofApp::keyPressed(int key)
                   "I'm trying out ofxSMTP!",  // Subject line.
                   "It works!");               // Message body.
     }
+    else if (key == 'u') // Press 'u' to send a message ahead of the others.
+    {
+        // Urgent messages overtake normal and bulk messages in the outbox.
+        smtp.send(recipientEmail,
+                  senderEmail,
+                  "Urgent message from ofxSMTP!",
+                  "This one skipped the queue.",
+                  ofxSMTP::Settings::URGENT);
+    }
+    else if (key == 'b') // Press 'b' to send one message to many recipients.
+    {
+        auto message = std::make_shared<Poco::Net::MailMessage>();
+        message->setSender(Poco::Net::MailMessage::encodeWord(senderEmail, "UTF-8"));
+        message->set("To", "undisclosed-recipients:;");
+        message->setSubject(Poco::Net::MailMessage::encodeWord("News from ofxSMTP!", "UTF-8"));
+        message->setContentType("text/plain; charset=UTF-8");
+        message->setContent("Everyone gets the same message, sent once per transaction.",
+                            Poco::Net::MailMessage::ENCODING_8BIT);
+
+        // The recipients only go in the envelope, like Bcc.
+        std::vector<std::string> recipients;
+        recipients.push_back(recipientEmail);
+
+        smtp.sendBulk(message, recipients, ofxSMTP::Settings::BULK);
+    }
+    else if (key == 'r') // Press 'r' to send a personalized message to many recipients.
+    {
+        // A template is usually compiled once and kept. The image is encoded
+        // when it is compiled and shared by every message.
+        ofxSMTP::MessageTemplate invitation;
+        invitation.setSender(Poco::Net::MailMessage::encodeWord(senderEmail, "UTF-8"));
+        invitation.setSubject("{{name}}, you're invited!");
+        invitation.setContent("Hello {{name}},\n\nYour seat is {{seat}}. The image is shared by every invitation.\n");
+        invitation.setHeader("X-Mailer", "ofxSMTP (https://github.com/bakercp/ofxSMTP)");
+
+        try
+        {
+            invitation.addAttachment("of.png", new ofxSMTP::MappedFilePartSource(ofToDataPath("of.png", true)));
+            invitation.compile();
+        }
+        catch (const Poco::Exception& exc)
+        {
+            ofLogError("ofApp::keyPressed") << exc.name() << " : " << exc.displayText();
+            return;
+        }
+
+        std::vector<ofxSMTP::MessageTemplate::Recipient> recipients;
+        recipients.push_back({ recipientEmail, { { "name", "Chris" }, { "seat", "A1" } } });
+
+        smtp.sendMerge(invitation, recipients, ofxSMTP::Settings::BULK);
+    }
+    else if (key == 't') // Press 't' to follow a single message.
+    {
+        auto message = std::make_shared<Poco::Net::MailMessage>();
+        message->setSender(Poco::Net::MailMessage::encodeWord(senderEmail, "UTF-8"));
+        message->addRecipient(Poco::Net::MailRecipient(Poco::Net::MailRecipient::PRIMARY_RECIPIENT,
+                                                       recipientEmail));
+        message->setSubject(Poco::Net::MailMessage::encodeWord("Tracked message from ofxSMTP!", "UTF-8"));
+        message->setContent("This message has a ticket.");
+
+        // The ticket can also be polled with isDone() or waited on with
+        // wait(). The continuation runs on the delivery thread.
+        ofxSMTP::DeliveryTicket ticket = smtp.sendTracked(message);
+
+        ticket.then([](const ofxSMTP::DeliveryTicket& ticket) {
+            for (const auto& result: ticket.results())
+            {
+                ofLogNotice("ofApp::keyPressed") << "Ticket " << ticket.id() << ": "
+                                                 << ofxSMTP::DeliveryResultArgs::toString(result.outcome())
+                                                 << ", reply " << result.replyCode()
+                                                 << ", queue id " << result.queueId()
+                                                 << ", " << std::chrono::duration_cast<std::chrono::milliseconds>(result.timings().total).count() << " ms";
+            }
+        });
+    }
+    else if (key == 'm') // Press 'm' to print the delivery metrics.
+    {
+        // Use toPrometheus() to serve them to a Prometheus server instead.
+        ofLogNotice("ofApp::keyPressed") << smtp.getMetrics().toJSON().dump(4);
+    }
     else if(key == 'a') // Press 'a' for an advanced send with attachment.
     {
         // You can construct complex messages using POCO's MailMessage object.
@@ -81,15 +199,19 @@ void ofApp::keyPressed(int key)
         // so you don't have to worry about deleting the pointers.
         message->addContent(new Poco::Net::StringPartSource("Hello world! How about an image?"));
         
-        // Poco::Net::MailMessage throws exceptions when a file is not found.
+        // File part sources throw exceptions when a file is not found.
         // Thus, we need to add attachments in a try / catch block.
+        //
+        // ofxSMTP::MappedFilePartSource memory-maps the file instead of
+        // reading it through streams, so large attachments do not increase
+        // the memory used by queued messages.
 
         try
         {
             message->addAttachment(Poco::Net::MailMessage::encodeWord("of.png","UTF-8"),
-                                   new Poco::Net::FilePartSource(ofToDataPath("of.png", true)));
+                                   new ofxSMTP::MappedFilePartSource(ofToDataPath("of.png", true)));
         }
-        catch (const Poco::OpenFileException& exc)
+        catch (const Poco::FileException& exc)
         {
             ofLogError("ofApp::keyPressed") << exc.name() << " : " << exc.displayText();
         }
@@ -121,6 +243,29 @@ void ofApp::onSMTPException(const ofxSMTP::ErrorArgs& evt)
 }
 
 
+void ofApp::onSMTPResult(const ofxSMTP::DeliveryResultArgs& evt)
+{
+    ofLogNotice("ofApp::onSMTPResult") << ofxSMTP::DeliveryResultArgs::toString(evt.outcome())
+                                       << " for " << evt.recipients().size() << " recipient(s)"
+                                       << " after " << evt.attempts() << " attempt(s): "
+                                       << evt.message()->getSubject();
+}
+
+
+void ofApp::onSMTPResultBatch(const std::vector<ofxSMTP::DeliveryResultArgs>& evt)
+{
+    std::size_t delivered = 0;
+
+    for (const auto& result: evt)
+    {
+        if (ofxSMTP::DeliveryResultArgs::DELIVERED == result.outcome())
+            ++delivered;
+    }
+
+    ofLogVerbose("ofApp::onSMTPResultBatch") << delivered << " of " << evt.size() << " result(s) delivered.";
+}
+
+
 void ofApp::onSSLClientVerificationError(Poco::Net::VerificationErrorArgs& args)
 {
     ofLogNotice("ofApp::onClientVerificationError") << std::endl << ofToString(args);
@@ -21,12 +21,16 @@ public:
 
     void onSMTPDelivery(std::shared_ptr<Poco::Net::MailMessage>& message);
     void onSMTPException(const ofxSMTP::ErrorArgs& evt);
+    void onSMTPResult(const ofxSMTP::DeliveryResultArgs& evt);
+    void onSMTPResultBatch(const std::vector<ofxSMTP::DeliveryResultArgs>& evt);
 
     void onSSLClientVerificationError(Poco::Net::VerificationErrorArgs& args);
     void onSSLPrivateKeyPassphraseRequired(std::string& passphrase);
 
     ofEventListener smtpDeliveryListener;
     ofEventListener smtpExceptionListener;
+    ofEventListener smtpResultListener;
+    ofEventListener smtpResultBatchListener;
 
     std::string recipientEmail;
     std::string senderEmail;
@@ -0,0 +1,733 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "FakeSMTPServer.h"
+#include <chrono>
+#include <sstream>
+#include <thread>
+#include "Poco/String.h"
+#include "Poco/Net/SecureServerSocket.h"
+#include "Poco/Net/SecureStreamSocket.h"
+#include "Poco/Net/ServerSocket.h"
+#include "Poco/Net/TCPServerConnection.h"
+#include "Poco/Net/TCPServerConnectionFactory.h"
+#include "Poco/Net/TCPServerParams.h"
+#include "ofFileUtils.h"
+
+
+/// \brief One client connection.
+class FakeSMTPServer::Session: public Poco::Net::TCPServerConnection
+{
+public:
+    Session(const Poco::Net::StreamSocket& socket, FakeSMTPServer& server):
+        Poco::Net::TCPServerConnection(socket),
+        _server(server),
+        _socket(socket)
+    {
+    }
+
+    void run() override
+    {
+        ++_server._connections;
+
+        _socket.setReceiveTimeout(Poco::Timespan(60, 0));
+
+        // SSLTLS sockets complete their handshake on the first write.
+        _isSecure = (ofxSMTP::Settings::SSLTLS == _server._encryption);
+
+        try
+        {
+            FakeSMTPServer::Fault fault;
+
+            if (_server.takeFault("CONNECT", "", fault) && !inject(fault, "CONNECT"))
+                return;
+
+            reply("220 localhost ESMTP ofxSMTP fake server");
+
+            std::string line;
+
+            while (readLine(line) && handle(line))
+            {
+            }
+        }
+        catch (const Poco::Exception& exc)
+        {
+            ofLogVerbose("FakeSMTPServer::Session::run") << exc.displayText();
+        }
+    }
+
+private:
+    /// \brief Handle a command.
+    /// \returns false if the session should end.
+    bool handle(const std::string& line)
+    {
+        std::string verb = Poco::toUpper(line.substr(0, line.find(' ')));
+        std::string argument = line.size() > verb.size() ? line.substr(verb.size() + 1) : "";
+
+        FakeSMTPServer::Fault fault;
+
+        if (_server.takeFault(verb, argument, fault))
+        {
+            if (FakeSMTPServer::Fault::DELAY == fault.type)
+            {
+                inject(fault, verb);
+            }
+            else
+            {
+                // The chunk is sent right after the command.
+                if (verb == "BDAT" && !readBytes(chunkSize(argument)))
+                    return false;
+
+                return inject(fault, verb);
+            }
+        }
+
+        if (verb == "EHLO")
+        {
+            std::string response = "250-localhost\r\n"
+                                   "250-PIPELINING\r\n"
+                                   "250-8BITMIME\r\n"
+                                   "250-CHUNKING\r\n"
+                                   "250-BINARYMIME\r\n";
+
+            if (ofxSMTP::Settings::STARTTLS == _server._encryption && !_isSecure)
+                response += "250-STARTTLS\r\n";
+
+            reply(response + "250 AUTH PLAIN LOGIN");
+            resetTransaction();
+        }
+        else if (verb == "HELO")
+        {
+            reply("250 localhost");
+            resetTransaction();
+        }
+        else if (verb == "STARTTLS")
+        {
+            if (ofxSMTP::Settings::STARTTLS != _server._encryption || _isSecure)
+            {
+                reply("502 5.5.1 STARTTLS not available");
+                return true;
+            }
+
+            reply("220 2.0.0 Ready to start TLS");
+
+            _socket = Poco::Net::SecureStreamSocket::attach(_socket, _server._pContext);
+            _isSecure = true;
+            resetTransaction();
+        }
+        else if (verb == "AUTH")
+        {
+            std::string mechanism = Poco::toUpper(argument.substr(0, argument.find(' ')));
+            std::string response;
+
+            if (mechanism == "LOGIN")
+            {
+                reply("334 VXNlcm5hbWU6");
+
+                if (!readLine(response))
+                    return false;
+
+                reply("334 UGFzc3dvcmQ6");
+
+                if (!readLine(response))
+                    return false;
+            }
+            else if (mechanism == "PLAIN" && argument.find(' ') == std::string::npos)
+            {
+                reply("334 ");
+
+                if (!readLine(response))
+                    return false;
+            }
+            else if (mechanism != "PLAIN")
+            {
+                reply("504 5.5.4 Unrecognized authentication type");
+                return true;
+            }
+
+            // Any credentials are accepted.
+            reply("235 2.7.0 Authentication successful");
+        }
+        else if (verb == "MAIL")
+        {
+            if (_hasTransaction)
+            {
+                reply("503 5.5.1 Nested MAIL command");
+                return true;
+            }
+
+            _hasTransaction = true;
+            reply("250 2.1.0 Ok");
+        }
+        else if (verb == "RCPT")
+        {
+            if (!_hasTransaction)
+            {
+                reply("503 5.5.1 Need MAIL command");
+                return true;
+            }
+
+            ++_recipients;
+            reply("250 2.1.5 Ok");
+        }
+        else if (verb == "DATA")
+        {
+            if (_recipients == 0)
+            {
+                reply("503 5.5.1 Need RCPT command");
+                return true;
+            }
+
+            reply("354 End data with <CR><LF>.<CR><LF>");
+
+            uint64_t size = 0;
+
+            if (!readData(size))
+                return false;
+
+            return complete(size);
+        }
+        else if (verb == "BDAT")
+        {
+            uint64_t size = chunkSize(argument);
+
+            // The chunk is sent right after the command and must be read
+            // even if the transaction is invalid.
+            if (!readBytes(size))
+                return false;
+
+            if (_recipients == 0)
+            {
+                reply("503 5.5.1 Need RCPT command");
+                return true;
+            }
+
+            _chunkBytes += size;
+
+            if (Poco::toUpper(argument).find("LAST") != std::string::npos)
+            {
+                return complete(_chunkBytes);
+            }
+            else
+            {
+                reply("250 2.0.0 Ok: " + std::to_string(size) + " octets received");
+            }
+        }
+        else if (verb == "RSET")
+        {
+            resetTransaction();
+            reply("250 2.0.0 Ok");
+        }
+        else if (verb == "NOOP")
+        {
+            reply("250 2.0.0 Ok");
+        }
+        else if (verb == "QUIT")
+        {
+            reply("221 2.0.0 Bye");
+            return false;
+        }
+        else
+        {
+            reply("500 5.5.2 Unknown command");
+        }
+
+        return true;
+    }
+
+    /// \brief Inject a Fault instead of handling a command.
+    /// \returns false if the session should end.
+    bool inject(const FakeSMTPServer::Fault& fault, const std::string& command)
+    {
+        switch (fault.type)
+        {
+            case FakeSMTPServer::Fault::REPLY:
+            case FakeSMTPServer::Fault::GREYLIST:
+                reply(std::to_string(fault.code) + " " + fault.text);
+                return fault.code != 421;
+            case FakeSMTPServer::Fault::RESET:
+                if (command == "DATA")
+                {
+                    // Let the client start sending the content.
+                    reply("354 End data with <CR><LF>.<CR><LF>");
+                    fill();
+                }
+
+                abort();
+                return false;
+            case FakeSMTPServer::Fault::TLS_FAILURE:
+                // Answer the client hello with something else. An SSLTLS
+                // connection is just reset before its handshake.
+                if (command == "STARTTLS")
+                {
+                    reply("220 2.0.0 Ready to start TLS");
+                    reply("HTTP/1.1 400 Bad Request");
+                }
+
+                abort();
+                return false;
+            case FakeSMTPServer::Fault::DELAY:
+                std::this_thread::sleep_for(std::chrono::microseconds(fault.duration.totalMicroseconds()));
+                return true;
+        }
+
+        return true;
+    }
+
+    /// \brief Finish receiving a message, unless a Fault is injected.
+    /// \returns false if the session should end.
+    bool complete(uint64_t size)
+    {
+        FakeSMTPServer::Fault fault;
+
+        if (_server.takeFault(".", "", fault))
+        {
+            if (!inject(fault, "."))
+                return false;
+
+            if (fault.type != FakeSMTPServer::Fault::DELAY)
+            {
+                resetTransaction();
+                return true;
+            }
+        }
+
+        accept(size);
+        return true;
+    }
+
+    /// \brief Reset the connection.
+    void abort()
+    {
+        _socket.setLinger(true, 0);
+        _socket.close();
+    }
+
+    /// \returns the chunk size of a BDAT command.
+    static uint64_t chunkSize(const std::string& argument)
+    {
+        std::istringstream parameters(argument);
+        uint64_t size = 0;
+        parameters >> size;
+        return size;
+    }
+
+    /// \brief Count a received message and end the transaction.
+    void accept(uint64_t size)
+    {
+        static std::atomic<uint64_t> queueId(0);
+
+        ++_server._messages;
+        _server._recipients += _recipients;
+        _server._bytes += size;
+
+        resetTransaction();
+
+        std::ostringstream response;
+        response << "250 2.0.0 Ok: queued as " << std::hex << std::uppercase << ++queueId;
+        reply(response.str());
+    }
+
+    void resetTransaction()
+    {
+        _hasTransaction = false;
+        _recipients = 0;
+        _chunkBytes = 0;
+    }
+
+    /// \brief Send a reply, after the configured latency.
+    void reply(const std::string& text)
+    {
+        if (_server._replyLatency.totalMicroseconds() > 0)
+            std::this_thread::sleep_for(std::chrono::microseconds(_server._replyLatency.totalMicroseconds()));
+
+        std::string data = text + "\r\n";
+        const char* p = data.data();
+        std::size_t size = data.size();
+
+        while (size > 0)
+        {
+            int sent = _socket.sendBytes(p, int(size));
+
+            if (sent <= 0)
+                throw Poco::Net::NetException("Unable to write reply");
+
+            p += sent;
+            size -= std::size_t(sent);
+        }
+    }
+
+    /// \brief Read more data into the buffer.
+    /// \returns false if the client disconnected.
+    bool fill()
+    {
+        if (_position > 0)
+        {
+            _buffer.erase(0, _position);
+            _position = 0;
+        }
+
+        char data[64 * 1024];
+        int received = _socket.receiveBytes(data, int(sizeof(data)));
+
+        if (received <= 0)
+            return false;
+
+        _buffer.append(data, std::size_t(received));
+        return true;
+    }
+
+    /// \brief Read a command line without its CRLF.
+    bool readLine(std::string& line)
+    {
+        while (true)
+        {
+            std::size_t end = _buffer.find("\r\n", _position);
+
+            if (end != std::string::npos)
+            {
+                line = _buffer.substr(_position, end - _position);
+                _position = end + 2;
+                return true;
+            }
+
+            if (!fill())
+                return false;
+        }
+    }
+
+    /// \brief Read DATA content up to and including the final dot.
+    /// \param size Set to the size of the content.
+    bool readData(uint64_t& size)
+    {
+        size = 0;
+
+        // The content follows the line break of the DATA command, so empty
+        // content is just the final dot.
+        bool isFirst = true;
+
+        while (true)
+        {
+            if (isFirst && _buffer.size() - _position >= 3)
+            {
+                if (_buffer.compare(_position, 3, ".\r\n") == 0)
+                {
+                    _position += 3;
+                    return true;
+                }
+
+                isFirst = false;
+            }
+
+            if (!isFirst)
+            {
+                std::size_t end = _buffer.find("\r\n.\r\n", _position);
+
+                if (end != std::string::npos)
+                {
+                    size += end + 2 - _position;
+                    _position = end + 5;
+                    return true;
+                }
+
+                // Keep what may be the start of the terminator.
+                if (_buffer.size() - _position > 4)
+                {
+                    size += _buffer.size() - 4 - _position;
+                    _position = _buffer.size() - 4;
+                }
+            }
+
+            if (!fill())
+                return false;
+        }
+    }
+
+    /// \brief Read and discard a number of bytes.
+    bool readBytes(uint64_t size)
+    {
+        while (true)
+        {
+            uint64_t available = _buffer.size() - _position;
+
+            if (available >= size)
+            {
+                _position += std::size_t(size);
+                return true;
+            }
+
+            size -= available;
+            _position = _buffer.size();
+
+            if (!fill())
+                return false;
+        }
+    }
+
+    FakeSMTPServer& _server;
+    Poco::Net::StreamSocket _socket;
+    std::string _buffer;
+    std::size_t _position = 0;
+    bool _isSecure = false;
+    bool _hasTransaction = false;
+    uint64_t _recipients = 0;
+    uint64_t _chunkBytes = 0;
+
+};
+
+
+/// \brief Creates a Session for each accepted connection.
+class FakeSMTPServer::SessionFactory: public Poco::Net::TCPServerConnectionFactory
+{
+public:
+    SessionFactory(FakeSMTPServer& server): _server(server)
+    {
+    }
+
+    Poco::Net::TCPServerConnection* createConnection(const Poco::Net::StreamSocket& socket) override
+    {
+        return new Session(socket, _server);
+    }
+
+private:
+    FakeSMTPServer& _server;
+
+};
+
+
+FakeSMTPServer::FakeSMTPServer():
+    _messages(0),
+    _recipients(0),
+    _bytes(0),
+    _connections(0)
+{
+}
+
+
+FakeSMTPServer::~FakeSMTPServer()
+{
+    stop();
+}
+
+
+void FakeSMTPServer::start(ofxSMTP::Settings::EncryptionType encryption,
+                           const Poco::Timespan& replyLatency,
+                           uint16_t port)
+{
+    stop();
+
+    _encryption = encryption;
+    _replyLatency = replyLatency;
+
+    if (ofxSMTP::Settings::NONE != encryption && !_pContext)
+    {
+        _pContext = new Poco::Net::Context(Poco::Net::Context::SERVER_USE,
+                                           ofToDataPath("ssl/fake-server.key", true),
+                                           ofToDataPath("ssl/cacert.pem", true),
+                                           "",
+                                           Poco::Net::Context::VERIFY_NONE);
+
+        // Let clients resume their sessions.
+        _pContext->enableSessionCache(true, "ofxSMTP-fake-server");
+    }
+
+    Poco::Net::SocketAddress address("127.0.0.1", port);
+    Poco::Net::ServerSocket socket;
+
+    if (ofxSMTP::Settings::SSLTLS == encryption)
+    {
+        socket = Poco::Net::SecureServerSocket(address, 64, _pContext);
+    }
+    else
+    {
+        socket = Poco::Net::ServerSocket(address, 64);
+    }
+
+    Poco::Net::TCPServerParams::Ptr pParams = new Poco::Net::TCPServerParams();
+    pParams->setMaxQueued(64);
+
+    _server.reset(new Poco::Net::TCPServer(new SessionFactory(*this), socket, pParams));
+    _server->start();
+    _port = _server->port();
+
+    ofLogNotice("FakeSMTPServer::start") << "Listening on 127.0.0.1:" << _port << ".";
+}
+
+
+void FakeSMTPServer::stop()
+{
+    if (!_server)
+        return;
+
+    _server->stop();
+
+    // Sessions use this server, wait for their clients to disconnect.
+    for (int i = 0; i < 500 && _server->currentConnections() > 0; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    _server.reset();
+}
+
+
+uint16_t FakeSMTPServer::port() const
+{
+    return _port;
+}
+
+
+uint64_t FakeSMTPServer::messages() const
+{
+    return _messages;
+}
+
+
+uint64_t FakeSMTPServer::recipients() const
+{
+    return _recipients;
+}
+
+
+uint64_t FakeSMTPServer::bytes() const
+{
+    return _bytes;
+}
+
+
+uint64_t FakeSMTPServer::connections() const
+{
+    return _connections;
+}
+
+
+FakeSMTPServer::Fault FakeSMTPServer::Fault::reply(const std::string& command,
+                                                   int code,
+                                                   const std::string& text,
+                                                   std::size_t count)
+{
+    Fault fault;
+    fault.type = REPLY;
+    fault.command = command;
+    fault.code = code;
+    fault.text = text;
+    fault.count = count;
+    return fault;
+}
+
+
+FakeSMTPServer::Fault FakeSMTPServer::Fault::reset(const std::string& command,
+                                                   std::size_t count)
+{
+    Fault fault;
+    fault.type = RESET;
+    fault.command = command;
+    fault.count = count;
+    return fault;
+}
+
+
+FakeSMTPServer::Fault FakeSMTPServer::Fault::delay(const std::string& command,
+                                                   const Poco::Timespan& delay,
+                                                   std::size_t count)
+{
+    Fault fault;
+    fault.type = DELAY;
+    fault.command = command;
+    fault.duration = delay;
+    fault.count = count;
+    return fault;
+}
+
+
+FakeSMTPServer::Fault FakeSMTPServer::Fault::tlsFailure(const std::string& command,
+                                                        std::size_t count)
+{
+    Fault fault;
+    fault.type = TLS_FAILURE;
+    fault.command = command;
+    fault.count = count;
+    return fault;
+}
+
+
+FakeSMTPServer::Fault FakeSMTPServer::Fault::greylist(const Poco::Timespan& period)
+{
+    Fault fault;
+    fault.type = GREYLIST;
+    fault.command = "RCPT";
+    fault.code = 451;
+    fault.text = "4.7.1 Greylisted, please try again later";
+    fault.duration = period;
+    return fault;
+}
+
+
+void FakeSMTPServer::addFault(const Fault& fault)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    ScriptedFault scripted;
+    scripted.fault = fault;
+    _faults.push_back(scripted);
+}
+
+
+void FakeSMTPServer::clearFaults()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _faults.clear();
+}
+
+
+uint64_t FakeSMTPServer::faults() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _faultsInjected;
+}
+
+
+FakeSMTPServer::Clock::time_point FakeSMTPServer::lastFault() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _lastFault;
+}
+
+
+bool FakeSMTPServer::takeFault(const std::string& command,
+                               const std::string& argument,
+                               Fault& fault)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    auto now = Clock::now();
+
+    for (auto& scripted: _faults)
+    {
+        if (scripted.fault.command != command)
+            continue;
+
+        if (scripted.fault.count > 0 && scripted.injected >= scripted.fault.count)
+            continue;
+
+        if (Fault::GREYLIST == scripted.fault.type)
+        {
+            // Only the recipient address, not its parameters.
+            std::string recipient = Poco::toLower(argument.substr(0, argument.find('>')));
+            auto firstSeen = scripted.firstSeen.insert(std::make_pair(recipient, now)).first->second;
+
+            if (now - firstSeen >= std::chrono::microseconds(scripted.fault.duration.totalMicroseconds()))
+                continue;
+        }
+
+        ++scripted.injected;
+        ++_faultsInjected;
+        _lastFault = now;
+        fault = scripted.fault;
+        return true;
+    }
+
+    return false;
+}
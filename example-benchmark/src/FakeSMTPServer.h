@@ -0,0 +1,219 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Poco/Timespan.h"
+#include "Poco/Net/Context.h"
+#include "Poco/Net/TCPServer.h"
+#include "ofxSMTP.h"
+
+
+/// \brief An in-process ESMTP server that accepts and discards mail.
+///
+/// The server listens on the loopback interface and speaks enough ESMTP for
+/// ofxSMTP::Client: EHLO with PIPELINING, 8BITMIME, CHUNKING and
+/// BINARYMIME, STARTTLS, AUTH PLAIN and LOGIN with any credentials, MAIL,
+/// RCPT, DATA, BDAT, RSET, NOOP and QUIT.
+///
+/// For SSLTLS and STARTTLS it uses the self-signed certificate in
+/// data/ssl/cacert.pem and data/ssl/fake-server.key. The certificate is for
+/// "localhost" and is also the client's CA file, so the client verifies it.
+///
+/// Every reply can be delayed to simulate a distant server, and Faults can
+/// be scripted to test how the client copes with a misbehaving relay.
+///
+/// \warning The key is published with this example. Never use it for
+/// anything but loopback testing.
+class FakeSMTPServer
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    /// \brief A misbehaviour of the server.
+    ///
+    /// A Fault is injected when the client sends its command. The command
+    /// "CONNECT" stands for the greeting and "." for the end of the content
+    /// of DATA or BDAT LAST.
+    struct Fault
+    {
+        enum Type
+        {
+            /// \brief Reply with code and text instead of the usual reply.
+            ///
+            /// 421 also closes the connection.
+            REPLY,
+            /// \brief Reset the connection without replying.
+            ///
+            /// At DATA the content is started before the reset.
+            RESET,
+            /// \brief Wait for duration before the usual reply.
+            DELAY,
+            /// \brief Break the TLS handshake of STARTTLS or of an SSLTLS
+            ///        connection at "CONNECT".
+            TLS_FAILURE,
+            /// \brief Refuse each recipient with code and text until
+            ///        duration has passed since it was first seen.
+            GREYLIST
+        };
+
+        /// \returns a Fault replying with code and text.
+        static Fault reply(const std::string& command,
+                           int code,
+                           const std::string& text,
+                           std::size_t count = 0);
+
+        /// \returns a Fault resetting the connection.
+        static Fault reset(const std::string& command, std::size_t count = 0);
+
+        /// \returns a Fault delaying the reply.
+        static Fault delay(const std::string& command,
+                           const Poco::Timespan& delay,
+                           std::size_t count = 0);
+
+        /// \returns a Fault breaking the TLS handshake.
+        static Fault tlsFailure(const std::string& command, std::size_t count = 0);
+
+        /// \returns a Fault greylisting recipients for a period.
+        static Fault greylist(const Poco::Timespan& period);
+
+        /// \brief What the server does.
+        Type type = REPLY;
+
+        /// \brief The command the Fault is injected at, e.g. "MAIL".
+        std::string command;
+
+        /// \brief The reply code of REPLY and GREYLIST.
+        int code = 451;
+
+        /// \brief The reply text of REPLY and GREYLIST.
+        std::string text = "4.3.0 Injected fault";
+
+        /// \brief The delay of DELAY and the period of GREYLIST.
+        Poco::Timespan duration;
+
+        /// \brief The number of times to inject the Fault, or 0 for no limit.
+        std::size_t count = 0;
+    };
+
+    /// \brief Create a stopped server.
+    FakeSMTPServer();
+
+    /// \brief Stop and destroy the server.
+    ~FakeSMTPServer();
+
+    /// \brief Start listening on a loopback port.
+    /// \param encryption How connections are secured.
+    /// \param replyLatency The delay before each reply.
+    /// \param port The port, or 0 to pick a free one.
+    void start(ofxSMTP::Settings::EncryptionType encryption,
+               const Poco::Timespan& replyLatency = 0,
+               uint16_t port = 0);
+
+    /// \brief Stop listening.
+    ///
+    /// Open sessions end when their client disconnects.
+    void stop();
+
+    /// \returns the port the server listens on.
+    uint16_t port() const;
+
+    /// \returns the number of messages accepted.
+    uint64_t messages() const;
+
+    /// \returns the number of recipients accepted.
+    uint64_t recipients() const;
+
+    /// \returns the number of message content bytes received.
+    uint64_t bytes() const;
+
+    /// \returns the number of connections accepted.
+    uint64_t connections() const;
+
+    /// \brief Add a Fault to the script.
+    ///
+    /// Faults are matched in the order they were added. Faults can be added
+    /// while the server runs.
+    ///
+    /// \param fault The Fault.
+    void addFault(const Fault& fault);
+
+    /// \brief Remove all Faults and forget greylisted recipients.
+    void clearFaults();
+
+    /// \returns the number of Faults injected.
+    uint64_t faults() const;
+
+    /// \returns the time the last Fault was injected.
+    Clock::time_point lastFault() const;
+
+private:
+    class Session;
+    class SessionFactory;
+
+    /// \brief A scripted Fault and what it has done so far.
+    struct ScriptedFault
+    {
+        Fault fault;
+
+        /// \brief The number of times the Fault was injected.
+        std::size_t injected = 0;
+
+        /// \brief When each greylisted recipient was first seen.
+        std::map<std::string, Clock::time_point> firstSeen;
+    };
+
+    /// \brief Find the Fault to inject at a command.
+    /// \param command The command verb.
+    /// \param argument The rest of the command line.
+    /// \param fault Set to the Fault to inject.
+    /// \returns true if a Fault must be injected.
+    bool takeFault(const std::string& command,
+                   const std::string& argument,
+                   Fault& fault);
+
+    /// \brief How connections are secured.
+    ofxSMTP::Settings::EncryptionType _encryption = ofxSMTP::Settings::NONE;
+
+    /// \brief The delay before each reply.
+    Poco::Timespan _replyLatency;
+
+    /// \brief The TLS context of the server.
+    Poco::Net::Context::Ptr _pContext;
+
+    /// \brief The listening server, or nullptr if stopped.
+    std::unique_ptr<Poco::Net::TCPServer> _server;
+
+    /// \brief The port the server listens on.
+    uint16_t _port = 0;
+
+    std::atomic<uint64_t> _messages;
+    std::atomic<uint64_t> _recipients;
+    std::atomic<uint64_t> _bytes;
+    std::atomic<uint64_t> _connections;
+
+    /// \brief The fault script.
+    std::vector<ScriptedFault> _faults;
+
+    /// \brief The number of Faults injected.
+    uint64_t _faultsInjected = 0;
+
+    /// \brief The time the last Fault was injected.
+    Clock::time_point _lastFault;
+
+    /// \brief Protects the fault script.
+    mutable std::mutex _mutex;
+
+};
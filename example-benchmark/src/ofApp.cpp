@@ -0,0 +1,566 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofApp.h"
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include "Poco/Base64Encoder.h"
+#include "Poco/Net/MailStream.h"
+
+
+namespace {
+
+
+/// \brief A delivery benchmark configuration.
+struct Scenario
+{
+    ofxSMTP::Settings::EncryptionType encryption;
+    std::size_t messageSize;
+    std::size_t recipients;
+    std::size_t connections;
+    bool preRender;
+    std::size_t messages;
+};
+
+
+/// \returns a short description of a scenario.
+std::string toString(const Scenario& scenario)
+{
+    std::string encryption = "NONE";
+
+    if (ofxSMTP::Settings::SSLTLS == scenario.encryption)
+        encryption = "SSLTLS";
+    else if (ofxSMTP::Settings::STARTTLS == scenario.encryption)
+        encryption = "STARTTLS";
+
+    return encryption
+        + ", " + ofToString(scenario.messageSize / 1024) + " KB"
+        + ", " + ofToString(scenario.recipients) + " rcpt"
+        + ", " + ofToString(scenario.connections) + " conn"
+        + (scenario.preRender ? ", pre-rendered" : "");
+}
+
+
+/// \brief A fault and what is expected of the client.
+struct FaultScenario
+{
+    std::string name;
+    ofxSMTP::Settings::EncryptionType encryption;
+    FakeSMTPServer::Fault fault;
+    /// \brief The number of messages expected to fail.
+    std::size_t failures;
+    /// \brief The longest time to get back to full speed.
+    Poco::Timespan maxRecoveryTime;
+    /// \brief The lowest throughput, as a fraction of the baseline.
+    double minThroughput;
+};
+
+
+/// \brief The outcome of sending a batch of messages.
+struct Load
+{
+    double seconds = 0;
+    std::size_t failed = 0;
+    bool isComplete = false;
+    std::vector<FakeSMTPServer::Clock::time_point> deliveries;
+};
+
+
+/// \brief Send small messages to a FakeSMTPServer and wait for them.
+Load sendLoad(const FakeSMTPServer& server,
+              ofxSMTP::Settings::EncryptionType encryption,
+              std::size_t messages)
+{
+    ofxSMTP::Settings settings("localhost",
+                               server.port(),
+                               ofxSMTP::Credentials("benchmark", "benchmark", Poco::Net::SMTPClientSession::AUTH_PLAIN),
+                               encryption,
+                               Poco::Timespan(10, 0));
+
+    settings.setSendRate(0);
+    settings.setMaxConnections(2);
+    settings.setOutboxCapacity(0);
+    settings.setRetryDelay(Poco::Timespan(0, 250000));
+    settings.setMaxRetryDelay(Poco::Timespan(2, 0));
+    settings.setMaxAttempts(20);
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::size_t remaining = messages;
+    Load load;
+
+    std::unique_ptr<ofxSMTP::Client> client(new ofxSMTP::Client());
+    client->setup(settings);
+
+    ofEventListener resultListener = client->events.onSMTPResult.newListener([&](const ofxSMTP::DeliveryResultArgs& args) {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        if (ofxSMTP::DeliveryResultArgs::DELIVERED == args.outcome())
+            load.deliveries.push_back(FakeSMTPServer::Clock::now());
+        else
+            ++load.failed;
+
+        remaining -= std::min(remaining, std::size_t(1));
+        condition.notify_all();
+    });
+
+    std::string body(1024, 'x');
+
+    uint64_t start = ofGetElapsedTimeMicros();
+
+    for (std::size_t i = 0; i < messages; ++i)
+    {
+        // Greylisting is per recipient.
+        auto message = std::make_shared<Poco::Net::MailMessage>();
+        message->setSender("benchmark@localhost");
+        message->addRecipient(Poco::Net::MailRecipient(Poco::Net::MailRecipient::PRIMARY_RECIPIENT,
+                                                       "recipient-" + ofToString(i % 100) + "@localhost"));
+        message->setSubject("Fault " + ofToString(i));
+        message->setContent(body, Poco::Net::MailMessage::ENCODING_8BIT);
+        client->send(message);
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        load.isComplete = condition.wait_for(lock, std::chrono::seconds(120), [&]() { return remaining == 0; });
+    }
+
+    load.seconds = double(ofGetElapsedTimeMicros() - start) / 1000000;
+
+    resultListener.unsubscribe();
+    client.reset();
+
+    std::sort(load.deliveries.begin(), load.deliveries.end());
+    return load;
+}
+
+
+/// \brief Find when deliveries got back to a rate after a fault.
+/// \param deliveries The sorted delivery times.
+/// \param fault The time of the last fault.
+/// \param rate The full speed in messages per second.
+/// \param recovery Set to the time from the fault until the rate is reached.
+/// \returns false if the rate was not reached again.
+bool findRecovery(const std::vector<FakeSMTPServer::Clock::time_point>& deliveries,
+                  FakeSMTPServer::Clock::time_point fault,
+                  double rate,
+                  FakeSMTPServer::Clock::duration& recovery)
+{
+    // Allow for the jitter of a short window.
+    const std::size_t window = 50;
+    std::chrono::duration<double> expected(window / (0.8 * rate));
+
+    auto first = std::lower_bound(deliveries.begin(), deliveries.end(), fault);
+
+    for (auto iter = first; deliveries.end() - iter > std::ptrdiff_t(window); ++iter)
+    {
+        if (*(iter + window) - *iter <= expected)
+        {
+            recovery = *iter - fault;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+} // namespace
+
+
+void ofApp::setup()
+{
+    ofSetLogLevel(OF_LOG_NOTICE);
+}
+
+
+void ofApp::draw()
+{
+    ofBackground(80);
+
+    std::stringstream ss;
+    ss << "Press <b> to benchmark base64 encoding." << std::endl;
+    ss << "Press <d> to benchmark dot-stuffing." << std::endl;
+    ss << "Press <s> to benchmark delivery to a loopback server." << std::endl;
+    ss << "Press <f> to test recovery from server faults." << std::endl;
+    ss << "Press <l> to toggle the server reply latency (";
+    ss << replyLatency.totalMilliseconds() << " ms)." << std::endl;
+    ss << std::endl;
+
+    for (const auto& result: results)
+        ss << result << std::endl;
+
+    ofDrawBitmapStringHighlight(ss.str(), 10, 20);
+}
+
+
+void ofApp::keyPressed(int key)
+{
+    if (key == 'b')
+    {
+        benchmarkBase64();
+    }
+    else if (key == 'd')
+    {
+        benchmarkDotStuffing();
+    }
+    else if (key == 's')
+    {
+        benchmarkDelivery();
+    }
+    else if (key == 'f')
+    {
+        benchmarkFaults();
+    }
+    else if (key == 'l')
+    {
+        // A few milliseconds is typical of a relay in the same region.
+        replyLatency = replyLatency.totalMicroseconds() > 0 ? 0 : Poco::Timespan(0, 2000);
+    }
+}
+
+
+void ofApp::benchmarkBase64()
+{
+    results.clear();
+
+    // Random data does not compress and resembles image and PDF content.
+    const std::size_t size = 32 * 1024 * 1024;
+    const int iterations = 4;
+
+    std::string data(size, '\0');
+
+    for (auto& c: data)
+        c = char(ofRandom(256));
+
+    // Encode as Poco::Net::MailMessage does for ENCODING_BASE64 parts.
+    std::string expected;
+
+    uint64_t start = ofGetElapsedTimeMicros();
+
+    for (int i = 0; i < iterations; ++i)
+    {
+        std::ostringstream stream;
+        Poco::Base64Encoder encoder(stream);
+        encoder.write(data.data(), std::streamsize(data.size()));
+        encoder.close();
+        expected = stream.str();
+    }
+
+    uint64_t elapsed = ofGetElapsedTimeMicros() - start;
+
+    double megabytes = double(size * iterations) / (1024 * 1024);
+
+    results.push_back("Poco::Base64Encoder: " + ofToString(megabytes * 1000000 / elapsed, 1) + " MB/s");
+
+    for (auto implementation: { ofxSMTP::Base64::SCALAR,
+                                ofxSMTP::Base64::SSSE3,
+                                ofxSMTP::Base64::AVX2 })
+    {
+        std::string name = ofxSMTP::Base64::toString(implementation);
+
+        if (!ofxSMTP::Base64::isSupported(implementation))
+        {
+            results.push_back(name + ": not supported");
+            continue;
+        }
+
+        std::string encoded;
+
+        start = ofGetElapsedTimeMicros();
+
+        for (int i = 0; i < iterations; ++i)
+        {
+            encoded.clear();
+            ofxSMTP::Base64::encode(data.data(), data.size(), encoded, implementation);
+        }
+
+        elapsed = ofGetElapsedTimeMicros() - start;
+
+        results.push_back(name + ": " + ofToString(megabytes * 1000000 / elapsed, 1) + " MB/s"
+                          + (encoded == expected ? "" : " (OUTPUT MISMATCH)"));
+    }
+
+    for (const auto& result: results)
+        ofLogNotice("ofApp::benchmarkBase64") << result;
+}
+
+
+void ofApp::benchmarkDotStuffing()
+{
+    results.clear();
+
+    // A plain text log digest with bare LF line endings and a few lines
+    // beginning with '.'.
+    std::string data;
+
+    for (int i = 0; i < 500000; ++i)
+    {
+        data += ofGetTimestampString("%Y-%m-%d %H:%M:%S") + " INFO worker " + ofToString(i % 16) + " processed a request\n";
+
+        if (i % 100 == 0)
+            data += ".\n";
+    }
+
+    const int iterations = 4;
+
+    double megabytes = double(data.size() * iterations) / (1024 * 1024);
+
+    std::string expected;
+
+    uint64_t start = ofGetElapsedTimeMicros();
+
+    for (int i = 0; i < iterations; ++i)
+    {
+        std::ostringstream stream;
+        Poco::Net::MailOutputStream mailStream(stream);
+        mailStream.write(data.data(), std::streamsize(data.size()));
+        mailStream.close();
+        expected = stream.str();
+    }
+
+    uint64_t elapsed = ofGetElapsedTimeMicros() - start;
+
+    results.push_back("Poco::Net::MailOutputStream: " + ofToString(megabytes * 1000000 / elapsed, 1) + " MB/s");
+
+    std::string encoded;
+
+    start = ofGetElapsedTimeMicros();
+
+    for (int i = 0; i < iterations; ++i)
+    {
+        encoded = ofxSMTP::DataEncoder::encode(ofxSMTP::DataEncoder::DOT_STUFFED, data);
+    }
+
+    elapsed = ofGetElapsedTimeMicros() - start;
+
+    results.push_back("ofxSMTP::DataEncoder: " + ofToString(megabytes * 1000000 / elapsed, 1) + " MB/s"
+                      + (encoded == expected ? "" : " (OUTPUT MISMATCH)"));
+
+    for (const auto& result: results)
+        ofLogNotice("ofApp::benchmarkDotStuffing") << result;
+}
+
+
+void ofApp::benchmarkDelivery()
+{
+    results.clear();
+
+    std::vector<Scenario> scenarios = {
+        // Encryption.
+        { ofxSMTP::Settings::NONE, 4096, 1, 1, true, 500 },
+        { ofxSMTP::Settings::STARTTLS, 4096, 1, 1, true, 500 },
+        { ofxSMTP::Settings::SSLTLS, 4096, 1, 1, true, 500 },
+        // Message size.
+        { ofxSMTP::Settings::NONE, 64 * 1024, 1, 1, true, 200 },
+        { ofxSMTP::Settings::NONE, 1024 * 1024, 1, 1, true, 20 },
+        // Recipients, sent with sendBulk().
+        { ofxSMTP::Settings::NONE, 4096, 10, 1, true, 100 },
+        { ofxSMTP::Settings::NONE, 4096, 100, 1, true, 20 },
+        // Client settings.
+        { ofxSMTP::Settings::NONE, 4096, 1, 4, true, 500 },
+        { ofxSMTP::Settings::SSLTLS, 4096, 1, 4, true, 500 },
+        { ofxSMTP::Settings::NONE, 64 * 1024, 1, 1, false, 200 }
+    };
+
+    results.push_back("Server reply latency: " + ofToString(replyLatency.totalMilliseconds()) + " ms");
+
+    for (const auto& scenario: scenarios)
+    {
+        FakeSMTPServer server;
+        server.start(scenario.encryption, replyLatency);
+
+        ofxSMTP::Settings settings("localhost",
+                                   server.port(),
+                                   ofxSMTP::Credentials("benchmark", "benchmark", Poco::Net::SMTPClientSession::AUTH_PLAIN),
+                                   scenario.encryption);
+
+        settings.setSendRate(0);
+        settings.setMaxConnections(scenario.connections);
+        settings.setPreRenderMessages(scenario.preRender);
+        settings.setOutboxCapacity(0);
+
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::size_t remaining = scenario.messages * scenario.recipients;
+        std::size_t failed = 0;
+
+        std::unique_ptr<ofxSMTP::Client> client(new ofxSMTP::Client());
+        client->setup(settings);
+
+        // Results arrive on the delivery threads.
+        ofEventListener resultListener = client->events.onSMTPResult.newListener([&](const ofxSMTP::DeliveryResultArgs& args) {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            if (ofxSMTP::DeliveryResultArgs::DELIVERED != args.outcome())
+                failed += args.recipients().size();
+
+            remaining -= std::min(remaining, args.recipients().size());
+            condition.notify_all();
+        });
+
+        std::string body(scenario.messageSize, 'x');
+
+        // Wrap the body in 76 character lines.
+        for (std::size_t i = 76; i + 2 < body.size(); i += 78)
+            body.replace(i, 2, "\r\n");
+
+        std::vector<std::string> recipients;
+
+        for (std::size_t i = 0; i < scenario.recipients; ++i)
+            recipients.push_back("recipient-" + ofToString(i) + "@localhost");
+
+        uint64_t start = ofGetElapsedTimeMicros();
+
+        for (std::size_t i = 0; i < scenario.messages; ++i)
+        {
+            auto message = std::make_shared<Poco::Net::MailMessage>();
+            message->setSender("benchmark@localhost");
+            message->setSubject("Benchmark " + ofToString(i));
+            message->setContentType("text/plain; charset=UTF-8");
+            message->setContent(body, Poco::Net::MailMessage::ENCODING_8BIT);
+
+            if (scenario.recipients == 1)
+            {
+                message->addRecipient(Poco::Net::MailRecipient(Poco::Net::MailRecipient::PRIMARY_RECIPIENT,
+                                                               recipients.front()));
+                client->send(message);
+            }
+            else
+            {
+                message->set("To", "undisclosed-recipients:;");
+                client->sendBulk(message, recipients);
+            }
+        }
+
+        bool isComplete = false;
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            isComplete = condition.wait_for(lock, std::chrono::seconds(120), [&]() { return remaining == 0; });
+        }
+
+        uint64_t elapsed = ofGetElapsedTimeMicros() - start;
+
+        const ofxSMTP::Metrics& metrics = client->getMetrics();
+        const ofxSMTP::Histogram& latency = metrics.histogram(ofxSMTP::Metrics::END_TO_END);
+        double seconds = double(elapsed) / 1000000;
+        double megabytes = double(metrics.counter(ofxSMTP::Metrics::BYTES_SENT)) / (1024 * 1024);
+
+        std::string result = toString(scenario) + ": "
+            + ofToString(double(scenario.messages) / seconds, 1) + " msg/s, "
+            + ofToString(megabytes / seconds, 1) + " MB/s, p50 "
+            + ofToString(std::chrono::duration<double, std::milli>(latency.quantile(0.5)).count(), 2) + " ms, p99 "
+            + ofToString(std::chrono::duration<double, std::milli>(latency.quantile(0.99)).count(), 2) + " ms";
+
+        if (!isComplete)
+            result += " (TIMED OUT)";
+
+        if (failed > 0)
+            result += " (" + ofToString(failed) + " FAILED)";
+
+        results.push_back(result);
+
+        // Disconnect before the server stops.
+        resultListener.unsubscribe();
+        client.reset();
+        server.stop();
+    }
+
+    for (const auto& result: results)
+        ofLogNotice("ofApp::benchmarkDelivery") << result;
+}
+
+
+void ofApp::benchmarkFaults()
+{
+    results.clear();
+
+    typedef FakeSMTPServer::Fault Fault;
+
+    std::vector<FaultScenario> scenarios = {
+        // Transient errors are retried on the same connection.
+        { "451 at end of DATA", ofxSMTP::Settings::NONE,
+          Fault::reply(".", 451, "4.3.0 Temporary failure", 20), 0, Poco::Timespan(1, 0), 0.5 },
+        // Permanent errors fail only their own message.
+        { "550 at RCPT", ofxSMTP::Settings::NONE,
+          Fault::reply("RCPT", 550, "5.1.1 No such user", 20), 20, Poco::Timespan(1, 0), 0.5 },
+        // The relay cools down after connection level failures, for 1 s
+        // doubling with each consecutive failure.
+        { "421 at MAIL", ofxSMTP::Settings::NONE,
+          Fault::reply("MAIL", 421, "4.7.0 Too many messages, closing connection", 2), 0, Poco::Timespan(3, 0), 0.2 },
+        { "Reset mid-DATA", ofxSMTP::Settings::NONE,
+          Fault::reset("DATA", 2), 0, Poco::Timespan(3, 0), 0.2 },
+        { "TLS failure at STARTTLS", ofxSMTP::Settings::STARTTLS,
+          Fault::tlsFailure("STARTTLS", 2), 0, Poco::Timespan(3, 0), 0.2 },
+        { "Slow replies", ofxSMTP::Settings::NONE,
+          Fault::delay("MAIL", Poco::Timespan(0, 500000), 10), 0, Poco::Timespan(1, 0), 0.5 },
+        { "Greylisting for 1 s", ofxSMTP::Settings::NONE,
+          Fault::greylist(Poco::Timespan(1, 0)), 0, Poco::Timespan(1, 0), 0.3 }
+    };
+
+    std::size_t failures = 0;
+
+    for (const auto& scenario: scenarios)
+    {
+        FakeSMTPServer server;
+        server.start(scenario.encryption, replyLatency);
+
+        // Full speed, without faults.
+        Load baseline = sendLoad(server, scenario.encryption, 1000);
+        double baselineRate = double(baseline.deliveries.size()) / baseline.seconds;
+
+        // Keep the client busy for a few seconds, well past the faults.
+        std::size_t messages = std::size_t(ofClamp(float(baselineRate * 4), 500, 20000));
+
+        server.addFault(scenario.fault);
+
+        Load load = sendLoad(server, scenario.encryption, messages);
+        double rate = double(messages) / load.seconds;
+
+        FakeSMTPServer::Clock::duration recovery = FakeSMTPServer::Clock::duration::zero();
+        bool hasRecovered = findRecovery(load.deliveries, server.lastFault(), baselineRate, recovery);
+        double recoveryTime = std::chrono::duration<double>(recovery).count();
+
+        std::vector<std::string> errors;
+
+        if (server.faults() == 0)
+            errors.push_back("no fault injected");
+
+        if (!load.isComplete)
+            errors.push_back("timed out");
+
+        if (!hasRecovered)
+            errors.push_back("never recovered");
+        else if (recoveryTime > double(scenario.maxRecoveryTime.totalMicroseconds()) / 1000000)
+            errors.push_back("slow recovery");
+
+        if (rate < baselineRate * scenario.minThroughput)
+            errors.push_back("low throughput");
+
+        if (load.failed != scenario.failures)
+            errors.push_back(ofToString(load.failed) + " failed, expected " + ofToString(scenario.failures));
+
+        if (!errors.empty())
+            ++failures;
+
+        results.push_back(scenario.name + ": " + (errors.empty() ? "PASS" : "FAIL (" + ofJoinString(errors, ", ") + ")"));
+        results.push_back("    " + ofToString(server.faults()) + " fault(s), recovered in "
+                          + ofToString(recoveryTime * 1000, 0) + " ms, "
+                          + ofToString(rate, 1) + " msg/s ("
+                          + ofToString(100 * rate / baselineRate, 0) + "% of "
+                          + ofToString(baselineRate, 1) + " msg/s)");
+
+        server.stop();
+    }
+
+    results.push_back(ofToString(scenarios.size() - failures) + " of " + ofToString(scenarios.size()) + " scenarios passed.");
+
+    for (const auto& result: results)
+        ofLogNotice("ofApp::benchmarkFaults") << result;
+}
@@ -0,0 +1,48 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include "ofMain.h"
+#include "ofxSMTP.h"
+#include "FakeSMTPServer.h"
+
+
+class ofApp: public ofBaseApp
+{
+public:
+    void setup() override;
+    void draw() override;
+    void keyPressed(int key) override;
+
+    /// \brief Compare the attachment encoders with Poco::Base64Encoder.
+    void benchmarkBase64();
+
+    /// \brief Compare the DATA encoder with Poco::Net::MailOutputStream.
+    void benchmarkDotStuffing();
+
+    /// \brief Measure delivery to a loopback FakeSMTPServer.
+    ///
+    /// Each scenario varies one of the encryption, the message size, the
+    /// number of recipients, the number of connections or pre-rendering.
+    void benchmarkDelivery();
+
+    /// \brief Measure recovery from faults injected by a FakeSMTPServer.
+    ///
+    /// Each scenario asserts how soon deliveries are back to full speed
+    /// after the last fault, the overall throughput and the number of
+    /// failed messages.
+    void benchmarkFaults();
+
+    /// \brief The delay before each reply of the fake server.
+    Poco::Timespan replyLatency = 0;
+
+    /// \brief The benchmark results.
+    std::vector<std::string> results;
+
+};
@@ -0,0 +1,87 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <cstddef>
+#include <string>
+
+
+namespace ofx {
+namespace SMTP {
+
+
+/// \brief A base64 encoder for message attachments.
+///
+/// The output is identical to that of Poco::Base64Encoder as used by
+/// Poco::Net::MailMessage: lines of LINE_LENGTH characters separated by CRLF,
+/// without a line break after the last line.
+///
+/// On x86 processors whole lines are encoded with SSSE3 or AVX2 instructions
+/// when the processor supports them. The implementation is chosen at runtime.
+class Base64
+{
+public:
+    /// \brief An encoder implementation.
+    enum Implementation
+    {
+        /// \brief The fastest implementation supported by the processor.
+        AUTO,
+        /// \brief The portable implementation.
+        SCALAR,
+        /// \brief The SSSE3 implementation.
+        SSSE3,
+        /// \brief The AVX2 implementation.
+        AVX2
+    };
+
+    enum
+    {
+        /// \brief The length of an encoded line.
+        LINE_LENGTH = 72,
+
+        /// \brief The number of input bytes encoded on one line.
+        LINE_INPUT_LENGTH = LINE_LENGTH / 4 * 3
+    };
+
+    /// \brief Calculate the size of encoded data.
+    /// \param size The number of input bytes.
+    /// \returns the number of encoded bytes, including line breaks.
+    static std::size_t encodedSize(std::size_t size);
+
+    /// \brief Encode data.
+    ///
+    /// Data may be encoded in several calls as long as every piece but the
+    /// last is a multiple of LINE_INPUT_LENGTH bytes and the caller appends
+    /// CRLF between the pieces.
+    ///
+    /// \param data The data to encode.
+    /// \param size The number of bytes to encode.
+    /// \param output The string the encoded data is appended to.
+    /// \param implementation The implementation to use. Implementations not
+    ///        supported by the processor fall back to SCALAR.
+    static void encode(const char* data,
+                       std::size_t size,
+                       std::string& output,
+                       Implementation implementation = AUTO);
+
+    /// \param implementation The implementation to query.
+    /// \returns true if the processor supports the implementation.
+    static bool isSupported(Implementation implementation);
+
+    /// \returns the implementation used for AUTO.
+    static Implementation defaultImplementation();
+
+    /// \param implementation The implementation.
+    /// \returns the name of the implementation.
+    static std::string toString(Implementation implementation);
+
+};
+
+
+} } // namespace ofx::SMTP
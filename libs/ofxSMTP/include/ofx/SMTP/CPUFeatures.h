@@ -0,0 +1,46 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    /// \brief Defined when x86 vector instructions may be used.
+    #define OFX_SMTP_X86
+    #if defined(_MSC_VER)
+        #define OFX_SMTP_TARGET(name)
+    #else
+        /// \brief Compile a function for an instruction set extension.
+        #define OFX_SMTP_TARGET(name) __attribute__((target(name)))
+    #endif
+#endif
+
+
+namespace ofx {
+namespace SMTP {
+
+
+/// \brief Runtime detection of processor features used by the encoders.
+///
+/// Functions using an extension are compiled with OFX_SMTP_TARGET and must
+/// only be called when the extension is supported.
+class CPUFeatures
+{
+public:
+    /// \returns true if the processor supports SSE2.
+    static bool hasSSE2();
+
+    /// \returns true if the processor supports SSSE3.
+    static bool hasSSSE3();
+
+    /// \returns true if the processor and operating system support AVX2.
+    static bool hasAVX2();
+
+};
+
+
+} } // namespace ofx::SMTP
@@ -11,8 +11,12 @@
 #undef verify // this is for OSX to get around the x509 macro error.
 
 
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 #include <string>
-#include <deque>
+#include <vector>
 #include "Poco/Net/ConsoleCertificateHandler.h"
 #include "Poco/Net/Context.h"
 #include "Poco/Net/KeyConsoleHandler.h"
@@ -23,8 +27,19 @@
 #include "Poco/Net/SSLException.h"
 #include "Poco/Net/SSLManager.h"
 #include "Poco/Net/StreamSocket.h"
+#include "ofx/SMTP/Connection.h"
+#include "ofx/SMTP/DeliveryTicket.h"
+#include "ofx/SMTP/EventQueue.h"
+#include "ofx/SMTP/MessageTemplate.h"
+#include "ofx/SMTP/Outbox.h"
+#include "ofx/SMTP/RelayPool.h"
+#include "ofx/SMTP/Resolver.h"
+#include "ofx/SMTP/RetryScheduler.h"
 #include "ofx/SMTP/Settings.h"
 #include "ofx/SMTP/Events.h"
+#include "ofx/SMTP/Journal.h"
+#include "ofx/SMTP/Spool.h"
+#include "ofx/SMTP/TLSSessionCache.h"
 #include "ofLog.h"
 #include "ofSSLManager.h"
 #include "ofThread.h"
@@ -35,9 +50,41 @@ namespace SMTP {
 
 
 /// \brief An SMTP Client.
-class Client: public ofThread
+///
+/// Messages are queued in a shared Outbox and delivered by a pool of worker
+/// threads, each owning one server Connection. The size of the pool is set
+/// with Settings::setMaxConnections(). Queuing a message never waits for a
+/// worker.
+///
+/// Messages that fail with a transient error are retried with a jittered
+/// exponential backoff until they are delivered or Settings::maxAttempts()
+/// or Settings::maxMessageAge() is reached. The final outcome of every
+/// message is reported by ClientEvents::onSMTPResult.
+///
+/// With a journal directory set, queued messages survive a restart of the
+/// application and are delivered at least once.
+///
+/// Events are notified on the delivery threads by default. To keep slow
+/// listeners from holding up delivery, or to handle events on the main
+/// thread, choose another Settings::EventDispatch.
+class Client
 {
 public:
+    /// \brief The outcome of queuing a message.
+    enum SendResult
+    {
+        /// \brief The message was queued.
+        QUEUED,
+        /// \brief The message was queued after waiting for room.
+        QUEUED_AFTER_BLOCKING,
+        /// \brief The message was queued after dropping older messages.
+        QUEUED_AFTER_DROPPING,
+        /// \brief The message was written to the spool directory.
+        SPILLED,
+        /// \brief The message was not queued.
+        REJECTED
+    };
+
     /// \brief Create an SMTP client.
     Client();
 
@@ -48,27 +95,141 @@ public:
     /// \param settings The SMTP Client configuration.
     void setup(const Settings& settings = Settings());
 
+    /// \brief Setup an SMTP client delivering through several relays.
+    ///
+    /// Connections are spread over the healthy relays by weight, latency
+    /// and error rate. A relay that fails is skipped until its cooldown
+    /// ends, and the message that failed is retried on another relay at
+    /// once. See Settings::setRelayWeight() and Settings::loadAll().
+    ///
+    /// \param relays The relay settings, in failover order. The options
+    ///        that are not specific to a relay, such as the outbox and retry
+    ///        settings, are taken from the first.
+    void setup(const std::vector<Settings>& relays);
+
     void exit(ofEventArgs& args);
 
+    /// \brief Notify a batch of queued events, with Settings::UPDATE_LOOP.
+    void update(ofEventArgs& args);
+
+    /// \brief Notify a batch of queued events on the calling thread.
+    ///
+    /// With Settings::UPDATE_LOOP this is called once per frame. Call it
+    /// yourself in an application without an update loop. The events of a
+    /// batch are notified in the order they happened, then the results are
+    /// notified together by ClientEvents::onSMTPResultBatch.
+    ///
+    /// \returns the number of events notified.
+    std::size_t dispatchEvents();
+
     /// \brief Send a simple message with no attachments.
     /// \param to The recipient address.
     /// \param from The sender address.
     /// \param subject The subject of the message.
     /// \param body The plain text body of the message.
-    void send(const std::string& to,
-              const std::string& from,
-              const std::string& subject,
-              const std::string& body);
+    /// \param priority The priority of the message.
+    /// \returns how the message was queued.
+    SendResult send(const std::string& to,
+                    const std::string& from,
+                    const std::string& subject,
+                    const std::string& body,
+                    Settings::Priority priority = Settings::NORMAL);
 
     /// \brief Send a more complex message with attachments etc.
+    ///
+    /// More urgent messages are delivered ahead of less urgent ones, see
+    /// Settings::setPriorityWeight().
+    ///
+    /// When the outbox is full, the Settings::OverflowPolicy decides what
+    /// happens to the message. Messages dropped to make room, the oldest of
+    /// the least urgent priority first, are reported with onSMTPException.
+    ///
     /// \param message The message to send.
-    void send(std::shared_ptr<Poco::Net::MailMessage> message);
+    /// \param priority The priority of the message.
+    /// \returns how the message was queued.
+    SendResult send(std::shared_ptr<Poco::Net::MailMessage> message,
+                    Settings::Priority priority = Settings::NORMAL);
+
+    /// \brief Send a message and track its outcome.
+    ///
+    /// The message is queued like send() does. The returned ticket
+    /// completes when the message is delivered or given up on, with the
+    /// server's reply, its queue id and the timings. It can be polled,
+    /// waited on or given a continuation, without listening to
+    /// ClientEvents::onSMTPResult.
+    ///
+    /// A message that could not be queued completes its ticket at once as
+    /// DeliveryResultArgs::DROPPED.
+    ///
+    /// \param message The message to send.
+    /// \param priority The priority of the message.
+    /// \returns the ticket of the message.
+    DeliveryTicket sendTracked(std::shared_ptr<Poco::Net::MailMessage> message,
+                               Settings::Priority priority = Settings::NORMAL);
+
+    /// \brief Send the same message to many recipients.
+    ///
+    /// The message is rendered once and sent in as few transactions as
+    /// Settings::maxRecipientsPerMessage() allows, each with many RCPT TO
+    /// commands, instead of once per recipient. The recipients are only
+    /// used for the envelope. They are not written to the message headers,
+    /// so recipients do not see each other.
+    ///
+    /// Recipients refused by the server do not fail the transaction. The
+    /// outcome of each group of recipients is reported by
+    /// ClientEvents::onSMTPResult with DeliveryResultArgs::recipients().
+    /// Recipients refused with a transient error are retried on their own.
+    ///
+    /// \param message The message to send.
+    /// \param recipients The envelope recipient addresses.
+    /// \param priority The priority of the message.
+    /// \returns how the message was queued. If the transactions were queued
+    ///          differently, the least favourable result.
+    SendResult sendBulk(std::shared_ptr<Poco::Net::MailMessage> message,
+                        const std::vector<std::string>& recipients,
+                        Settings::Priority priority = Settings::NORMAL);
+
+    /// \brief Send a personalized message to each of many recipients.
+    ///
+    /// Each recipient gets its own message, rendered from the compiled
+    /// template with its fields. The shared parts of the template are
+    /// encoded once and referenced by every message. The messages reported
+    /// by events only hold the headers.
+    ///
+    /// \param messageTemplate The compiled template.
+    /// \param recipients The recipients and their fields.
+    /// \param priority The priority of the messages.
+    /// \returns how the messages were queued. If they were queued
+    ///          differently, the least favourable result.
+    SendResult sendMerge(const MessageTemplate& messageTemplate,
+                         const std::vector<MessageTemplate::Recipient>& recipients,
+                         Settings::Priority priority = Settings::NORMAL);
 
     /// \brief Get number in the outbox.
-    /// \returns The number of messages queued in the outbox.
+    /// \returns The number of messages queued in the outbox, including
+    ///          messages waiting to be retried.
     std::size_t getOutboxSize() const; 
 
-    /// \returns the current Settings.
+    /// \brief Get the queue depth and wait times of a priority.
+    /// \param priority The priority.
+    /// \returns The state of the priority's lane in the outbox.
+    Outbox::LaneStats getLaneStats(Settings::Priority priority) const;
+
+    /// \brief Get the latency histograms and counters of the client.
+    ///
+    /// Export them with Metrics::toJSON() or Metrics::toPrometheus() to see
+    /// where delivery time goes.
+    ///
+    /// \returns The metrics.
+    const Metrics& getMetrics() const;
+
+    /// \returns The relays and their health, in failover order.
+    const std::vector<std::shared_ptr<Relay>>& getRelays() const;
+
+    /// \returns The number of events waiting to be notified.
+    std::size_t getEventQueueSize() const;
+
+    /// \returns the current Settings, of the first relay.
     Settings settings() const;
     
     /// \brief The event callbacks.
@@ -97,26 +258,172 @@ public:
     }
     
 private:
-    /// \brief Start the thread.
+    class Worker;
+    class Dispatcher;
+
+    /// \brief Start the worker threads if they are not running.
     void start();
 
-    /// \brief The threaded function.
-    void threadedFunction();
+    /// \brief Deliver messages from the outbox until the worker is stopped.
+    /// \param worker The worker running this function.
+    void deliver(Worker& worker);
+
+    /// \brief Schedule a failed message for another attempt.
+    ///
+    /// Messages that reached the maximum attempts or age are finished
+    /// instead.
+    ///
+    /// A message that failed because its relay failed is retried at once if
+    /// another relay is available.
+    ///
+    /// \param entry The failed message. Ignored if empty.
+    /// \param exc The error.
+    /// \param isRelayFailure True if the relay, not the message, failed.
+    void retry(const Outbox::Entry& entry,
+               const Poco::Exception& exc,
+               bool isRelayFailure);
+
+    /// \brief Queue a message.
+    /// \param message The message to send.
+    /// \param priority The priority of the message.
+    /// \param ticket The ticket of the message, if tracked.
+    /// \returns how the message was queued.
+    SendResult post(std::shared_ptr<Poco::Net::MailMessage> message,
+                    Settings::Priority priority,
+                    const DeliveryTicket& ticket);
+
+    /// \brief Report the final outcome of a message and forget it.
+    ///
+    /// Completes the ticket of the message, if tracked.
+    ///
+    /// \param entry The message.
+    /// \param outcome The outcome.
+    /// \param reason The last error, if any.
+    /// \param replyCode The server's reply code, or 0.
+    /// \param reply The server's reply accepting the message, if delivered.
+    /// \param transfer The duration of the last attempt.
+    void finish(const Outbox::Entry& entry,
+                DeliveryResultArgs::Outcome outcome,
+                const std::string& reason = "",
+                int replyCode = 0,
+                const std::string& reply = "",
+                DeliveryResultArgs::Clock::duration transfer = DeliveryResultArgs::Clock::duration::zero());
+
+    /// \brief Report the outcome of a transaction with refused recipients.
+    ///
+    /// Permanently refused recipients are rejected one by one, the accepted
+    /// recipients are delivered and the others are retried together.
+    ///
+    /// \param entry The pre-rendered message that was sent.
+    /// \param rejections The refused recipients, in envelope order.
+    /// \param reply The server's reply accepting the message.
+    /// \param transfer The duration of the transaction.
+    void finishRecipients(const Outbox::Entry& entry,
+                          const std::vector<Connection::Rejection>& rejections,
+                          const Connection::Reply& reply,
+                          DeliveryResultArgs::Clock::duration transfer);
+
+    /// \returns how long a message took so far.
+    static DeliveryResultArgs::Timings timings(const Outbox::Entry& entry,
+                                               DeliveryResultArgs::Clock::duration transfer);
+
+    /// \brief Move the messages due for a retry to the front of the outbox.
+    void promoteRetries();
+
+    /// \brief Sleep until a time or until the worker is stopped.
+    /// \param worker The sleeping worker.
+    /// \param time The time to wake at.
+    void sleepUntil(Worker& worker, RateLimiter::Clock::time_point time);
+
+    /// \brief Wake a worker waiting for messages.
+    void notifyWorker();
+
+    /// \brief Notify events until the dispatcher is stopped.
+    /// \param dispatcher The dispatcher running this function.
+    void dispatch(Dispatcher& dispatcher);
+
+    /// \brief Notify or queue ClientEvents::onSMTPDelivery.
+    /// \param message The delivered message.
+    void notifyDelivery(std::shared_ptr<Poco::Net::MailMessage> message);
+
+    /// \brief Notify or queue ClientEvents::onSMTPException.
+    /// \param args The error.
+    void notifyException(const ErrorArgs& args);
+
+    /// \brief Notify or queue ClientEvents::onSMTPResult.
+    /// \param args The result.
+    void notifyResult(const DeliveryResultArgs& args);
+
+    /// \brief Journal a new message and add it to the outbox.
+    /// \param entry The message to add. Its journal id is set.
+    /// \returns how the message was queued.
+    SendResult submit(Outbox::Entry& entry);
+
+    /// \brief Add a message to the outbox according to the overflow policy.
+    /// \param entry The message to add.
+    /// \returns how the message was queued.
+    SendResult enqueue(const Outbox::Entry& entry);
+
+    /// \brief Take the next message from the outbox or the spool.
+    /// \param entry Set to the message taken.
+    /// \returns false if there are no messages.
+    bool takeNext(Outbox::Entry& entry);
+
+    /// \returns true if a message is waiting in the outbox or the spool.
+    bool hasMessages() const;
 
     /// \brief The current client settings.
     Settings _settings;
 
     /// \brief The message outbox queue.
-    std::deque<std::shared_ptr<Poco::Net::MailMessage>> _outbox;
+    Outbox _outbox;
+
+    /// \brief Messages spilled from a full outbox.
+    Spool _spool;
 
-    /// \brief The current message being sent.
-    std::shared_ptr<Poco::Net::MailMessage> _currentMessage;
+    /// \brief Failed messages waiting to be retried.
+    RetryScheduler _retries;
+
+    /// \brief The write-ahead journal of queued messages.
+    Journal _journal;
+
+    /// \brief The relays, each with its own send rate limiter.
+    RelayPool _relays;
+
+    /// \brief The delivery worker threads.
+    std::vector<std::unique_ptr<Worker>> _workers;
+
+    /// \brief True once the workers have been started.
+    std::atomic<bool> _isStarted;
+
+    /// \brief The mutex protecting the workers and the send condition.
+    ///
+    /// It is never held while a message is delivered.
+    mutable std::mutex _mutex;
 
     /// \brief The send condition.
-    Poco::Event _messageReady;
+    std::condition_variable _messageReady;
+
+    /// \brief The number of workers waiting on the send condition.
+    std::atomic<std::size_t> _waitingWorkers;
+
+    /// \brief TLS sessions to be reused if permitted.
+    TLSSessionCache _tlsSessionCache;
+
+    /// \brief The resolved server addresses.
+    Resolver _resolver;
+
+    /// \brief The latency histograms and counters.
+    Metrics _metrics;
+
+    /// \brief Events waiting to be notified in batches.
+    EventQueue _eventQueue;
+
+    /// \brief The thread notifying queued events, if any.
+    std::unique_ptr<Dispatcher> _dispatcher;
 
-    /// \brief A session pointer to be set and reused if permitted.
-    Poco::Net::Session::Ptr _pSession = nullptr;
+    /// \brief The id of the last DeliveryTicket.
+    std::atomic<uint64_t> _lastTicketId;
 
     /// \brief Is the program initalized via setup?
     bool _isInited = false;
@@ -0,0 +1,325 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#undef verify // this is for OSX to get around the x509 macro error.
+
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Poco/Net/MailMessage.h"
+#include "Poco/Net/NetException.h"
+#include "Poco/Net/SecureSMTPClientSession.h"
+#include "Poco/Net/SecureStreamSocket.h"
+#include "Poco/Net/Session.h"
+#include "Poco/Net/SMTPClientSession.h"
+#include "ofx/SMTP/Metrics.h"
+#include "ofx/SMTP/Resolver.h"
+#include "ofx/SMTP/Settings.h"
+#include "ofx/SMTP/WireMessage.h"
+
+
+namespace ofx {
+namespace SMTP {
+
+
+/// \brief A single SMTP server connection.
+///
+/// A Connection wraps one Poco::Net::SecureSMTPClientSession and knows how to
+/// establish it for each Settings::EncryptionType. A Connection is not thread
+/// safe and is meant to be owned by a single delivery worker.
+class Connection
+{
+public:
+    /// \brief A recipient refused by the server.
+    struct Rejection
+    {
+        /// \brief The recipient address.
+        std::string recipient;
+
+        /// \brief The server's reply to RCPT TO.
+        Poco::Net::SMTPException error;
+    };
+
+    /// \brief A server reply.
+    struct Reply
+    {
+        /// \brief The reply code, or 0 if there was no reply.
+        int code = 0;
+
+        /// \brief The reply, including its code.
+        std::string text;
+    };
+
+    /// \brief Create an unopened connection.
+    /// \param settings The SMTP Client configuration.
+    /// \param resolver The cache of server addresses.
+    /// \param metrics The metrics the session phases are timed in.
+    Connection(const Settings& settings,
+               Resolver& resolver,
+               Metrics& metrics);
+
+    /// \brief Destroy the connection, closing it if needed.
+    ~Connection();
+
+    /// \brief Connect, greet and authenticate with the server.
+    ///
+    /// The server's addresses are raced as described in RFC 8305 ("Happy
+    /// Eyeballs"). A connection to the next address is started whenever the
+    /// previous attempt fails or has not completed within
+    /// Settings::connectionAttemptDelay(), and the first to complete is
+    /// used. An unreachable address costs one attempt delay instead of the
+    /// whole timeout.
+    ///
+    /// For SSLTLS and STARTTLS connections the given TLS session is offered
+    /// to the server for resumption.
+    ///
+    /// \param pSession A TLS session to resume, or nullptr.
+    /// \throws Poco::Exception on failure.
+    void open(Poco::Net::Session::Ptr pSession = nullptr);
+
+    /// \brief Close the connection.
+    ///
+    /// Errors raised while closing are ignored.
+    void close();
+
+    /// \returns true if the connection is open.
+    bool isOpen() const;
+
+    /// \brief Send a message over the open connection.
+    ///
+    /// If the previous transaction failed, the session is reset with RSET
+    /// before the message is sent. If the server advertises PIPELINING
+    /// (RFC 2920), the MAIL FROM and RCPT TO commands are written at once and
+    /// their replies are read back in order. Otherwise each command waits for
+    /// its reply.
+    ///
+    /// If the server advertises CHUNKING (RFC 3030), the content is streamed
+    /// in BDAT chunks as it is generated, avoiding dot-stuffing, and the body
+    /// is declared as BINARYMIME when supported. Otherwise the content is
+    /// dot-stuffed by a DataEncoder and sent with DATA.
+    ///
+    /// \param message The message to send.
+    /// \throws Poco::Exception on failure.
+    void send(const Poco::Net::MailMessage& message);
+
+    /// \brief Send a pre-rendered message over the open connection.
+    ///
+    /// Only the envelope commands and the ready DATA payload are written.
+    ///
+    /// Unlike send(const Poco::Net::MailMessage&), recipients refused by the
+    /// server do not fail the transaction. The message is delivered to the
+    /// recipients that were accepted and the refused ones are returned, so
+    /// that they can be retried or reported with WireMessage::withRecipients().
+    /// If every recipient is refused, no content is sent.
+    ///
+    /// \param message The message to send.
+    /// \returns the refused recipients, in envelope order.
+    /// \throws Poco::Exception on failure, or if the server replies 421 to a
+    ///         recipient.
+    std::vector<Rejection> send(const WireMessage& message);
+
+    /// \returns the server's reply accepting the content of the last message
+    ///          sent, or an empty Reply if it was not accepted.
+    const Reply& lastReply() const;
+
+    /// \brief Reset a reused session with RSET.
+    ///
+    /// If the server has dropped the session, the connection is closed so
+    /// that it can be reopened.
+    ///
+    /// \returns true if the session is still usable.
+    bool reset();
+
+    /// \brief Keep an idle connection alive.
+    ///
+    /// Closes the connection if no transaction was made for longer than
+    /// the Settings::idleTimeout(), otherwise sends a NOOP. NOOPs do not
+    /// extend the idle time. If the server has dropped the session, the
+    /// connection is closed.
+    ///
+    /// \returns true if the connection is still open.
+    bool keepAlive();
+
+    /// \returns the time at which keepAlive() should next be called.
+    std::chrono::steady_clock::time_point nextKeepAlive() const;
+
+    /// \brief Query an ESMTP capability advertised in the EHLO reply.
+    /// \param keyword The capability keyword, e.g. "PIPELINING".
+    /// \returns true if the server advertised the capability.
+    bool hasCapability(const std::string& keyword) const;
+
+    /// \returns the ESMTP capabilities mapped to their parameters.
+    const std::map<std::string, std::string>& capabilities() const;
+
+    /// \returns the TLS session negotiated by the last open() or nullptr.
+    Poco::Net::Session::Ptr tlsSession() const;
+
+    /// \returns true if the last open() resumed a previous TLS session
+    /// instead of performing a full handshake.
+    bool isTLSSessionReused() const;
+
+    /// \returns the connection Settings.
+    Settings settings() const;
+
+private:
+    class ClientSession;
+
+    /// \brief Writes message content as BDAT chunks.
+    class ChunkWriter
+    {
+    public:
+        /// \brief Create a ChunkWriter for an open connection.
+        ChunkWriter(Connection& connection);
+
+        /// \brief Send a chunk.
+        /// \param data The chunk content.
+        /// \param size The chunk size in bytes.
+        /// \param isLast True for the final chunk.
+        /// \throws Poco::Net::SMTPException if a chunk was rejected. No chunk
+        ///         is sent after a rejected one.
+        void write(const char* data, std::size_t size, bool isLast);
+
+        /// \brief Read the outstanding replies.
+        /// \throws Poco::Net::SMTPException if a chunk was rejected.
+        void finish();
+
+    private:
+        /// \brief Read one chunk reply.
+        void receive();
+
+        enum
+        {
+            /// \brief The number of unacknowledged chunks when pipelining.
+            MAX_CHUNKS_IN_FLIGHT = 4
+        };
+
+        Connection& _connection;
+        bool _isPipelined = false;
+        std::size_t _pending = 0;
+        std::string _frame;
+        std::unique_ptr<Poco::Net::SMTPException> _error;
+
+    };
+
+    /// \brief Connect a socket to the first server address to answer.
+    /// \returns the connected socket, in blocking mode.
+    /// \throws Poco::Exception if no address could be connected to.
+    Poco::Net::StreamSocket connect();
+
+    /// \brief Greet the server with EHLO and record its capabilities.
+    void greet();
+
+    /// \brief Save the TLS session of the current socket.
+    void updateTLSSession();
+
+    /// \brief Check the session is open and reset a failed transaction.
+    void beginTransaction();
+
+    /// \brief Get the MAIL FROM BODY parameter for a transfer.
+    /// \param isChunking True if the content is sent with BDAT.
+    /// \returns the parameter, including a leading space, or empty.
+    std::string bodyParameter(bool isChunking) const;
+
+    /// \brief Send MAIL FROM and RCPT TO, pipelined if supported.
+    /// \param sender The envelope sender, including angle brackets.
+    /// \param recipients The envelope recipient addresses.
+    /// \param pRejections Receives the refused recipients, or nullptr to
+    ///        throw when a recipient is refused.
+    /// \throws Poco::Net::SMTPException if a command was rejected.
+    void sendEnvelope(const std::string& sender,
+                      const std::vector<std::string>& recipients,
+                      std::vector<Rejection>* pRejections = nullptr);
+
+    /// \brief Send MAIL FROM and RCPT TO as one PIPELINING group.
+    /// \param sender The envelope sender, including angle brackets.
+    /// \param recipients The envelope recipient addresses.
+    /// \param pRejections Receives the refused recipients, or nullptr to
+    ///        throw when a recipient is refused.
+    /// \throws Poco::Net::SMTPException if a command was rejected.
+    void sendEnvelopePipelined(const std::string& sender,
+                               const std::vector<std::string>& recipients,
+                               std::vector<Rejection>* pRejections);
+
+    /// \brief Handle the reply to a RCPT TO command.
+    /// \param recipient The recipient address.
+    /// \param status The reply code.
+    /// \param response The reply.
+    /// \param pRejections Receives the refused recipient, or nullptr.
+    /// \param error Set to the error to throw, if not set already.
+    void rejectRecipient(const std::string& recipient,
+                         int status,
+                         const std::string& response,
+                         std::vector<Rejection>* pRejections,
+                         std::unique_ptr<Poco::Net::SMTPException>& error);
+
+    /// \brief Send DATA and the message content.
+    /// \param message The message to send.
+    /// \throws Poco::Net::SMTPException if the message was rejected.
+    void sendData(const Poco::Net::MailMessage& message);
+
+    /// \brief Send DATA and a pre-rendered payload.
+    /// \param message The message to send.
+    /// \throws Poco::Net::SMTPException if the message was rejected.
+    void sendData(const WireMessage& message);
+
+    /// \brief Write raw bytes to the session socket.
+    /// \param data The bytes to write.
+    /// \param size The number of bytes to write.
+    void write(const char* data, std::size_t size);
+
+    enum
+    {
+        /// \brief The largest single socket write.
+        WRITE_CHUNK_SIZE = 64 * 1024,
+        /// \brief The size of BDAT chunks.
+        BDAT_CHUNK_SIZE = 1024 * 1024
+    };
+
+    /// \brief The connection settings.
+    Settings _settings;
+
+    /// \brief The cache of server addresses.
+    Resolver& _resolver;
+
+    /// \brief The metrics the session phases are timed in.
+    Metrics& _metrics;
+
+    /// \brief The SMTP session, or nullptr if closed.
+    std::unique_ptr<ClientSession> _session;
+
+    /// \brief The ESMTP capabilities advertised by the server.
+    std::map<std::string, std::string> _capabilities;
+
+    /// \brief The TLS session negotiated by the last open().
+    Poco::Net::Session::Ptr _pTLSSession = nullptr;
+
+    /// \brief True if the last open() resumed a TLS session.
+    bool _isTLSSessionReused = false;
+
+    /// \brief The reply accepting the last message.
+    Reply _lastReply;
+
+    /// \brief True if the last transaction failed and must be reset.
+    bool _needsReset = false;
+
+    /// \brief The time the session was opened, reset or last sent a
+    ///        message. The idle timeout is measured from it.
+    std::chrono::steady_clock::time_point _lastTransaction;
+
+    /// \brief The time of the last successful NOOP.
+    std::chrono::steady_clock::time_point _lastKeepAlive;
+
+};
+
+
+} } // namespace ofx::SMTP
@@ -0,0 +1,165 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <cstddef>
+#include <functional>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+
+namespace ofx {
+namespace SMTP {
+
+
+/// \brief A streaming encoder for message content sent to an SMTP server.
+///
+/// In CANONICAL mode bare LF line endings are converted to CRLF. This is the
+/// form sent with BDAT (RFC 3030), which transfers content unchanged.
+///
+/// In DOT_STUFFED mode lines are also dot-stuffed and finish() appends the
+/// "CRLF.CRLF" terminator required by the DATA command (RFC 5321).
+///
+/// Content may be passed to encode() in arbitrary pieces.
+///
+/// Line feeds are located with SSE2 or AVX2 instructions when available, and
+/// the bytes between them are copied in spans, so only the bytes around line
+/// breaks are examined one at a time.
+class DataEncoder
+{
+public:
+    /// \brief The encoding mode.
+    enum Mode
+    {
+        /// \brief Convert line endings to CRLF.
+        CANONICAL,
+        /// \brief Convert line endings to CRLF and dot-stuff lines.
+        DOT_STUFFED
+    };
+
+    /// \brief Create a DataEncoder.
+    /// \param mode The encoding mode.
+    DataEncoder(Mode mode);
+
+    /// \brief Destroy the DataEncoder.
+    ~DataEncoder();
+
+    /// \brief Encode a piece of content.
+    /// \param data The content to encode.
+    /// \param size The number of bytes to encode.
+    /// \param output The string the encoded content is appended to.
+    void encode(const char* data, std::size_t size, std::string& output);
+
+    /// \brief Finish the content.
+    ///
+    /// Makes sure the content ends with CRLF and, in DOT_STUFFED mode, appends
+    /// the terminating ".CRLF".
+    ///
+    /// \param output The string the final bytes are appended to.
+    void finish(std::string& output);
+
+    /// \returns true if a line beginning with '.' has been encoded.
+    bool hasDotLines() const;
+
+    /// \brief Encode a complete piece of content.
+    /// \param mode The encoding mode.
+    /// \param data The content to encode.
+    /// \returns the encoded and finished content.
+    static std::string encode(Mode mode, const std::string& data);
+
+private:
+    /// \brief The encoding mode.
+    Mode _mode;
+
+    /// \brief True if the next byte begins a line.
+    bool _isLineStart = true;
+
+    /// \brief True if the last byte was a CR.
+    bool _isCR = false;
+
+    /// \brief True if a line beginning with '.' was seen.
+    bool _hasDotLines = false;
+
+};
+
+
+/// \brief An output stream that encodes content with a DataEncoder.
+///
+/// The encoded content is handed to a callback in blocks of roughly the
+/// requested size, so that a message can be written to the network while it
+/// is being generated, without buffering all of it.
+class DataEncoderStream: public std::ostream
+{
+public:
+    /// \brief A callback receiving encoded blocks.
+    ///
+    /// The second argument is true for the final block, which may be empty.
+    typedef std::function<void(const std::string&, bool)> Sink;
+
+    /// \brief Create a DataEncoderStream.
+    /// \param mode The encoding mode.
+    /// \param sink The callback receiving encoded blocks.
+    /// \param blockSize The preferred block size in bytes.
+    DataEncoderStream(DataEncoder::Mode mode,
+                      Sink sink,
+                      std::size_t blockSize = DEFAULT_BLOCK_SIZE);
+
+    /// \brief Destroy the DataEncoderStream.
+    ~DataEncoderStream();
+
+    /// \brief Finish the content and pass the final block to the sink.
+    void close();
+
+    /// \returns the underlying encoder.
+    const DataEncoder& encoder() const;
+
+    enum
+    {
+        /// \brief The default block size.
+        DEFAULT_BLOCK_SIZE = 64 * 1024
+    };
+
+private:
+    /// \brief The stream buffer feeding the encoder.
+    class StreamBuf: public std::streambuf
+    {
+    public:
+        StreamBuf(DataEncoder::Mode mode, Sink sink, std::size_t blockSize);
+
+        void close();
+
+        const DataEncoder& encoder() const;
+
+    protected:
+        int_type overflow(int_type c) override;
+
+        int sync() override;
+
+    private:
+        /// \brief Encode the pending input and emit full blocks.
+        void encodePending();
+
+        DataEncoder _encoder;
+        Sink _sink;
+        std::size_t _blockSize;
+        std::vector<char> _input;
+        std::string _output;
+        bool _isClosed = false;
+
+    };
+
+    /// \brief The stream buffer.
+    StreamBuf _streamBuf;
+
+};
+
+
+} } // namespace ofx::SMTP
@@ -0,0 +1,134 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "Poco/Timespan.h"
+#include "ofx/SMTP/Events.h"
+
+
+namespace ofx {
+namespace SMTP {
+
+
+/// \brief A handle to the outcome of a message sent with Client::sendTracked().
+///
+/// The ticket completes once every envelope recipient of the message has a
+/// final outcome. Its results are the DeliveryResultArgs also reported by
+/// ClientEvents::onSMTPResult, with the server's reply, queue id and
+/// timings. A ticket can be polled with isDone(), waited on with wait(), or
+/// given a continuation with then().
+///
+/// Tickets are cheap to copy and every copy refers to the same message.
+/// Tickets live in memory only. A message restored from the Journal after a
+/// restart has no ticket. The ticket of a message still queued, spooled or
+/// waiting for a retry when the Client is destroyed completes with
+/// DeliveryResultArgs::DROPPED, even if the message itself is delivered by
+/// the next run.
+class DeliveryTicket
+{
+public:
+    /// \brief A function called when a ticket completes.
+    typedef std::function<void(const DeliveryTicket&)> Continuation;
+
+    /// \brief Create an invalid ticket, tracking no message.
+    DeliveryTicket();
+
+    /// \brief Destroy the ticket.
+    ~DeliveryTicket();
+
+    /// \returns true if the ticket tracks a message.
+    bool isValid() const;
+
+    /// \returns the id of the ticket, unique within a Client, or 0 if the
+    ///          ticket is invalid.
+    uint64_t id() const;
+
+    /// \returns true if every recipient has a final outcome.
+    bool isDone() const;
+
+    /// \brief Wait for the ticket to complete.
+    void wait() const;
+
+    /// \brief Wait for the ticket to complete, for a limited time.
+    /// \param timeout The longest time to wait.
+    /// \returns true if the ticket completed.
+    bool wait(const Poco::Timespan& timeout) const;
+
+    /// \brief Get the results so far.
+    ///
+    /// A message usually has a single result. When the server refuses some
+    /// of its recipients, there is one result for each group of recipients
+    /// that share an outcome.
+    ///
+    /// \returns the results, in the order they were reported.
+    std::vector<DeliveryResultArgs> results() const;
+
+    /// \returns true if the ticket completed and every recipient was
+    ///          delivered to.
+    bool isDelivered() const;
+
+    /// \brief Call a function when the ticket completes.
+    ///
+    /// If the ticket is already complete, the function is called at once on
+    /// the calling thread. Otherwise it is called on the delivery thread
+    /// that completes the ticket, so it should return quickly.
+    ///
+    /// \param continuation The function to call.
+    void then(Continuation continuation) const;
+
+private:
+    friend class Client;
+
+    /// \brief Create a ticket for a message.
+    /// \param id The ticket id.
+    /// \param recipients The number of envelope recipients of the message.
+    DeliveryTicket(uint64_t id, std::size_t recipients);
+
+    /// \brief Record the outcome of some recipients.
+    ///
+    /// Completes the ticket when every recipient has an outcome.
+    ///
+    /// \param result The outcome.
+    void complete(const DeliveryResultArgs& result) const;
+
+    /// \brief The state shared by the copies of a ticket.
+    struct State
+    {
+        /// \brief The ticket id.
+        uint64_t id = 0;
+
+        /// \brief The number of recipients without an outcome.
+        std::size_t pending = 0;
+
+        /// \brief The results reported so far.
+        std::vector<DeliveryResultArgs> results;
+
+        /// \brief The functions to call on completion.
+        std::vector<Continuation> continuations;
+
+        /// \brief The mutex protecting the state.
+        mutable std::mutex mutex;
+
+        /// \brief Signalled when the ticket completes.
+        mutable std::condition_variable completed;
+    };
+
+    /// \brief The shared state, or nullptr if the ticket is invalid.
+    std::shared_ptr<State> _state;
+
+};
+
+
+} } // namespace ofx::SMTP
@@ -0,0 +1,138 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "Poco/Net/MailMessage.h"
+#include "ofx/SMTP/Events.h"
+
+
+namespace ofx {
+namespace SMTP {
+
+
+/// \brief A lock-free queue of Client events waiting to be notified.
+///
+/// Delivery threads push events with a single compare-and-swap and never
+/// wait for each other or for listeners. The consumer takes everything
+/// pushed so far with a single exchange and hands it out in batches, in the
+/// order the events were pushed.
+///
+/// Any number of threads may push. Batches are taken by one thread at a
+/// time.
+class EventQueue
+{
+public:
+    /// \brief A queued event.
+    struct Event
+    {
+        enum Type
+        {
+            /// \brief ClientEvents::onSMTPDelivery.
+            DELIVERY,
+            /// \brief ClientEvents::onSMTPException.
+            EXCEPTION,
+            /// \brief ClientEvents::onSMTPResult.
+            RESULT
+        };
+
+        /// \brief The event.
+        Type type = DELIVERY;
+
+        /// \brief The delivered message of DELIVERY.
+        std::shared_ptr<Poco::Net::MailMessage> message;
+
+        /// \brief The error of EXCEPTION.
+        std::shared_ptr<const ErrorArgs> error;
+
+        /// \brief The result of RESULT.
+        std::shared_ptr<const DeliveryResultArgs> result;
+    };
+
+    typedef std::chrono::steady_clock Clock;
+
+    /// \brief Create an empty EventQueue.
+    EventQueue();
+
+    /// \brief Destroy the EventQueue and the events it holds.
+    ~EventQueue();
+
+    /// \brief Add an event.
+    /// \param event The event.
+    void push(Event event);
+
+    /// \brief Take the oldest events.
+    /// \param events Filled with the events, oldest first.
+    /// \param maxEvents The largest number of events to take.
+    /// \returns the number of events taken.
+    std::size_t take(std::vector<Event>& events, std::size_t maxEvents);
+
+    /// \brief Wait until an event is pushed.
+    /// \param timeout The longest time to wait.
+    /// \returns true if an event is waiting.
+    bool wait(Clock::duration timeout);
+
+    /// \brief Make a thread waiting for events return at once.
+    void wake();
+
+    /// \returns true if no event is waiting.
+    bool empty() const;
+
+    /// \returns the number of events waiting.
+    std::size_t size() const;
+
+private:
+    EventQueue(const EventQueue&) = delete;
+    EventQueue& operator = (const EventQueue&) = delete;
+
+    /// \brief A link of the queue.
+    struct Node
+    {
+        Event event;
+        Node* next = nullptr;
+    };
+
+    /// \brief Delete a list of nodes.
+    /// \param node The first node.
+    static void destroy(Node* node);
+
+    /// \brief The newest pushed node, linked to the older ones.
+    std::atomic<Node*> _head;
+
+    /// \brief The oldest node taken from the pushed nodes but not handed
+    ///        out yet, linked to the newer ones.
+    Node* _taken = nullptr;
+
+    /// \brief The number of events waiting.
+    std::atomic<std::size_t> _size;
+
+    /// \brief True while the consumer waits for events.
+    std::atomic<bool> _isWaiting;
+
+    /// \brief Serializes the consumers.
+    mutable std::mutex _takeMutex;
+
+    /// \brief True if wake() was called since the last wait.
+    bool _isWoken = false;
+
+    /// \brief The mutex of the wait condition.
+    std::mutex _waitMutex;
+
+    /// \brief Signalled when an event is pushed.
+    std::condition_variable _eventReady;
+
+};
+
+
+} } // namespace ofx::SMTP
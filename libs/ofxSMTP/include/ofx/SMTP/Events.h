@@ -8,8 +8,11 @@
 #pragma once
 
 
+#include <chrono>
+#include <vector>
 #include "Poco/Exception.h"
 #include "Poco/Net/MailMessage.h"
+#include "ofx/SMTP/Settings.h"
 #include "ofEvents.h"
 
 
@@ -52,7 +55,178 @@ protected:
 };
 
 
+/// \brief A class used for connection event callbacks.
+class ConnectionArgs
+{
+public:
+    /// \brief Create the ConnectionArgs.
+    /// \param settings The settings used to connect.
+    /// \param isTLSSessionReused True if a TLS session was resumed.
+    ConnectionArgs(const Settings& settings, bool isTLSSessionReused);
+
+    /// \brief Destroy the ConnectionArgs.
+    ~ConnectionArgs();
+
+    /// \returns The settings used to connect.
+    const Settings& settings() const;
+
+    /// \returns true if the connection resumed a previous TLS session.
+    bool isTLSSessionReused() const;
+
+protected:
+    /// \brief The settings used to connect.
+    Settings _settings;
+
+    /// \brief True if a TLS session was resumed.
+    bool _isTLSSessionReused = false;
+
+};
+
+
+/// \brief A class used for final delivery result callbacks.
+class DeliveryResultArgs
+{
+public:
+    /// \brief The final outcome of a message.
+    enum Outcome
+    {
+        /// \brief The message was delivered.
+        DELIVERED,
+        /// \brief The server rejected the message with a permanent error, or
+        ///        the message could not be rendered.
+        REJECTED,
+        /// \brief The message failed Settings::maxAttempts() times.
+        TOO_MANY_ATTEMPTS,
+        /// \brief The message was older than Settings::maxMessageAge().
+        EXPIRED,
+        /// \brief The message was dropped to make room in the outbox, or its
+        ///        spool file could not be read.
+        DROPPED
+    };
+
+    typedef std::chrono::steady_clock Clock;
+
+    /// \brief How long a message took.
+    struct Timings
+    {
+        /// \brief Create zero Timings.
+        Timings();
+
+        /// \brief From queuing the message to its first delivery attempt.
+        Clock::duration queueWait;
+
+        /// \brief The last attempt, from MAIL FROM to the server's reply.
+        Clock::duration transfer;
+
+        /// \brief From queuing the message to its outcome, including
+        ///        retries.
+        Clock::duration total;
+    };
+
+    /// \brief Create the DeliveryResultArgs.
+    /// \param message The message.
+    /// \param recipients The envelope recipients the outcome applies to.
+    /// \param outcome The final outcome.
+    /// \param attempts The number of delivery attempts made.
+    /// \param reason The last error, or an empty string.
+    /// \param replyCode The server's reply code, or 0.
+    /// \param reply The server's reply accepting the message, or an empty
+    ///        string.
+    /// \param timings How long the message took.
+    DeliveryResultArgs(std::shared_ptr<Poco::Net::MailMessage> message,
+                       const std::vector<std::string>& recipients,
+                       Outcome outcome,
+                       std::size_t attempts,
+                       const std::string& reason = "",
+                       int replyCode = 0,
+                       const std::string& reply = "",
+                       const Timings& timings = Timings());
+
+    /// \brief Destroy the DeliveryResultArgs.
+    ~DeliveryResultArgs();
+
+    /// \returns A pointer to the message, or nullptr for a message that was
+    ///          spooled when the Client was destroyed.
+    std::shared_ptr<Poco::Net::MailMessage> message() const;
+
+    /// \brief Get the envelope recipients the outcome applies to.
+    ///
+    /// A message may have a different outcome for each of its recipients,
+    /// for example when the server refuses some of them. Each outcome is
+    /// reported with the recipients it applies to.
+    ///
+    /// \returns The recipient addresses.
+    const std::vector<std::string>& recipients() const;
+
+    /// \returns The final outcome.
+    Outcome outcome() const;
+
+    /// \returns The number of delivery attempts made.
+    std::size_t attempts() const;
+
+    /// \returns The last error, or an empty string.
+    const std::string& reason() const;
+
+    /// \brief Get the server's reply code.
+    ///
+    /// This is the reply to the end of the content for delivered messages,
+    /// and the code of the last error for rejected ones.
+    ///
+    /// \returns The reply code, or 0 if there was no reply.
+    int replyCode() const;
+
+    /// \returns The server's reply accepting the message, or an empty string.
+    const std::string& reply() const;
+
+    /// \brief Get the id the server queued the message under.
+    ///
+    /// The id is taken from replies such as "250 2.0.0 Ok: queued as
+    /// 4BF3D1C0A2" or "250 OK id=1qZx5B-0003Kp-2N". Useful to trace a
+    /// message in the server logs.
+    ///
+    /// \returns The queue id, or an empty string if the reply has none.
+    std::string queueId() const;
+
+    /// \returns How long the message took.
+    const Timings& timings() const;
+
+    /// \returns a string representation of an outcome.
+    static std::string toString(Outcome outcome);
+
+protected:
+    /// \brief The message.
+    std::shared_ptr<Poco::Net::MailMessage> _message;
+
+    /// \brief The recipients.
+    std::vector<std::string> _recipients;
+
+    /// \brief The final outcome.
+    Outcome _outcome;
+
+    /// \brief The number of delivery attempts.
+    std::size_t _attempts = 0;
+
+    /// \brief The last error.
+    std::string _reason;
+
+    /// \brief The server's reply code.
+    int _replyCode = 0;
+
+    /// \brief The server's reply accepting the message.
+    std::string _reply;
+
+    /// \brief How long the message took.
+    Timings _timings;
+
+};
+
+
 /// \brief A collection of SMTP events.
+///
+/// Events are notified on the delivery threads unless the Client is set up
+/// with another Settings::EventDispatch. onSMTPConnect is always notified on
+/// the delivery thread.
+///
 /// \todo Add progress once Poco supports it
 /// http://pocoproject.org/forum/viewtopic.php?f=12&t=5655&p=9788&hilit=smtp#p9788
 class ClientEvents
@@ -63,6 +237,30 @@ public:
 
     /// \brief This message is triggered upon client error.
     ofEvent<const ErrorArgs> onSMTPException;
+
+    /// \brief This event is triggered when a server connection is opened.
+    ///
+    /// It is not registered by Client::registerEvents(). Use
+    /// ofEvent::newListener() to receive it.
+    ofEvent<const ConnectionArgs> onSMTPConnect;
+
+    /// \brief This event is triggered once for every message when its fate
+    /// is final, or once for each group of its recipients that share a fate.
+    ///
+    /// Transient errors are reported by onSMTPException and retried; this
+    /// event reports whether the message was eventually delivered or given
+    /// up on. It is not registered by Client::registerEvents(). Use
+    /// ofEvent::newListener() to receive it.
+    ofEvent<const DeliveryResultArgs> onSMTPResult;
+
+    /// \brief This event is triggered with the results of many messages at
+    /// once.
+    ///
+    /// With Settings::INLINE event dispatch, each batch holds a single
+    /// result. Otherwise it holds the results of a batch of queued events,
+    /// notified after their onSMTPResult events. It is not registered by
+    /// Client::registerEvents(). Use ofEvent::newListener() to receive it.
+    ofEvent<const std::vector<DeliveryResultArgs>> onSMTPResultBatch;
     
 };
 
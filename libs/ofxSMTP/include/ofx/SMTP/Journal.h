@@ -0,0 +1,215 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "Poco/Timespan.h"
+#include "ofx/SMTP/Outbox.h"
+
+
+namespace ofx {
+namespace SMTP {
+
+
+/// \brief An append-only journal of queued messages.
+///
+/// Every queued message is appended to the current segment file, with its
+/// priority and attempt count, and every delivered or abandoned message is
+/// marked with a tombstone record. When the journal is opened, the messages
+/// without a tombstone are replayed.
+///
+/// Records are written to the operating system as soon as they are
+/// appended, which protects them from a crash of the process. They are
+/// synced to the disk in groups, either by a background thread after the
+/// sync interval or, with an interval of zero, by the first of the waiting
+/// producers on behalf of all of them. Either way a single fsync covers
+/// every record written before it.
+///
+/// With a sync interval above zero, append() returns before its record is
+/// synced. Messages appended within the last interval before a power loss
+/// or operating system crash are lost. Only an interval of zero makes every
+/// appended message survive those.
+///
+/// Segments are deleted, oldest first, once all of their messages are dead.
+///
+/// Delivery is at least once: a message delivered just before a crash may
+/// be replayed if its tombstone had not reached the disk.
+class Journal
+{
+public:
+    /// \brief Create a closed Journal.
+    Journal();
+
+    /// \brief Destroy the Journal, syncing and closing it.
+    ~Journal();
+
+    /// \brief Open a journal directory, creating it if needed.
+    /// \param directory The directory, relative to the data folder.
+    /// \param syncInterval The longest time a record waits to be synced, or
+    ///        zero to make append() wait for the sync.
+    /// \param segmentSize The size at which a new segment is started.
+    /// \param entries Filled with the messages to replay, oldest first.
+    /// \returns true if the journal could be opened.
+    bool open(const std::string& directory,
+              const Poco::Timespan& syncInterval,
+              std::size_t segmentSize,
+              std::vector<Outbox::Entry>& entries);
+
+    /// \brief Sync and close the journal.
+    void close();
+
+    /// \returns true if the journal is open.
+    bool isOpen() const;
+
+    /// \brief Append a message to the journal.
+    /// \param message The message to append.
+    /// \param priority The priority of the message.
+    /// \param attempts The number of delivery attempts made so far.
+    /// \returns the journal id of the message, or 0 on failure.
+    uint64_t append(const WireMessage& message,
+                    Settings::Priority priority,
+                    std::size_t attempts = 0);
+
+    /// \brief Record the number of delivery attempts of a message.
+    ///
+    /// Like tombstones, these records do not wait for a sync. A lost record
+    /// only means that fewer attempts are counted after a restart.
+    ///
+    /// \param id The journal id of the message. 0 is ignored.
+    /// \param attempts The number of delivery attempts made so far.
+    void setAttempts(uint64_t id, std::size_t attempts);
+
+    /// \brief Mark a message as done.
+    /// \param id The journal id of the message. 0 is ignored.
+    void remove(uint64_t id);
+
+    /// \brief Sync all written records to the disk.
+    void sync();
+
+    /// \returns the number of messages without a tombstone.
+    std::size_t size() const;
+
+    enum
+    {
+        /// \brief The default segment size.
+        DEFAULT_SEGMENT_SIZE = 16 * 1024 * 1024
+    };
+
+private:
+    Journal(const Journal&) = delete;
+    Journal& operator = (const Journal&) = delete;
+
+    /// \brief The journal record types.
+    enum RecordType
+    {
+        /// \brief A message, without its priority and attempt count.
+        MESSAGE = 1,
+        TOMBSTONE = 2,
+        /// \brief A message, after its priority (1) and attempt count (4).
+        ENTRY = 3,
+        /// \brief The attempt count (4) of a message.
+        ATTEMPTS = 4
+    };
+
+    /// \brief Read a segment, adding its messages to the replay list.
+    void replay(uint64_t segment,
+                std::map<uint64_t, Outbox::Entry>& entries);
+
+    /// \brief Write a record to the current segment.
+    ///
+    /// A record that fails to be written is left partial at the end of the
+    /// segment, so a new segment is started.
+    ///
+    /// \param lock The held journal lock.
+    /// \returns the position after the record, or 0 on failure.
+    uint64_t write(std::unique_lock<std::mutex>& lock,
+                   RecordType type,
+                   uint64_t id,
+                   const std::string& payload);
+
+    /// \brief Sync and close the current segment and start a new one.
+    /// \param lock The held journal lock.
+    /// \returns true if the new segment could be created.
+    bool rotate(std::unique_lock<std::mutex>& lock);
+
+    /// \brief Wait until the given position is synced.
+    void waitForSync(std::unique_lock<std::mutex>& lock, uint64_t position);
+
+    /// \brief Sync the current segment, releasing the lock meanwhile.
+    void syncUnlocked(std::unique_lock<std::mutex>& lock);
+
+    /// \brief Delete the oldest segments without live messages.
+    void collectGarbage();
+
+    /// \brief The background sync loop.
+    void flush();
+
+    /// \returns the path of a segment file.
+    std::string path(uint64_t segment) const;
+
+    /// \brief The journal directory.
+    std::string _directory;
+
+    /// \brief The sync interval.
+    Poco::Timespan _syncInterval;
+
+    /// \brief The segment size.
+    std::size_t _segmentSize = DEFAULT_SEGMENT_SIZE;
+
+    /// \brief The current segment file.
+    std::FILE* _file = nullptr;
+
+    /// \brief The current segment.
+    uint64_t _segment = 0;
+
+    /// \brief The size of the current segment.
+    std::size_t _segmentBytes = 0;
+
+    /// \brief The number of live messages per segment.
+    std::map<uint64_t, std::size_t> _liveCounts;
+
+    /// \brief The segment of each live message.
+    std::unordered_map<uint64_t, uint64_t> _messages;
+
+    /// \brief The next message id.
+    uint64_t _nextId = 1;
+
+    /// \brief The number of bytes written.
+    uint64_t _written = 0;
+
+    /// \brief The number of bytes synced.
+    uint64_t _synced = 0;
+
+    /// \brief True while a thread is syncing.
+    bool _isSyncing = false;
+
+    /// \brief True while the journal is closing.
+    bool _isClosing = false;
+
+    /// \brief Signalled when a sync completes or work is pending.
+    std::condition_variable _condition;
+
+    /// \brief The background sync thread.
+    std::thread _flusher;
+
+    /// \brief The mutex protecting the journal.
+    mutable std::mutex _mutex;
+
+};
+
+
+} } // namespace ofx::SMTP
@@ -0,0 +1,94 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <istream>
+#include <memory>
+#include <string>
+#include "Poco/SharedMemory.h"
+#include "Poco/Net/PartSource.h"
+
+
+namespace ofx {
+namespace SMTP {
+
+
+/// \brief A message part backed by a memory-mapped file.
+///
+/// Unlike Poco::Net::FilePartSource, the file is not read into stream
+/// buffers. When a message is written directly, the encoder reads the mapped
+/// pages as it goes. When a message is pre-rendered, the attachment is left
+/// out of the rendered content and encoded chunk by chunk while it is sent,
+/// so queued messages do not hold encoded copies of their attachments.
+///
+/// The file must not be modified while the part is in use.
+class MappedFilePartSource: public Poco::Net::PartSource
+{
+public:
+    /// \brief Create a MappedFilePartSource of type application/octet-stream.
+    /// \param path The file path.
+    /// \throws Poco::FileException if the file cannot be mapped.
+    MappedFilePartSource(const std::string& path);
+
+    /// \brief Create a MappedFilePartSource.
+    /// \param path The file path.
+    /// \param mediaType The media type of the content.
+    /// \throws Poco::FileException if the file cannot be mapped.
+    MappedFilePartSource(const std::string& path,
+                         const std::string& mediaType);
+
+    /// \brief Create a MappedFilePartSource.
+    /// \param path The file path.
+    /// \param filename The file name reported to the recipient.
+    /// \param mediaType The media type of the content.
+    /// \throws Poco::FileException if the file cannot be mapped.
+    MappedFilePartSource(const std::string& path,
+                         const std::string& filename,
+                         const std::string& mediaType);
+
+    /// \brief Destroy the MappedFilePartSource.
+    virtual ~MappedFilePartSource();
+
+    /// \returns a new stream reading the mapped file.
+    std::istream& stream() override;
+
+    /// \returns the file name reported to the recipient.
+    const std::string& filename() const override;
+
+    /// \returns the size of the file in bytes.
+    std::streamsize getContentLength() const override;
+
+    /// \returns the mapped file content, or nullptr for an empty file.
+    const char* data() const;
+
+    /// \returns the size of the file in bytes.
+    std::size_t size() const;
+
+private:
+    /// \brief Map the file at the given path.
+    void map(const std::string& path);
+
+    /// \brief The file mapping, shared with rendered messages.
+    std::shared_ptr<const Poco::SharedMemory> _pMemory;
+
+    /// \brief The size of the file.
+    std::size_t _size = 0;
+
+    /// \brief The file name reported to the recipient.
+    std::string _filename;
+
+    /// \brief The current stream.
+    std::unique_ptr<std::istream> _pStream;
+
+    friend class WireMessage;
+
+};
+
+
+} } // namespace ofx::SMTP
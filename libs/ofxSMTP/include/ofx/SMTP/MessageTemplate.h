@@ -0,0 +1,263 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Poco/Net/MailMessage.h"
+#include "Poco/Net/PartSource.h"
+#include "ofx/SMTP/WireMessage.h"
+
+
+namespace ofx {
+namespace SMTP {
+
+
+/// \brief A message rendered once and personalized for many recipients.
+///
+/// The subject and content are templates with fields written as
+/// `{{name}}`. Compiling the template renders the message once, with its
+/// shared parts, such as logos and PDFs, transfer encoded. Rendering it
+/// for a recipient then only fills in the fields, the recipient and the
+/// date. The encoded parts are shared by reference between the rendered
+/// messages, never copied.
+///
+/// The content is sent with the 8bit transfer encoding, so field values are
+/// inserted as they are, with their line endings made canonical. Values in
+/// HTML content must be escaped by the caller. Line breaks in the subject
+/// are replaced with spaces, and a subject that is not ASCII is encoded.
+///
+/// A missing field is rendered as an empty string.
+///
+/// \code
+/// ofxSMTP::MessageTemplate newsletter;
+/// newsletter.setSender("Shop <news@example.com>");
+/// newsletter.setSubject("{{name}}, your order has shipped");
+/// newsletter.setContent("Hello {{name}},\n\nYour order {{order}} is on its way.\n");
+/// newsletter.addAttachment("invoice.pdf", new ofxSMTP::MappedFilePartSource(ofToDataPath("invoice.pdf"), "application/pdf"));
+/// newsletter.compile();
+///
+/// smtp.sendMerge(newsletter, { { "alice@example.com", { { "name", "Alice" }, { "order", "1001" } } } });
+/// \endcode
+class MessageTemplate
+{
+public:
+    /// \brief Field values by name.
+    typedef std::map<std::string, std::string> Fields;
+
+    /// \brief A recipient and its field values.
+    struct Recipient
+    {
+        /// \brief The recipient address.
+        std::string address;
+
+        /// \brief The field values of the recipient.
+        Fields fields;
+    };
+
+    /// \brief Create an empty MessageTemplate.
+    MessageTemplate();
+
+    /// \brief Destroy the MessageTemplate.
+    ~MessageTemplate();
+
+    /// \brief Set the sender.
+    /// \param sender The sender, e.g. "Name <address>".
+    void setSender(const std::string& sender);
+
+    /// \brief Set the subject template.
+    /// \param subject The subject, with fields.
+    void setSubject(const std::string& subject);
+
+    /// \brief Set the content template.
+    /// \param content The content, with fields.
+    /// \param mediaType The media type of the content.
+    void setContent(const std::string& content,
+                    const std::string& mediaType = "text/plain; charset=UTF-8");
+
+    /// \brief Set a header shared by every message.
+    /// \param name The header name.
+    /// \param value The header value.
+    void setHeader(const std::string& name, const std::string& value);
+
+    /// \brief Add a part shared by every message.
+    ///
+    /// The part is encoded once, when the template is compiled. A base64
+    /// part backed by a MappedFilePartSource is encoded from the mapped file
+    /// while each message is written instead, see WireMessage.
+    ///
+    /// \param name The name of the part.
+    /// \param pSource The content of the part. The template takes ownership.
+    /// \param disposition The content disposition.
+    /// \param encoding The transfer encoding.
+    void addPart(const std::string& name,
+                 Poco::Net::PartSource* pSource,
+                 Poco::Net::MailMessage::ContentDisposition disposition,
+                 Poco::Net::MailMessage::ContentTransferEncoding encoding);
+
+    /// \brief Add an attachment shared by every message.
+    /// \param name The file name of the attachment.
+    /// \param pSource The content of the attachment. The template takes
+    ///        ownership.
+    /// \param encoding The transfer encoding.
+    void addAttachment(const std::string& name,
+                       Poco::Net::PartSource* pSource,
+                       Poco::Net::MailMessage::ContentTransferEncoding encoding = Poco::Net::MailMessage::ENCODING_BASE64);
+
+    /// \brief Parse the templates and encode the shared parts.
+    ///
+    /// The template can not be changed once compiled.
+    ///
+    /// \throws Poco::Exception if the message can not be rendered.
+    void compile();
+
+    /// \returns true if the template is compiled.
+    bool isCompiled() const;
+
+    /// \returns the names of the fields, in order of appearance.
+    const std::vector<std::string>& fields() const;
+
+    /// \brief Render the message for a recipient.
+    ///
+    /// Rendering only reads the compiled template, so many threads can
+    /// render at once.
+    ///
+    /// \param recipient The recipient address.
+    /// \param fields The field values.
+    /// \returns the rendered message, addressed to the recipient.
+    /// \throws Poco::IllegalStateException if the template is not compiled.
+    std::shared_ptr<const WireMessage> render(const std::string& recipient,
+                                              const Fields& fields) const;
+
+    /// \brief Render the subject for field values.
+    /// \param fields The field values.
+    /// \returns the subject, before header encoding.
+    std::string renderSubject(const Fields& fields) const;
+
+    enum
+    {
+        /// \brief Rendered text at least this long is shared by reference.
+        ///
+        /// Shorter text is copied into the message, so that a message is
+        /// written in a few large pieces.
+        SHARED_TEXT_SIZE = 1024
+    };
+
+private:
+    MessageTemplate(const MessageTemplate&) = delete;
+    MessageTemplate& operator = (const MessageTemplate&) = delete;
+
+    /// \brief A piece of a template string.
+    struct Token
+    {
+        /// \brief The literal text, if not a field.
+        std::string text;
+
+        /// \brief The index of the field, or NO_FIELD.
+        std::size_t field;
+    };
+
+    /// \brief A piece of the rendered message.
+    struct Piece
+    {
+        enum Type
+        {
+            /// \brief Rendered content shared by every message.
+            CONTENT,
+            /// \brief The encoded subject.
+            SUBJECT,
+            /// \brief The recipient address.
+            RECIPIENT,
+            /// \brief The date of the message.
+            DATE,
+            /// \brief The value of a field.
+            FIELD
+        };
+
+        Type type = CONTENT;
+
+        /// \brief The content of CONTENT.
+        WireMessage::Segment segment;
+
+        /// \brief The index of the field of FIELD.
+        std::size_t field = 0;
+    };
+
+    /// \brief A part waiting to be compiled.
+    struct Part
+    {
+        std::string name;
+        std::unique_ptr<Poco::Net::PartSource> source;
+        Poco::Net::MailMessage::ContentDisposition disposition;
+        Poco::Net::MailMessage::ContentTransferEncoding encoding;
+    };
+
+    /// \brief Split a template string into literals and fields.
+    /// \param text The template string.
+    /// \returns the tokens.
+    std::vector<Token> parse(const std::string& text);
+
+    /// \brief Log an error if the template is compiled.
+    /// \param function The name of the calling function.
+    /// \returns true if the template can still be changed.
+    bool isMutable(const std::string& function) const;
+
+    /// \brief Append a field value with canonical line endings.
+    /// \param value The value.
+    /// \param text The text to append to.
+    static void appendCanonical(const std::string& value, std::string& text);
+
+    enum : std::size_t
+    {
+        /// \brief The field index of a literal token.
+        NO_FIELD = std::size_t(-1)
+    };
+
+    /// \brief The sender.
+    std::string _sender;
+
+    /// \brief The subject template.
+    std::string _subject;
+
+    /// \brief The content template.
+    std::string _content;
+
+    /// \brief The media type of the content.
+    std::string _mediaType = "text/plain; charset=UTF-8";
+
+    /// \brief The shared headers.
+    std::vector<std::pair<std::string, std::string>> _headers;
+
+    /// \brief The shared parts, until compiled.
+    std::vector<Part> _parts;
+
+    /// \brief The names of the fields.
+    std::vector<std::string> _fields;
+
+    /// \brief The parsed subject.
+    std::vector<Token> _subjectTokens;
+
+    /// \brief The compiled message.
+    std::vector<Piece> _pieces;
+
+    /// \brief The envelope sender.
+    std::string _envelopeSender;
+
+    /// \brief True if the shared content has a line beginning with '.'.
+    bool _hasDotLines = false;
+
+    /// \brief True once compiled.
+    bool _isCompiled = false;
+
+};
+
+
+} } // namespace ofx::SMTP
@@ -0,0 +1,225 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include "ofJson.h"
+
+
+namespace ofx {
+namespace SMTP {
+
+
+/// \brief A lock free histogram of durations.
+///
+/// Durations are counted in buckets whose bounds are powers of two
+/// microseconds, from 1 microsecond to about 67 seconds. Recording a value
+/// is a few relaxed atomic increments, so histograms can be updated from any
+/// thread on the delivery path.
+class Histogram
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    enum
+    {
+        /// \brief The number of buckets, the last one is unbounded.
+        NUM_BUCKETS = 28
+    };
+
+    /// \brief Create an empty Histogram.
+    Histogram();
+
+    /// \brief Destroy the Histogram.
+    ~Histogram();
+
+    /// \brief Count a duration.
+    /// \param duration The duration.
+    void record(Clock::duration duration);
+
+    /// \returns the number of durations counted.
+    uint64_t count() const;
+
+    /// \returns the sum of the durations counted.
+    Clock::duration sum() const;
+
+    /// \brief Estimate a quantile.
+    ///
+    /// The value is interpolated within its bucket, so it is accurate to
+    /// within a factor of two.
+    ///
+    /// \param quantile The quantile, between 0 and 1.
+    /// \returns the estimated duration, or zero if nothing was counted.
+    Clock::duration quantile(double quantile) const;
+
+    /// \param bucket The bucket index.
+    /// \returns the number of durations in a bucket.
+    uint64_t bucketCount(std::size_t bucket) const;
+
+    /// \param bucket The bucket index.
+    /// \returns the inclusive upper bound of a bucket.
+    static Clock::duration bucketBound(std::size_t bucket);
+
+private:
+    /// \brief The bucket counts.
+    std::array<std::atomic<uint64_t>, NUM_BUCKETS> _buckets;
+
+    /// \brief The number of durations counted.
+    std::atomic<uint64_t> _count;
+
+    /// \brief The sum of the durations in microseconds.
+    std::atomic<uint64_t> _sum;
+
+};
+
+
+/// \brief Latency histograms and counters of a Client.
+///
+/// A Connection times each phase of its SMTP sessions and the Client times
+/// the life of each message, so that the time spent delivering can be
+/// broken down. Metrics can be read at any time and exported as JSON or in
+/// the Prometheus text exposition format.
+class Metrics
+{
+public:
+    /// \brief A timed phase of the delivery pipeline.
+    enum Phase
+    {
+        /// \brief Resolving the server address.
+        DNS,
+        /// \brief Establishing the TCP connection.
+        CONNECT,
+        /// \brief The TLS handshake, including STARTTLS.
+        TLS_HANDSHAKE,
+        /// \brief The EHLO command.
+        EHLO,
+        /// \brief Authentication.
+        AUTH,
+        /// \brief The MAIL FROM and RCPT TO commands.
+        ENVELOPE,
+        /// \brief Transferring the content, until the server accepts it.
+        DATA,
+        /// \brief From queuing a message to its first delivery attempt.
+        QUEUE_WAIT,
+        /// \brief From queuing a message to its delivery, including retries.
+        END_TO_END
+    };
+
+    enum
+    {
+        /// \brief The number of phases.
+        NUM_PHASES = END_TO_END + 1
+    };
+
+    /// \brief A counted event.
+    enum Counter
+    {
+        /// \brief Messages queued for delivery.
+        MESSAGES_QUEUED,
+        /// \brief Messages delivered.
+        MESSAGES_DELIVERED,
+        /// \brief Messages given up on.
+        MESSAGES_FAILED,
+        /// \brief Recipients refused permanently by the server.
+        RECIPIENTS_REJECTED,
+        /// \brief Message content bytes written.
+        BYTES_SENT,
+        /// \brief Delivery attempts scheduled after a failure.
+        RETRIES,
+        /// \brief Server connections opened.
+        CONNECTIONS,
+        /// \brief Server connections that failed to open.
+        CONNECTION_ERRORS,
+        /// \brief Connections that resumed a TLS session.
+        TLS_RESUMPTIONS
+    };
+
+    enum
+    {
+        /// \brief The number of counters.
+        NUM_COUNTERS = TLS_RESUMPTIONS + 1
+    };
+
+    /// \brief Times a phase for as long as it is in scope.
+    class Timer
+    {
+    public:
+        /// \brief Start timing a phase.
+        /// \param metrics The metrics to record to.
+        /// \param phase The phase.
+        Timer(Metrics& metrics, Phase phase);
+
+        /// \brief Record the time since the Timer was created.
+        ~Timer();
+
+    private:
+        Metrics& _metrics;
+        Phase _phase;
+        Histogram::Clock::time_point _start;
+
+    };
+
+    /// \brief Create empty Metrics.
+    Metrics();
+
+    /// \brief Destroy the Metrics.
+    ~Metrics();
+
+    /// \brief Record the duration of a phase.
+    /// \param phase The phase.
+    /// \param duration The duration.
+    void record(Phase phase, Histogram::Clock::duration duration);
+
+    /// \brief Increment a counter.
+    /// \param counter The counter.
+    /// \param value The amount to add.
+    void add(Counter counter, uint64_t value = 1);
+
+    /// \param phase The phase.
+    /// \returns the histogram of a phase.
+    const Histogram& histogram(Phase phase) const;
+
+    /// \param counter The counter.
+    /// \returns the value of a counter.
+    uint64_t counter(Counter counter) const;
+
+    /// \brief Export a snapshot of the metrics as JSON.
+    ///
+    /// Counters are listed by name. Each phase lists its count, its sum and
+    /// its 50th, 90th and 99th percentiles in seconds.
+    ///
+    /// \returns the metrics.
+    ofJson toJSON() const;
+
+    /// \brief Export a snapshot in the Prometheus text exposition format.
+    /// \param prefix The prefix of the metric names.
+    /// \returns the metrics.
+    std::string toPrometheus(const std::string& prefix = "ofxsmtp") const;
+
+    /// \returns the lower case name of a phase.
+    static std::string toString(Phase phase);
+
+    /// \returns the lower case name of a counter.
+    static std::string toString(Counter counter);
+
+private:
+    /// \brief The phase histograms.
+    std::array<Histogram, NUM_PHASES> _phases;
+
+    /// \brief The counters.
+    std::array<std::atomic<uint64_t>, NUM_COUNTERS> _counters;
+
+};
+
+
+} } // namespace ofx::SMTP
@@ -0,0 +1,287 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include "Poco/Net/MailMessage.h"
+#include "ofx/SMTP/DeliveryTicket.h"
+#include "ofx/SMTP/Settings.h"
+#include "ofx/SMTP/WireMessage.h"
+
+
+namespace ofx {
+namespace SMTP {
+
+
+/// \brief The queue of messages waiting for delivery.
+///
+/// Messages are queued in one lane per Settings::Priority. Producers push
+/// onto a lane's lock-free stack and never wait for the delivery workers.
+/// A worker takes each whole stack in a single atomic exchange and moves
+/// it, in order, to a queue shared by the workers only.
+///
+/// Workers pick lanes by deficit round robin. Each lane in turn, from the
+/// most urgent, may deliver as many messages as its weight before the next
+/// lane is served, so urgent mail overtakes bulk mail while bulk mail keeps
+/// a share of the throughput.
+///
+/// The outbox may be bounded by a number of messages and a total size.
+/// Producers that want to wait for room block on a condition that is only
+/// signalled while someone is waiting.
+class Outbox
+{
+public:
+    /// \brief A message waiting in the outbox.
+    struct Entry
+    {
+        /// \brief The message.
+        std::shared_ptr<Poco::Net::MailMessage> message;
+
+        /// \brief The rendered message, or nullptr if not pre-rendered.
+        std::shared_ptr<const WireMessage> wire;
+
+        /// \brief The size counted against the byte capacity.
+        std::size_t size = 0;
+
+        /// \brief The Journal id of the message, or 0 if not journaled.
+        uint64_t journalId = 0;
+
+        /// \brief The number of delivery attempts made.
+        std::size_t attempts = 0;
+
+        /// \brief The time the message was queued.
+        std::chrono::steady_clock::time_point queued;
+
+        /// \brief The time the message last entered the outbox.
+        ///
+        /// Set by the Outbox on every push and requeue, so that the lane
+        /// wait does not include the retry backoff.
+        std::chrono::steady_clock::time_point enqueued;
+
+        /// \brief The time of the first delivery attempt.
+        std::chrono::steady_clock::time_point started;
+
+        /// \brief The lane of the message.
+        Settings::Priority priority = Settings::NORMAL;
+
+        /// \brief The ticket completed with the outcome, if tracked.
+        DeliveryTicket ticket;
+    };
+
+    /// \brief The state of a lane.
+    struct LaneStats
+    {
+        /// \brief The number of queued messages.
+        std::size_t size = 0;
+
+        /// \brief The number of messages taken for delivery.
+        uint64_t taken = 0;
+
+        /// \brief The moving average time messages waited in the lane.
+        std::chrono::steady_clock::duration averageWait = std::chrono::steady_clock::duration::zero();
+
+        /// \brief The longest time a message waited in the lane.
+        std::chrono::steady_clock::duration maxWait = std::chrono::steady_clock::duration::zero();
+
+        /// \brief How long the oldest queued message has been waiting.
+        std::chrono::steady_clock::duration oldestWait = std::chrono::steady_clock::duration::zero();
+    };
+
+    /// \brief Create an empty Outbox.
+    Outbox();
+
+    /// \brief Destroy the Outbox.
+    ~Outbox();
+
+    /// \brief Set the capacity of the outbox.
+    ///
+    /// Must be called before messages are added.
+    ///
+    /// \param messages The maximum number of messages, or 0 for no limit.
+    /// \param bytes The maximum total size in bytes, or 0 for no limit.
+    void setCapacity(std::size_t messages, std::size_t bytes);
+
+    /// \brief Set the number of messages a lane may deliver per turn.
+    ///
+    /// Must be called before messages are added.
+    ///
+    /// \param priority The lane.
+    /// \param weight The weight, clamped to at least 1.
+    void setWeight(Settings::Priority priority, std::size_t weight);
+
+    /// \brief Add a message to the back of the outbox, ignoring the capacity.
+    ///
+    /// This is lock-free and may be called from any thread.
+    ///
+    /// \param entry The message to add.
+    void push(const Entry& entry);
+
+    /// \brief Add a message to the back of the outbox if there is room.
+    ///
+    /// This is lock-free and may be called from any thread.
+    ///
+    /// \param entry The message to add.
+    /// \returns false if the outbox is full.
+    bool tryPush(const Entry& entry);
+
+    /// \brief Add a message to the back of the outbox, waiting for room.
+    /// \param entry The message to add.
+    /// \returns false if the outbox was closed or the message can never fit.
+    bool waitPush(const Entry& entry);
+
+    /// \brief Wake producers waiting for room and make them fail.
+    void close();
+
+    /// \brief Check whether a message can ever fit in the outbox.
+    /// \param entry The message to check.
+    /// \returns true if the message is not larger than the byte capacity.
+    bool fits(const Entry& entry) const;
+
+    /// \brief Return a message to the front of the outbox.
+    /// \param entry The message to return.
+    void requeue(const Entry& entry);
+
+    /// \brief Take the message at the front of the outbox.
+    /// \param entry Set to the message taken.
+    /// \returns false if the outbox is empty.
+    bool pop(Entry& entry);
+
+    /// \brief Take a message to make room for another.
+    ///
+    /// The oldest message of the least urgent lane is taken, but never one
+    /// more urgent than the given priority.
+    ///
+    /// \param entry Set to the message taken.
+    /// \param priority The priority of the message that needs room.
+    /// \returns false if there is no such message.
+    bool evict(Entry& entry, Settings::Priority priority);
+
+    /// \returns the number of messages in the outbox.
+    std::size_t size() const;
+
+    /// \param priority The lane.
+    /// \returns the number of messages in the lane.
+    std::size_t size(Settings::Priority priority) const;
+
+    /// \returns the total size of the messages in the outbox.
+    std::size_t bytes() const;
+
+    /// \returns true if the outbox is empty.
+    bool empty() const;
+
+    /// \param priority The lane.
+    /// \returns the state of the lane.
+    LaneStats laneStats(Settings::Priority priority) const;
+
+private:
+    Outbox(const Outbox&) = delete;
+    Outbox& operator = (const Outbox&) = delete;
+
+    /// \brief A node of the incoming stack.
+    struct Node
+    {
+        Entry entry;
+        Node* next = nullptr;
+    };
+
+    /// \brief A queue of messages of one priority.
+    struct Lane
+    {
+        /// \brief The most recently pushed message.
+        std::atomic<Node*> incoming;
+
+        /// \brief Messages taken from the incoming stack, oldest first.
+        std::deque<Entry> ready;
+
+        /// \brief The number of messages in the lane.
+        std::atomic<std::size_t> size;
+
+        /// \brief The number of messages per turn.
+        std::size_t weight = 1;
+
+        /// \brief The messages left in the current turn.
+        std::size_t deficit = 0;
+
+        /// \brief The number of messages taken.
+        uint64_t taken = 0;
+
+        /// \brief The moving average wait.
+        std::chrono::steady_clock::duration averageWait = std::chrono::steady_clock::duration::zero();
+
+        /// \brief The longest wait.
+        std::chrono::steady_clock::duration maxWait = std::chrono::steady_clock::duration::zero();
+
+        Lane(): incoming(nullptr), size(0)
+        {
+        }
+    };
+
+    /// \brief Reserve room for a message.
+    /// \returns false if the outbox is full.
+    bool reserve(std::size_t size);
+
+    /// \brief Link a message whose room was reserved onto its lane's stack.
+    void link(const Entry& entry);
+
+    /// \returns the lane of a message.
+    Lane& lane(const Entry& entry);
+
+    /// \brief Release the room of a message that was taken.
+    void release(std::size_t size);
+
+    /// \brief Move a lane's incoming stack to its ready queue, in push order.
+    ///
+    /// Must be called with _readyMutex held.
+    void takeIncoming(Lane& lane);
+
+    /// \brief The lanes, most urgent first.
+    std::array<Lane, Settings::NUM_PRIORITIES> _lanes;
+
+    /// \brief The lane currently being served. The first turn goes to the
+    /// most urgent lane.
+    std::size_t _currentLane = Settings::NUM_PRIORITIES - 1;
+
+    /// \brief The mutex protecting the ready queues, used by workers only.
+    mutable std::mutex _readyMutex;
+
+    /// \brief The number of messages in the outbox.
+    std::atomic<std::size_t> _size;
+
+    /// \brief The total size of the messages in the outbox.
+    std::atomic<std::size_t> _bytes;
+
+    /// \brief The maximum number of messages, or 0.
+    std::size_t _capacity = 0;
+
+    /// \brief The maximum total size, or 0.
+    std::size_t _byteCapacity = 0;
+
+    /// \brief The mutex used by producers waiting for room.
+    std::mutex _spaceMutex;
+
+    /// \brief Signalled when room is released.
+    std::condition_variable _spaceAvailable;
+
+    /// \brief The number of producers waiting for room.
+    std::atomic<std::size_t> _waitingProducers;
+
+    /// \brief True once close() was called.
+    std::atomic<bool> _isClosed;
+
+};
+
+
+} } // namespace ofx::SMTP
@@ -0,0 +1,93 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+
+
+namespace ofx {
+namespace SMTP {
+
+
+/// \brief An adaptive token bucket shared by the workers of a relay.
+///
+/// Tokens are added at the current rate up to the burst size, and each
+/// message takes one. A worker that finds the bucket empty reserves the next
+/// token anyway and waits for it, so waiting workers are served in order.
+///
+/// The rate adapts to the relay. A throttling reply halves it, down to the
+/// minimum rate, and each successful delivery raises it by 1 / rate, so that
+/// the rate grows by about one message per second every second until it
+/// reaches the maximum rate.
+class RateLimiter
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    /// \brief Create an unlimited RateLimiter.
+    RateLimiter();
+
+    /// \brief Destroy the RateLimiter.
+    ~RateLimiter();
+
+    /// \brief Configure the limiter. The bucket starts full.
+    /// \param rate The initial rate in messages per second, or 0 for no limit.
+    /// \param burst The number of messages that may be sent without waiting.
+    /// \param minRate The lowest rate throttling may reduce the rate to.
+    /// \param maxRate The highest rate successes may raise the rate to, or 0
+    ///        for no upper bound.
+    void setup(double rate, std::size_t burst, double minRate, double maxRate);
+
+    /// \brief Take a token for one message.
+    /// \returns the time at which the message may be sent.
+    Clock::time_point acquire();
+
+    /// \brief Report a successful delivery.
+    void succeeded();
+
+    /// \brief Report a throttling reply, such as 421 or 451.
+    void throttled();
+
+    /// \returns the current rate in messages per second, or 0 for no limit.
+    double rate() const;
+
+private:
+    /// \brief Add the tokens earned since the last update.
+    void refill(Clock::time_point now);
+
+    /// \brief The current rate, or 0 for no limit.
+    double _rate = 0;
+
+    /// \brief The lowest rate.
+    double _minRate = 0;
+
+    /// \brief The highest rate.
+    double _maxRate = 0;
+
+    /// \brief The bucket size.
+    double _burst = 1;
+
+    /// \brief The available tokens, negative while tokens are reserved.
+    double _tokens = 0;
+
+    /// \brief The time tokens were last added.
+    Clock::time_point _updated;
+
+    /// \brief The time of the last rate decrease.
+    Clock::time_point _decreased;
+
+    /// \brief The mutex protecting the bucket.
+    mutable std::mutex _mutex;
+
+};
+
+
+} } // namespace ofx::SMTP
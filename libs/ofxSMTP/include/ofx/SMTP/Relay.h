@@ -0,0 +1,111 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include "ofx/SMTP/RateLimiter.h"
+#include "ofx/SMTP/Settings.h"
+
+
+namespace ofx {
+namespace SMTP {
+
+
+/// \brief An SMTP relay server and its health.
+///
+/// The health of a relay is tracked as moving averages of its delivery
+/// latency and error rate. A relay that fails, by refusing or dropping a
+/// connection, timing out or closing the session with 421, is taken out of
+/// rotation for a cooldown that doubles with each consecutive failure, so
+/// that messages fail over at once instead of each waiting for the same
+/// timeout. After the cooldown the relay is tried again, and the first
+/// success restores it.
+class Relay
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    /// \brief Create a Relay.
+    /// \param settings The relay settings.
+    Relay(const Settings& settings);
+
+    /// \brief Destroy the Relay.
+    ~Relay();
+
+    /// \returns the relay settings.
+    const Settings& settings() const;
+
+    /// \returns the send rate limiter of the relay.
+    RateLimiter& rateLimiter();
+
+    /// \brief Report a successful delivery.
+    /// \param latency The time taken to deliver the message.
+    void succeeded(Clock::duration latency);
+
+    /// \brief Report a failure of the relay and start its cooldown.
+    void failed();
+
+    /// \param now The current time.
+    /// \returns true if the relay is not cooling down.
+    bool isAvailable(Clock::time_point now = Clock::now()) const;
+
+    /// \returns the time the relay's cooldown ends.
+    Clock::time_point availableAt() const;
+
+    /// \returns the moving average delivery latency.
+    Clock::duration latency() const;
+
+    /// \returns the moving average error rate, from 0 to 1.
+    double errorRate() const;
+
+    /// \brief Get the health score used to balance the load.
+    ///
+    /// The score is the relay weight, divided by the average latency in
+    /// seconds and scaled down by the error rate.
+    ///
+    /// \returns the health score, or 0 for a backup relay.
+    double score() const;
+
+    /// \brief The cooldown after the first failure.
+    static const Clock::duration INITIAL_COOLDOWN;
+
+    /// \brief The longest cooldown.
+    static const Clock::duration MAX_COOLDOWN;
+
+private:
+    Relay(const Relay&) = delete;
+    Relay& operator = (const Relay&) = delete;
+
+    /// \brief The relay settings.
+    const Settings _settings;
+
+    /// \brief The send rate limiter.
+    RateLimiter _rateLimiter;
+
+    /// \brief The moving average latency in seconds.
+    double _latency = 0.1;
+
+    /// \brief The moving average error rate.
+    double _errorRate = 0;
+
+    /// \brief The number of failures since the last success.
+    std::size_t _failures = 0;
+
+    /// \brief The end of the cooldown.
+    Clock::time_point _availableAt;
+
+    /// \brief The mutex protecting the health.
+    mutable std::mutex _mutex;
+
+};
+
+
+} } // namespace ofx::SMTP
@@ -0,0 +1,59 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <memory>
+#include <vector>
+#include "ofx/SMTP/Relay.h"
+
+
+namespace ofx {
+namespace SMTP {
+
+
+/// \brief The relays a Client delivers through.
+///
+/// Each new connection picks an available relay at random, in proportion
+/// to its Relay::score(), so that slow or failing relays get less of the
+/// load. Backup relays, with a weight of 0, are only picked, in order, when
+/// no weighted relay is available.
+class RelayPool
+{
+public:
+    /// \brief Create an empty RelayPool.
+    RelayPool();
+
+    /// \brief Destroy the RelayPool.
+    ~RelayPool();
+
+    /// \brief Set the relays.
+    /// \param relays The relay settings, in failover order.
+    void setup(const std::vector<Settings>& relays);
+
+    /// \brief Pick a relay for a new connection.
+    /// \returns an available relay, or nullptr if all are cooling down.
+    std::shared_ptr<Relay> select() const;
+
+    /// \returns true if any relay is available.
+    bool hasAvailable() const;
+
+    /// \returns the time the first relay becomes available again.
+    Relay::Clock::time_point nextAvailable() const;
+
+    /// \returns the relays, in failover order.
+    const std::vector<std::shared_ptr<Relay>>& relays() const;
+
+private:
+    /// \brief The relays, in failover order.
+    std::vector<std::shared_ptr<Relay>> _relays;
+
+};
+
+
+} } // namespace ofx::SMTP
@@ -0,0 +1,103 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Poco/Timespan.h"
+#include "Poco/Net/IPAddress.h"
+#include "Poco/Net/SocketAddress.h"
+
+
+namespace ofx {
+namespace SMTP {
+
+
+/// \brief A thread safe cache of resolved server addresses.
+///
+/// Poco::Net::DNS does not report record TTLs, so resolved addresses are
+/// kept for a fixed time. If the resolver fails once an entry has expired,
+/// the expired addresses are used rather than failing the connection.
+///
+/// Addresses are returned in the order recommended by RFC 8305, alternating
+/// between IPv6 and IPv4, with the address of the last successful connection
+/// first.
+class Resolver
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    /// \brief Create an empty Resolver.
+    Resolver();
+
+    /// \brief Destroy the Resolver.
+    ~Resolver();
+
+    /// \brief Set how long resolved addresses are kept.
+    /// \param ttl The time to keep addresses, or 0 to resolve every time.
+    void setTTL(const Poco::Timespan& ttl);
+
+    /// \brief Get the addresses of a host.
+    ///
+    /// The host is resolved if it is not cached. IP address literals are
+    /// returned without a lookup.
+    ///
+    /// \param host The host name or address.
+    /// \param port The port of the returned socket addresses.
+    /// \returns the addresses to try, in order.
+    /// \throws Poco::Net::HostNotFoundException or
+    ///         Poco::Net::NoAddressFoundException if the host cannot be
+    ///         resolved and is not cached.
+    std::vector<Poco::Net::SocketAddress> resolve(const std::string& host,
+                                                  uint16_t port);
+
+    /// \brief Try an address of a host first from now on.
+    /// \param host The host name.
+    /// \param address The address a connection succeeded to.
+    void succeeded(const std::string& host, const Poco::Net::IPAddress& address);
+
+    /// \brief Forget the addresses of all hosts.
+    void clear();
+
+    /// \returns the number of cached hosts.
+    std::size_t size() const;
+
+private:
+    /// \brief The cached addresses of a host.
+    struct Entry
+    {
+        /// \brief The addresses, in the order they are tried.
+        std::vector<Poco::Net::IPAddress> addresses;
+
+        /// \brief The time the addresses expire.
+        Clock::time_point expires;
+    };
+
+    /// \brief Sort addresses by alternating address families.
+    /// \param addresses The addresses in resolver order.
+    /// \returns the addresses in the order they are tried.
+    static std::vector<Poco::Net::IPAddress> interleave(const std::vector<Poco::Net::IPAddress>& addresses);
+
+    /// \brief The time to keep addresses.
+    Clock::duration _ttl = std::chrono::minutes(1);
+
+    /// \brief The cached addresses by host name.
+    std::map<std::string, Entry> _entries;
+
+    /// \brief The mutex protecting the entries.
+    mutable std::mutex _mutex;
+
+};
+
+
+} } // namespace ofx::SMTP
@@ -0,0 +1,121 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "ofx/SMTP/Outbox.h"
+
+
+namespace ofx {
+namespace SMTP {
+
+
+/// \brief Holds failed messages until they are due to be retried.
+///
+/// Messages are kept in a hashed timing wheel: a ring of slots, each
+/// covering one tick. Scheduling a message and taking the due messages cost
+/// the same however many messages are waiting, and messages that are not
+/// due never reach the outbox, so they do not hold up the messages behind
+/// them.
+class RetryScheduler
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    /// \brief Create an empty RetryScheduler.
+    /// \param tick The time covered by a slot.
+    /// \param slots The number of slots in the wheel.
+    RetryScheduler(Clock::duration tick = std::chrono::milliseconds(DEFAULT_TICK_MILLISECONDS),
+                   std::size_t slots = DEFAULT_SLOTS);
+
+    /// \brief Destroy the RetryScheduler.
+    ~RetryScheduler();
+
+    /// \brief Schedule a message.
+    /// \param entry The message.
+    /// \param due The time at which the message should be retried.
+    void schedule(const Outbox::Entry& entry, Clock::time_point due);
+
+    /// \brief Take the messages that are due.
+    /// \param now The current time.
+    /// \param entries Filled with the due messages, earliest first.
+    /// \returns true if any message was due.
+    bool takeDue(Clock::time_point now, std::vector<Outbox::Entry>& entries);
+
+    /// \returns the time the next message is due, or Clock::time_point::max().
+    Clock::time_point nextDue() const;
+
+    /// \returns the number of scheduled messages.
+    std::size_t size() const;
+
+    /// \brief Take every scheduled message, due or not.
+    /// \param entries Filled with the messages.
+    void takeAll(std::vector<Outbox::Entry>& entries);
+
+    /// \brief Calculate a jittered exponential backoff.
+    ///
+    /// The delay doubles with each attempt, up to the maximum, and a random
+    /// delay between half and all of it is chosen so that messages that
+    /// failed together are not retried together.
+    ///
+    /// \param attempts The number of attempts made so far.
+    /// \param initialDelay The delay after the first attempt.
+    /// \param maxDelay The longest delay.
+    /// \returns the delay before the next attempt.
+    static Clock::duration backoff(std::size_t attempts,
+                                   Clock::duration initialDelay,
+                                   Clock::duration maxDelay);
+
+    enum
+    {
+        /// \brief The default tick in milliseconds.
+        DEFAULT_TICK_MILLISECONDS = 100,
+        /// \brief The default number of slots.
+        DEFAULT_SLOTS = 1024
+    };
+
+private:
+    /// \brief A scheduled message.
+    struct Timer
+    {
+        /// \brief The tick at which the message is due.
+        uint64_t tick;
+
+        /// \brief The message.
+        Outbox::Entry entry;
+    };
+
+    /// \returns the tick containing a time.
+    uint64_t tickOf(Clock::time_point time) const;
+
+    /// \brief The time covered by a slot.
+    Clock::duration _tick;
+
+    /// \brief The time of tick 0.
+    Clock::time_point _start;
+
+    /// \brief The wheel.
+    std::vector<std::vector<Timer>> _slots;
+
+    /// \brief The first tick that has not been taken.
+    uint64_t _currentTick = 0;
+
+    /// \brief The number of scheduled messages.
+    std::size_t _size = 0;
+
+    /// \brief The mutex protecting the wheel.
+    mutable std::mutex _mutex;
+
+};
+
+
+} } // namespace ofx::SMTP
@@ -9,6 +9,7 @@
 
 
 #include <string>
+#include <vector>
 #include "Poco/Timespan.h"
 #include "Poco/Util/AbstractConfiguration.h"
 #include "ofx/SMTP/Credentials.h"
@@ -35,13 +36,57 @@ public:
         STARTTLS
     };
 
+    /// \brief What Client::send() does when the outbox is full.
+    enum OverflowPolicy
+    {
+        /// \brief Wait until a worker makes room.
+        BLOCK,
+        /// \brief Reject the new message.
+        FAIL,
+        /// \brief Drop the oldest queued messages to make room.
+        DROP_OLDEST,
+        /// \brief Write the new message to the spool directory.
+        SPILL
+    };
+
+    /// \brief Where the Client notifies its events.
+    enum EventDispatch
+    {
+        /// \brief On the delivery thread, as each event happens.
+        INLINE,
+        /// \brief In batches, on a dispatcher thread of the Client.
+        DISPATCHER_THREAD,
+        /// \brief In batches, from the app's update loop.
+        UPDATE_LOOP
+    };
+
+    /// \brief The priority of a message, most urgent first.
+    enum Priority
+    {
+        /// \brief Pages and alerts that must not wait behind other mail.
+        URGENT,
+        /// \brief Mail a person is waiting for.
+        HIGH,
+        /// \brief Regular mail.
+        NORMAL,
+        /// \brief Newsletters and other mass mail.
+        BULK
+    };
+
+    enum
+    {
+        /// \brief The number of priorities.
+        NUM_PRIORITIES = 4
+    };
+
     /// \brief Create SMTP Settings.
     /// \param host The SMTP server host.
     /// \param port The SMTP server port.
     /// \param credentials The SMTP Credentials settings.
     /// \param encryption The SMTP encryption settings.
     /// \param timeout The client timeout.
-    /// \param messageSendDelay The delay between sending messages.
+    /// \param messageSendDelay The delay between sending messages, used as
+    ///        the initial send rate, or 0 for no limit. See setSendRate().
     Settings(const std::string& host = "",
              uint16_t port = DEFAULT_SMTP_PORT,
              Credentials credentials = Credentials(),
@@ -73,9 +118,325 @@ public:
     OF_DEPRECATED_MSG("Use timeout().", Poco::Timespan getTimeout() const);
 
     /// \returns The delay between sending message.
+    /// \note Messages are no longer sent with a fixed delay. The delay given
+    ///       to the constructor only sets the initial sendRate().
     Poco::Timespan messageSendDelay() const;
     OF_DEPRECATED_MSG("Use messageSendDelay().", Poco::Timespan getMessageSendDelay() const);
 
+    /// \brief Set the share of connections given to this relay.
+    ///
+    /// When a Client is set up with several relays, new connections are
+    /// spread over the healthy relays in proportion to their weight and
+    /// health. Relays with a weight of 0 are backups, used in order only
+    /// while no weighted relay is healthy.
+    ///
+    /// \param weight The relay weight.
+    void setRelayWeight(std::size_t weight);
+
+    /// \returns The relay weight.
+    std::size_t relayWeight() const;
+
+    /// \brief Set the rate at which messages are sent to the relay.
+    ///
+    /// The rate is shared by all connections and enforced with a token
+    /// bucket. It adapts to the relay: 421 and 451 replies halve it, down to
+    /// minSendRate(), and successful deliveries raise it again, up to
+    /// maxSendRate().
+    ///
+    /// \param rate The rate in messages per second, or 0 for no limit.
+    void setSendRate(double rate);
+
+    /// \returns The initial send rate in messages per second, or 0.
+    double sendRate() const;
+
+    /// \brief Set the number of messages that may be sent without waiting.
+    /// \param burst The burst size, clamped to at least 1.
+    void setSendBurst(std::size_t burst);
+
+    /// \returns The send burst size.
+    std::size_t sendBurst() const;
+
+    /// \brief Set the lowest rate throttling replies may reduce the rate to.
+    /// \param rate The rate in messages per second.
+    void setMinSendRate(double rate);
+
+    /// \returns The minimum send rate in messages per second.
+    double minSendRate() const;
+
+    /// \brief Set the highest rate successful deliveries may raise the rate to.
+    ///
+    /// With the default of 0 the rate keeps growing until the relay
+    /// throttles, so it settles at the relay's real quota. Set this to the
+    /// quota, if known, to never exceed it.
+    ///
+    /// \param rate The rate in messages per second, or 0 for no upper bound.
+    void setMaxSendRate(double rate);
+
+    /// \returns The maximum send rate in messages per second, or 0 for no
+    ///          upper bound.
+    double maxSendRate() const;
+
+    /// \brief Set the delay before a failed message is first retried.
+    ///
+    /// The delay doubles after each failed attempt, up to maxRetryDelay(),
+    /// and is randomized by up to half so that messages that failed together
+    /// are not retried together.
+    ///
+    /// \param delay The initial retry delay.
+    void setRetryDelay(const Poco::Timespan& delay);
+
+    /// \returns The initial retry delay.
+    Poco::Timespan retryDelay() const;
+
+    /// \brief Set the longest delay between two attempts.
+    /// \param delay The maximum retry delay.
+    void setMaxRetryDelay(const Poco::Timespan& delay);
+
+    /// \returns The maximum retry delay.
+    Poco::Timespan maxRetryDelay() const;
+
+    /// \brief Set the number of attempts after which a message is given up.
+    /// \param attempts The number of attempts, or 0 for no limit.
+    void setMaxAttempts(std::size_t attempts);
+
+    /// \returns The maximum number of attempts, or 0.
+    std::size_t maxAttempts() const;
+
+    /// \brief Set the age after which a failed message is not retried.
+    /// \param age The maximum age, or 0 for no limit.
+    void setMaxMessageAge(const Poco::Timespan& age);
+
+    /// \returns The maximum message age, or 0.
+    Poco::Timespan maxMessageAge() const;
+
+    /// \brief Set the share of deliveries given to a priority.
+    ///
+    /// While several priorities have queued messages, each in turn, from
+    /// the most urgent, delivers up to its weight in messages. The default
+    /// weights are 8, 4, 2 and 1, so bulk mail gets at least one message in
+    /// fifteen and urgent mail waits for at most seven others.
+    ///
+    /// \param priority The priority.
+    /// \param weight The weight, clamped to at least 1.
+    void setPriorityWeight(Priority priority, std::size_t weight);
+
+    /// \param priority The priority.
+    /// \returns The weight of the priority.
+    std::size_t priorityWeight(Priority priority) const;
+
+    /// \brief Convert a Settings::Priority to its lower case name.
+    /// \param priority The priority to convert.
+    /// \returns the name of the priority.
+    static std::string priorityToString(Priority priority);
+
+    /// \brief Set the maximum number of simultaneous server connections.
+    ///
+    /// Each connection is served by its own worker thread. Workers share a
+    /// single outbox and deliver messages in parallel. Relays often limit the
+    /// number of concurrent connections per account, so check with your
+    /// provider before raising this value.
+    ///
+    /// \param maxConnections The number of connections, clamped to at least 1.
+    void setMaxConnections(std::size_t maxConnections);
+
+    /// \returns The maximum number of simultaneous server connections.
+    std::size_t maxConnections() const;
+
+    /// \brief Set how long an authenticated connection may stay idle.
+    ///
+    /// When the outbox is empty, connections are kept open for this long so
+    /// that the next message does not pay for a new connection, TLS handshake
+    /// and login. A value of zero closes connections as soon as the outbox is
+    /// drained.
+    ///
+    /// \param idleTimeout The idle timeout.
+    void setIdleTimeout(const Poco::Timespan& idleTimeout);
+
+    /// \returns The idle connection timeout.
+    Poco::Timespan idleTimeout() const;
+
+    /// \brief Set the interval between NOOP commands on idle connections.
+    ///
+    /// A value of zero disables keep alive commands.
+    ///
+    /// \param keepAliveInterval The keep alive interval.
+    void setKeepAliveInterval(const Poco::Timespan& keepAliveInterval);
+
+    /// \returns The interval between NOOP commands on idle connections.
+    Poco::Timespan keepAliveInterval() const;
+
+    /// \brief Set the delay before racing the next server address.
+    ///
+    /// When a host has several addresses, a connection to the next one is
+    /// started if the previous one has not connected within this delay.
+    /// RFC 8305 recommends 250 milliseconds.
+    ///
+    /// \param connectionAttemptDelay The connection attempt delay.
+    void setConnectionAttemptDelay(const Poco::Timespan& connectionAttemptDelay);
+
+    /// \returns The delay before racing the next server address.
+    Poco::Timespan connectionAttemptDelay() const;
+
+    /// \brief Set how long resolved server addresses are cached.
+    ///
+    /// Addresses are resolved again after this time, or kept if the
+    /// resolver then fails. A value of zero resolves on every connection.
+    ///
+    /// \param dnsCacheTTL The time to keep resolved addresses.
+    void setDNSCacheTTL(const Poco::Timespan& dnsCacheTTL);
+
+    /// \returns How long resolved server addresses are cached.
+    Poco::Timespan dnsCacheTTL() const;
+
+    /// \brief Render messages to their wire format when they are queued.
+    ///
+    /// When enabled, Client::send() performs the MIME assembly and transfer
+    /// encoding on the calling thread, and delivery workers only write the
+    /// ready bytes. This moves CPU work off the delivery threads at the cost
+    /// of keeping each rendered message in memory until it is sent.
+    ///
+    /// When disabled, messages with base64 parts are rendered by the delivery
+    /// worker, so that their parts are still encoded with the vectorized
+    /// Base64 encoder.
+    ///
+    /// \param preRenderMessages True to render messages when queued.
+    void setPreRenderMessages(bool preRenderMessages);
+
+    /// \returns true if messages are rendered when they are queued.
+    bool preRenderMessages() const;
+
+    /// \brief Set the maximum number of recipients in one transaction.
+    ///
+    /// Messages sent with Client::sendBulk() are split into transactions of
+    /// at most this many RCPT TO commands. Servers must accept at least 100
+    /// recipients per transaction (RFC 5321). Recipients refused with 452
+    /// because a server's own limit is lower are sent in the next
+    /// transaction.
+    ///
+    /// \param maxRecipients The number of recipients, or 0 for no limit.
+    void setMaxRecipientsPerMessage(std::size_t maxRecipients);
+
+    /// \returns The maximum number of recipients in one transaction, or 0.
+    std::size_t maxRecipientsPerMessage() const;
+
+    /// \brief Set the file used to persist TLS sessions across restarts.
+    ///
+    /// The file is loaded by Client::setup() and rewritten whenever a new
+    /// session is negotiated. An empty file name keeps sessions in memory
+    /// only.
+    ///
+    /// The file holds the master secret of each session, which is enough to
+    /// decrypt the traffic of those sessions, so treat it like a private key.
+    /// It is written readable by its owner only, and should not be kept in a
+    /// shared or synced folder.
+    ///
+    /// \param filename The cache file name, relative to the data folder.
+    void setTLSSessionCacheFile(const std::string& filename);
+
+    /// \returns The file used to persist TLS sessions or an empty string.
+    std::string tlsSessionCacheFile() const;
+
+    /// \brief Set the maximum number of messages held in the outbox.
+    /// \param capacity The number of messages, or 0 for no limit.
+    void setOutboxCapacity(std::size_t capacity);
+
+    /// \returns The maximum number of messages in the outbox, or 0.
+    std::size_t outboxCapacity() const;
+
+    /// \brief Set the maximum total size of the messages in the outbox.
+    ///
+    /// The size of a message is only known once it is rendered, so setting
+    /// a byte capacity renders messages when they are queued, as with
+    /// setPreRenderMessages().
+    ///
+    /// \param capacity The size in bytes, or 0 for no limit.
+    void setOutboxByteCapacity(std::size_t capacity);
+
+    /// \returns The maximum total size of the outbox in bytes, or 0.
+    std::size_t outboxByteCapacity() const;
+
+    /// \brief Set what happens to new messages when the outbox is full.
+    ///
+    /// The SPILL policy requires a spool directory and renders messages
+    /// when they are queued.
+    ///
+    /// \param policy The overflow policy.
+    void setOverflowPolicy(OverflowPolicy policy);
+
+    /// \returns The outbox overflow policy.
+    OverflowPolicy overflowPolicy() const;
+
+    /// \brief Set the directory messages are spilled to.
+    /// \param directory The directory, relative to the data folder.
+    void setSpoolDirectory(const std::string& directory);
+
+    /// \returns The spool directory or an empty string.
+    std::string spoolDirectory() const;
+
+    /// \brief Set the directory of the write-ahead journal.
+    ///
+    /// When set, every queued message is journaled before send() returns
+    /// and messages that were not delivered are queued again by
+    /// Client::setup() after a restart. Journaling renders messages when
+    /// they are queued.
+    ///
+    /// \param directory The directory, relative to the data folder, or an
+    ///        empty string to disable the journal.
+    void setJournalDirectory(const std::string& directory);
+
+    /// \returns The journal directory or an empty string.
+    std::string journalDirectory() const;
+
+    /// \brief Set the longest time a journaled message waits to be synced.
+    ///
+    /// Messages journaled within one interval share a single sync. With an
+    /// interval of zero send() waits until the message is on the disk,
+    /// sharing the sync with all concurrent senders.
+    ///
+    /// With an interval above zero, including the default of 20 ms, send()
+    /// returns before the message is synced. A crash of the application
+    /// loses nothing, but a power loss or operating system crash loses the
+    /// messages queued within the last interval. Use zero when every queued
+    /// message must survive those.
+    ///
+    /// \param interval The sync interval.
+    void setJournalSyncInterval(const Poco::Timespan& interval);
+
+    /// \returns The journal sync interval.
+    Poco::Timespan journalSyncInterval() const;
+
+    /// \brief Set the size at which a new journal segment file is started.
+    /// \param size The segment size in bytes.
+    void setJournalSegmentSize(std::size_t size);
+
+    /// \returns The journal segment size in bytes.
+    std::size_t journalSegmentSize() const;
+
+    /// \brief Set where the Client notifies its events.
+    ///
+    /// By default listeners are called on the delivery threads, which wait
+    /// for them. Otherwise events are posted to a lock-free queue and
+    /// notified in batches by a dispatcher thread, or by the app's update
+    /// loop so listeners can touch the GUI. Each batch is also notified at
+    /// once by ClientEvents::onSMTPResultBatch.
+    ///
+    /// \param dispatch Where events are notified.
+    void setEventDispatch(EventDispatch dispatch);
+
+    /// \returns Where the Client notifies its events.
+    EventDispatch eventDispatch() const;
+
+    /// \brief Set the largest number of events notified in one batch.
+    ///
+    /// The update loop notifies one batch per frame, so this bounds the
+    /// time a frame spends in listeners.
+    ///
+    /// \param size The number of events, at least 1.
+    void setMaxEventBatchSize(std::size_t size);
+
+    /// \returns The largest number of events notified in one batch.
+    std::size_t maxEventBatchSize() const;
+
     /// \brief Load settings from JSON.
     /// \param json The JSON.
     /// \returns Settings loaded from a file.
@@ -91,6 +452,29 @@ public:
     /// \returns Settings loaded from a file.
     static Settings loadFromJSON(const std::string& filename);
 
+    /// \brief Load the settings of all relays from an XML file.
+    /// \param filename The file name for the XML file.
+    /// \returns Settings for each relay. See loadAll().
+    static std::vector<Settings> loadAllFromXML(const std::string& filename);
+
+    /// \brief Load the settings of all relays from a JSON file.
+    /// \param filename The file name for the JSON file.
+    /// \returns Settings for each relay. See loadAll().
+    static std::vector<Settings> loadAllFromJSON(const std::string& filename);
+
+    /// \brief Load the settings of all relays.
+    ///
+    /// The top level settings describe the first relay and the options
+    /// shared by all relays. Further relays are listed in a "relays" array
+    /// in JSON, or as <relay> elements of <relays> in XML. Each may set its
+    /// own host, port, encryption, authentication, timeout, send rate and
+    /// weight, and inherits everything else.
+    ///
+    /// \param config the Poco::Util::AbstractConfiguration.
+    /// \returns Settings for each relay, the top level relay first.
+    /// \throws Poco::NotFoundException and others.
+    static std::vector<Settings> loadAll(const Poco::Util::AbstractConfiguration& config);
+
     /// \brief Load the settings from a Poco::Util::AbstractConfiguration.
     /// \param config the Poco::Util::AbstractConfiguration.
     /// \returns Settings loaded from a file.
@@ -100,9 +484,70 @@ public:
     /// \brief The default client timeout.
     static const Poco::Timespan DEFAULT_TIMEOUT;
 
-    /// \brief The delay between sending messages.
+    /// \brief The default delay between sending messages, none.
+    ///
+    /// Messages used to be sent 100 ms apart by each worker. The rate is now
+    /// shared by all workers of a relay, so it is unlimited unless a rate is
+    /// configured.
     static const Poco::Timespan DEFAULT_MESSAGE_SEND_DELAY;
 
+    /// \brief The default initial retry delay.
+    static const Poco::Timespan DEFAULT_RETRY_DELAY;
+
+    /// \brief The default maximum retry delay.
+    static const Poco::Timespan DEFAULT_MAX_RETRY_DELAY;
+
+    /// \brief The default maximum message age.
+    static const Poco::Timespan DEFAULT_MAX_MESSAGE_AGE;
+
+    /// \brief The default lowest adaptive send rate in messages per second.
+    static const double DEFAULT_MIN_SEND_RATE;
+
+    /// \brief The default idle connection timeout.
+    static const Poco::Timespan DEFAULT_IDLE_TIMEOUT;
+
+    /// \brief The default interval between NOOP commands on idle connections.
+    static const Poco::Timespan DEFAULT_KEEP_ALIVE_INTERVAL;
+
+    /// \brief The default delay before racing the next server address.
+    static const Poco::Timespan DEFAULT_CONNECTION_ATTEMPT_DELAY;
+
+    /// \brief The default time resolved server addresses are cached.
+    static const Poco::Timespan DEFAULT_DNS_CACHE_TTL;
+
+    /// \brief The default journal sync interval.
+    static const Poco::Timespan DEFAULT_JOURNAL_SYNC_INTERVAL;
+
+    enum
+    {
+        /// \brief The default number of simultaneous server connections.
+        DEFAULT_MAX_CONNECTIONS = 1
+    };
+
+    enum
+    {
+        /// \brief The default maximum number of delivery attempts.
+        DEFAULT_MAX_ATTEMPTS = 10
+    };
+
+    enum
+    {
+        /// \brief The default number of messages sent without waiting.
+        DEFAULT_SEND_BURST = 10
+    };
+
+    enum
+    {
+        /// \brief The default maximum number of recipients per transaction.
+        DEFAULT_MAX_RECIPIENTS_PER_MESSAGE = 100
+    };
+
+    enum
+    {
+        /// \brief The default largest number of events in a batch.
+        DEFAULT_MAX_EVENT_BATCH_SIZE = 256
+    };
+
     enum
     {
         /// \brief Default SMTP Port.
@@ -125,6 +570,24 @@ private:
     /// \returns the converted string.
     static std::string to_string(const Settings::EncryptionType& method);
 
+    /// \brief Load the per relay settings under a key prefix.
+    /// \param settings The settings to update.
+    /// \param config the Poco::Util::AbstractConfiguration.
+    /// \param prefix The key prefix, ending with '.', or empty.
+    static void loadRelay(Settings& settings,
+                          const Poco::Util::AbstractConfiguration& config,
+                          const std::string& prefix);
+
+    /// \brief Convert a string to a Settings::OverflowPolicy.
+    /// \param policy The policy to convert.
+    /// \returns the overflow policy.
+    static Settings::OverflowPolicy overflowPolicyFromString(const std::string& policy);
+
+    /// \brief Convert a string to a Settings::EventDispatch.
+    /// \param dispatch The dispatch to convert.
+    /// \returns the event dispatch.
+    static Settings::EventDispatch eventDispatchFromString(const std::string& dispatch);
+
     /// \brief SMTP server host.
     std::string _host;
 
@@ -143,6 +606,87 @@ private:
     /// \brief The delay between sending messages.
     Poco::Timespan _messageSendDelay;
 
+    /// \brief The weights of the priorities.
+    std::size_t _priorityWeights[NUM_PRIORITIES] = { 8, 4, 2, 1 };
+
+    /// \brief The initial retry delay.
+    Poco::Timespan _retryDelay = DEFAULT_RETRY_DELAY;
+
+    /// \brief The maximum retry delay.
+    Poco::Timespan _maxRetryDelay = DEFAULT_MAX_RETRY_DELAY;
+
+    /// \brief The maximum number of attempts, or 0.
+    std::size_t _maxAttempts = DEFAULT_MAX_ATTEMPTS;
+
+    /// \brief The maximum message age, or 0.
+    Poco::Timespan _maxMessageAge = DEFAULT_MAX_MESSAGE_AGE;
+
+    /// \brief The relay weight.
+    std::size_t _relayWeight = 1;
+
+    /// \brief The initial send rate in messages per second.
+    double _sendRate = 0;
+
+    /// \brief The send burst size.
+    std::size_t _sendBurst = DEFAULT_SEND_BURST;
+
+    /// \brief The minimum send rate.
+    double _minSendRate = DEFAULT_MIN_SEND_RATE;
+
+    /// \brief The maximum send rate, or 0.
+    double _maxSendRate = 0;
+
+    /// \brief The maximum number of simultaneous server connections.
+    std::size_t _maxConnections = DEFAULT_MAX_CONNECTIONS;
+
+    /// \brief The idle connection timeout.
+    Poco::Timespan _idleTimeout = DEFAULT_IDLE_TIMEOUT;
+
+    /// \brief The interval between NOOP commands on idle connections.
+    Poco::Timespan _keepAliveInterval = DEFAULT_KEEP_ALIVE_INTERVAL;
+
+    /// \brief The delay before racing the next server address.
+    Poco::Timespan _connectionAttemptDelay = DEFAULT_CONNECTION_ATTEMPT_DELAY;
+
+    /// \brief The time resolved server addresses are cached.
+    Poco::Timespan _dnsCacheTTL = DEFAULT_DNS_CACHE_TTL;
+
+    /// \brief The maximum number of recipients per transaction, or 0.
+    std::size_t _maxRecipientsPerMessage = DEFAULT_MAX_RECIPIENTS_PER_MESSAGE;
+
+    /// \brief The file used to persist TLS sessions.
+    std::string _tlsSessionCacheFile;
+
+    /// \brief True if messages are rendered when they are queued.
+    bool _preRenderMessages = false;
+
+    /// \brief The maximum number of messages in the outbox.
+    std::size_t _outboxCapacity = 0;
+
+    /// \brief The maximum total size of the outbox in bytes.
+    std::size_t _outboxByteCapacity = 0;
+
+    /// \brief The outbox overflow policy.
+    OverflowPolicy _overflowPolicy = BLOCK;
+
+    /// \brief The spool directory.
+    std::string _spoolDirectory;
+
+    /// \brief The journal directory.
+    std::string _journalDirectory;
+
+    /// \brief The journal sync interval.
+    Poco::Timespan _journalSyncInterval = DEFAULT_JOURNAL_SYNC_INTERVAL;
+
+    /// \brief The journal segment size.
+    std::size_t _journalSegmentSize;
+
+    /// \brief Where the Client notifies its events.
+    EventDispatch _eventDispatch = INLINE;
+
+    /// \brief The largest number of events notified in one batch.
+    std::size_t _maxEventBatchSize = DEFAULT_MAX_EVENT_BATCH_SIZE;
+
 };
 
 
@@ -0,0 +1,144 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "ofx/SMTP/Outbox.h"
+
+
+namespace ofx {
+namespace SMTP {
+
+
+/// \brief A directory of messages waiting for room in the outbox.
+///
+/// Each message is written to its own file with WireMessage::serialize(),
+/// named by a sequence number. A file is written under a temporary name
+/// and only renamed into place once complete. Messages are taken back
+/// most urgent first and, within a priority, in the order they were
+/// spilled. Files left behind by a previous run are picked up by open().
+///
+/// A spooled message keeps its Journal id, so that a message that is both
+/// spooled and journaled is only restored once after a restart. Its
+/// DeliveryTicket is kept in memory.
+class Spool
+{
+public:
+    /// \brief Create a closed Spool.
+    Spool();
+
+    /// \brief A tracked message in the spool.
+    struct Tracked
+    {
+        /// \brief The ticket of the message.
+        DeliveryTicket ticket;
+
+        /// \brief The envelope recipients of the message.
+        std::vector<std::string> recipients;
+    };
+
+    /// \brief Destroy the Spool.
+    ~Spool();
+
+    /// \brief Open a spool directory, creating it if needed.
+    /// \param directory The directory, relative to the data folder.
+    /// \returns true if the directory could be opened.
+    bool open(const std::string& directory);
+
+    /// \returns true if the spool is open.
+    bool isOpen() const;
+
+    /// \brief Write a message to the spool.
+    /// \param message The message to write.
+    /// \param priority The priority of the message.
+    /// \param journalId The Journal id of the message, or 0.
+    /// \param ticket The ticket of the message, if tracked.
+    /// \returns true if the message was written.
+    bool put(const WireMessage& message,
+             Settings::Priority priority,
+             uint64_t journalId = 0,
+             const DeliveryTicket& ticket = DeliveryTicket());
+
+    /// \brief Take the oldest message of the most urgent priority.
+    ///
+    /// Unreadable files are removed and skipped.
+    ///
+    /// \param entry Set to the message taken.
+    /// \param unreadable Appended with the tracked messages that were
+    ///        skipped, so that their tickets can be completed.
+    /// \returns false if the spool is empty.
+    bool take(Outbox::Entry& entry, std::vector<Tracked>& unreadable);
+
+    /// \returns the number of messages in the spool.
+    std::size_t size() const;
+
+    /// \returns true if the spool is empty.
+    bool empty() const;
+
+    /// \param priority A priority.
+    /// \returns true if no message of the priority is spooled.
+    bool empty(Settings::Priority priority) const;
+
+    /// \brief Get the most urgent priority of the spooled messages.
+    /// \param priority Set to the priority.
+    /// \returns false if the spool is empty.
+    bool mostUrgent(Settings::Priority& priority) const;
+
+    /// \param journalId A Journal id.
+    /// \returns true if a spooled message has the given Journal id.
+    bool contains(uint64_t journalId) const;
+
+    /// \brief Take the tickets of the spooled messages.
+    ///
+    /// The messages stay in the spool, untracked.
+    ///
+    /// \returns the tracked messages.
+    std::vector<Tracked> takeTickets();
+
+private:
+    Spool(const Spool&) = delete;
+    Spool& operator = (const Spool&) = delete;
+
+    /// \returns the path of the file with the given sequence number.
+    std::string path(uint64_t sequence) const;
+
+    /// \brief The spool directory.
+    std::string _directory;
+
+    /// \brief The sequence numbers of the spooled messages of each
+    ///        priority, oldest first.
+    std::array<std::deque<uint64_t>, Settings::NUM_PRIORITIES> _sequences;
+
+    /// \brief The Journal ids of the spooled messages.
+    std::unordered_set<uint64_t> _journalIds;
+
+    /// \brief The tracked spooled messages, by sequence number.
+    std::unordered_map<uint64_t, Tracked> _tickets;
+
+    /// \brief The next sequence number.
+    uint64_t _nextSequence = 0;
+
+    /// \brief The number of spooled messages.
+    std::atomic<std::size_t> _size;
+
+    /// \brief The mutex protecting the spool.
+    mutable std::mutex _mutex;
+
+};
+
+
+} } // namespace ofx::SMTP
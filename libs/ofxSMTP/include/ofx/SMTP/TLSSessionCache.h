@@ -0,0 +1,112 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#undef verify // this is for OSX to get around the x509 macro error.
+
+
+#include <cstdint>
+#include <ctime>
+#include <map>
+#include <mutex>
+#include <string>
+#include "Poco/Net/Session.h"
+
+
+namespace ofx {
+namespace SMTP {
+
+
+/// \brief A thread safe cache of TLS sessions keyed by server host and port.
+///
+/// Sessions can optionally be persisted to a file so that the first
+/// connections after a restart can resume a session instead of performing a
+/// full TLS handshake.
+///
+/// \warning A persisted session contains the session's master secret. Store
+/// the cache file somewhere only the application can read.
+class TLSSessionCache
+{
+public:
+    /// \brief Create an empty, memory only TLS session cache.
+    TLSSessionCache();
+
+    /// \brief Destroy the TLS session cache.
+    ~TLSSessionCache();
+
+    /// \brief Get the cached session for a server.
+    ///
+    /// Expired sessions are removed and not returned.
+    ///
+    /// \param host The server host.
+    /// \param port The server port.
+    /// \returns the cached session or nullptr.
+    Poco::Net::Session::Ptr get(const std::string& host, uint16_t port);
+
+    /// \brief Cache the session for a server.
+    ///
+    /// If a file was set with load(), it is rewritten when the session
+    /// changes.
+    ///
+    /// \param host The server host.
+    /// \param port The server port.
+    /// \param pSession The session to cache.
+    void put(const std::string& host,
+             uint16_t port,
+             Poco::Net::Session::Ptr pSession);
+
+    /// \brief Load sessions from a file and persist changes to it.
+    ///
+    /// A missing file is not an error. Expired sessions are skipped.
+    ///
+    /// \param filename The cache file name, relative to the data folder.
+    /// \returns true if the file was read or did not exist.
+    bool load(const std::string& filename);
+
+    /// \brief Write all unexpired sessions to the file set by load().
+    /// \returns true if the file was written.
+    bool save() const;
+
+    /// \returns the number of cached sessions.
+    std::size_t size() const;
+
+private:
+    /// \brief A cached session.
+    struct Entry
+    {
+        /// \brief The session.
+        Poco::Net::Session::Ptr session = nullptr;
+
+        /// \brief The time at which the session expires.
+        std::time_t expires = 0;
+    };
+
+    /// \brief Make the cache key for a server.
+    static std::string key(const std::string& host, uint16_t port);
+
+    /// \brief Calculate the expiration time for a session.
+    static std::time_t expiration(Poco::Net::Session::Ptr pSession);
+
+    /// \brief Write all unexpired sessions to the cache file.
+    /// \note _mutex must be held.
+    bool saveUnlocked() const;
+
+    /// \brief The cache file name, or empty if not persisted.
+    std::string _filename;
+
+    /// \brief The sessions mapped by host:port.
+    std::map<std::string, Entry> _sessions;
+
+    /// \brief The mutex protecting the cache.
+    mutable std::mutex _mutex;
+
+};
+
+
+} } // namespace ofx::SMTP
@@ -0,0 +1,166 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#pragma once
+
+
+#include <functional>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "Poco/SharedMemory.h"
+#include "Poco/Net/MailMessage.h"
+
+
+namespace ofx {
+namespace SMTP {
+
+
+/// \brief An immutable message rendered to its SMTP wire format.
+///
+/// Rendering performs the MIME assembly, header encoding and transfer
+/// encoding of a Poco::Net::MailMessage up front, so that a delivery worker
+/// only has to write ready bytes to the socket.
+///
+/// The content is kept in canonical form, with CRLF line endings but without
+/// dot-stuffing, so that it can be sent unchanged with BDAT. Content without
+/// lines beginning with '.' can also be sent unchanged with DATA.
+///
+/// Base64 parts are encoded with Base64::encode() rather than
+/// Poco::Base64Encoder. Base64 attachments added with a MappedFilePartSource
+/// are not copied into the rendered content. They are encoded from the mapped file while the
+/// message is written, so the memory held by a queued message does not grow
+/// with the size of its attachments.
+///
+/// Rendering does not change the message or its part sources. It does read
+/// the streams of the part sources, so a message that has been rendered
+/// should not be written again unless its sources can be read more than
+/// once, as a MappedFilePartSource can, and a message should not be rendered
+/// by two threads at once.
+class WireMessage
+{
+public:
+    /// \brief Destroy the WireMessage.
+    ~WireMessage();
+
+    /// \returns the envelope sender address, including angle brackets.
+    const std::string& sender() const;
+
+    /// \returns the envelope recipient addresses.
+    const std::vector<std::string>& recipients() const;
+
+    /// \brief A callback receiving a piece of message content.
+    typedef std::function<void(const char*, std::size_t)> Sink;
+
+    /// \brief Write the canonical message content, ending with CRLF.
+    ///
+    /// The content is passed to the sink in pieces of bounded size.
+    ///
+    /// \param sink The callback receiving the content.
+    void write(const Sink& sink) const;
+
+    /// \returns the size of the message content in bytes.
+    std::size_t size() const;
+
+    /// \returns true if the content must be dot-stuffed before DATA.
+    bool hasDotLines() const;
+
+    /// \brief Render a message to its wire format.
+    /// \param message The message to render.
+    /// \returns the rendered message.
+    static std::shared_ptr<const WireMessage> render(const Poco::Net::MailMessage& message);
+
+    /// \brief Address the same content to other envelope recipients.
+    ///
+    /// The rendered content is shared, not copied, so a message sent to many
+    /// recipients in several transactions is rendered and held only once.
+    ///
+    /// \param recipients The envelope recipient addresses.
+    /// \returns a message with the same sender and content.
+    std::shared_ptr<const WireMessage> withRecipients(const std::vector<std::string>& recipients) const;
+
+    /// \brief Write the message, including its envelope, to a stream.
+    ///
+    /// Mapped attachments are encoded into the stream.
+    ///
+    /// \param stream The stream to write to.
+    void serialize(std::ostream& stream) const;
+
+    /// \brief Read a message written by serialize().
+    /// \param stream The stream to read from.
+    /// \returns the message.
+    /// \throws Poco::DataFormatException if the data is malformed.
+    static std::shared_ptr<const WireMessage> deserialize(std::istream& stream);
+
+    /// \brief Create a message holding only the headers of this message.
+    ///
+    /// This is used to report messages that were restored from disk and no
+    /// longer have their original Poco::Net::MailMessage.
+    ///
+    /// \returns a message with the headers and recipients of this message.
+    std::shared_ptr<Poco::Net::MailMessage> headers() const;
+
+    /// \brief Extract the envelope sender from a message.
+    /// \param message The message.
+    /// \returns the sender address in angle brackets.
+    static std::string envelopeSender(const Poco::Net::MailMessage& message);
+
+    /// \brief Extract the envelope recipients from a message.
+    /// \param message The message.
+    /// \returns the recipient addresses.
+    static std::vector<std::string> envelopeRecipients(const Poco::Net::MailMessage& message);
+
+    /// \param message The message.
+    /// \returns true if a part of the message is base64 encoded.
+    static bool hasBase64Parts(const Poco::Net::MailMessage& message);
+
+private:
+    friend class MessageTemplate;
+
+    /// \brief Create an empty WireMessage.
+    WireMessage();
+
+    /// \brief The envelope sender.
+    std::string _sender;
+
+    /// \brief The envelope recipients.
+    std::vector<std::string> _recipients;
+
+    /// \brief A piece of the message content.
+    struct Segment
+    {
+        /// \brief Rendered content, if any.
+        std::shared_ptr<const std::string> text;
+
+        /// \brief A mapped file to base64 encode while writing, if any.
+        std::shared_ptr<const Poco::SharedMemory> file;
+
+        /// \brief The size of the mapped file.
+        std::size_t fileSize = 0;
+    };
+
+    enum
+    {
+        /// \brief The number of file bytes encoded per piece.
+        FILE_BLOCK_SIZE = 1024 * 54
+    };
+
+    /// \brief The message content.
+    std::vector<Segment> _segments;
+
+    /// \brief The size of the message content.
+    std::size_t _size = 0;
+
+    /// \brief True if a line of the content begins with '.'.
+    bool _hasDotLines = false;
+
+};
+
+
+} } // namespace ofx::SMTP
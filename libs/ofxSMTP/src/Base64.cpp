@@ -0,0 +1,302 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/SMTP/Base64.h"
+#include "ofx/SMTP/CPUFeatures.h"
+#include <algorithm>
+#include <cstdint>
+
+
+#if defined(OFX_SMTP_X86)
+    #include <immintrin.h>
+#endif
+
+
+namespace ofx {
+namespace SMTP {
+
+
+namespace {
+
+
+const char ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+
+/// \brief Line encoders read up to this many bytes past a full line.
+const std::size_t LINE_READ_AHEAD = 4;
+
+
+/// \brief Encode up to one line of input.
+char* encodeLineScalar(const uint8_t* in, std::size_t length, char* out)
+{
+    const uint8_t* end = in + length / 3 * 3;
+
+    for (; in != end; in += 3)
+    {
+        uint32_t group = (uint32_t(in[0]) << 16) | (uint32_t(in[1]) << 8) | in[2];
+        *out++ = ALPHABET[(group >> 18) & 0x3F];
+        *out++ = ALPHABET[(group >> 12) & 0x3F];
+        *out++ = ALPHABET[(group >> 6) & 0x3F];
+        *out++ = ALPHABET[group & 0x3F];
+    }
+
+    std::size_t remainder = length % 3;
+
+    if (remainder > 0)
+    {
+        uint32_t group = uint32_t(in[0]) << 16;
+
+        if (remainder == 2)
+            group |= uint32_t(in[1]) << 8;
+
+        *out++ = ALPHABET[(group >> 18) & 0x3F];
+        *out++ = ALPHABET[(group >> 12) & 0x3F];
+        *out++ = (remainder == 2) ? ALPHABET[(group >> 6) & 0x3F] : '=';
+        *out++ = '=';
+    }
+
+    return out;
+}
+
+
+#if defined(OFX_SMTP_X86)
+
+
+// The vector encoders follow W. Muła and D. Lemire, "Faster Base64 Encoding
+// and Decoding Using AVX2 Instructions" (2018). Each group of 3 bytes is
+// shuffled into a 32-bit lane, split into four 6-bit values with multiplies
+// and mapped to the alphabet by adding per-range offsets.
+
+
+OFX_SMTP_TARGET("ssse3")
+inline __m128i splitSSSE3(__m128i in)
+{
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    return _mm_or_si128(t1, t3);
+}
+
+
+OFX_SMTP_TARGET("ssse3")
+inline __m128i translateSSSE3(__m128i in)
+{
+    const __m128i offsets = _mm_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+    __m128i indices = _mm_subs_epu8(in, _mm_set1_epi8(51));
+    indices = _mm_sub_epi8(indices, _mm_cmpgt_epi8(in, _mm_set1_epi8(25)));
+    return _mm_add_epi8(in, _mm_shuffle_epi8(offsets, indices));
+}
+
+
+OFX_SMTP_TARGET("ssse3")
+inline void encode12SSSE3(const uint8_t* in, char* out)
+{
+    __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), translateSSSE3(splitSSSE3(input)));
+}
+
+
+/// \brief Encode a full line, reading LINE_READ_AHEAD bytes past it.
+OFX_SMTP_TARGET("ssse3")
+char* encodeLineSSSE3(const uint8_t* in, char* out)
+{
+    // Four blocks of 12 bytes, then one overlapping the third for the last
+    // 6 bytes. Overlapping blocks write the same characters.
+    encode12SSSE3(in, out);
+    encode12SSSE3(in + 12, out + 16);
+    encode12SSSE3(in + 24, out + 32);
+    encode12SSSE3(in + 36, out + 48);
+    encode12SSSE3(in + 42, out + 56);
+    return out + Base64::LINE_LENGTH;
+}
+
+
+OFX_SMTP_TARGET("avx2")
+inline __m256i splitAVX2(__m256i in)
+{
+    in = _mm256_shuffle_epi8(in, _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+                                                 10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+    __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+    __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+    __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+    return _mm256_or_si256(t1, t3);
+}
+
+
+OFX_SMTP_TARGET("avx2")
+inline __m256i translateAVX2(__m256i in)
+{
+    const __m256i offsets = _mm256_setr_epi8(65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0,
+                                             65, 71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -19, -16, 0, 0);
+    __m256i indices = _mm256_subs_epu8(in, _mm256_set1_epi8(51));
+    indices = _mm256_sub_epi8(indices, _mm256_cmpgt_epi8(in, _mm256_set1_epi8(25)));
+    return _mm256_add_epi8(in, _mm256_shuffle_epi8(offsets, indices));
+}
+
+
+OFX_SMTP_TARGET("avx2")
+inline void encode24AVX2(const uint8_t* in, char* out)
+{
+    // Each 128-bit lane holds 12 input bytes.
+    __m256i input = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in))),
+                                            _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 12)),
+                                            1);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), translateAVX2(splitAVX2(input)));
+}
+
+
+/// \brief Encode a full line, reading LINE_READ_AHEAD bytes past it.
+OFX_SMTP_TARGET("avx2")
+char* encodeLineAVX2(const uint8_t* in, char* out)
+{
+    // Two blocks of 24 bytes, then one overlapping the second for the last
+    // 6 bytes. Overlapping blocks write the same characters.
+    encode24AVX2(in, out);
+    encode24AVX2(in + 24, out + 32);
+    encode24AVX2(in + 30, out + 40);
+    return out + Base64::LINE_LENGTH;
+}
+
+
+#endif
+
+
+typedef char* (*LineEncoder)(const uint8_t* in, char* out);
+
+
+LineEncoder lineEncoder(Base64::Implementation implementation)
+{
+    if (implementation == Base64::AUTO)
+        implementation = Base64::defaultImplementation();
+
+    if (!Base64::isSupported(implementation))
+        return nullptr;
+
+#if defined(OFX_SMTP_X86)
+    switch (implementation)
+    {
+        case Base64::AVX2:
+            return encodeLineAVX2;
+        case Base64::SSSE3:
+            return encodeLineSSSE3;
+        default:
+            break;
+    }
+#endif
+
+    return nullptr;
+}
+
+
+} // namespace
+
+
+std::size_t Base64::encodedSize(std::size_t size)
+{
+    std::size_t length = (size + 2) / 3 * 4;
+
+    if (length == 0)
+        return 0;
+
+    std::size_t lines = (length + LINE_LENGTH - 1) / LINE_LENGTH;
+
+    return length + 2 * (lines - 1);
+}
+
+
+void Base64::encode(const char* data,
+                    std::size_t size,
+                    std::string& output,
+                    Implementation implementation)
+{
+    std::size_t offset = output.size();
+    output.resize(offset + encodedSize(size));
+
+    LineEncoder encodeLine = lineEncoder(implementation);
+
+    const uint8_t* in = reinterpret_cast<const uint8_t*>(data);
+    char* out = &output[offset];
+
+    while (size > 0)
+    {
+        std::size_t length = std::min(size, std::size_t(LINE_INPUT_LENGTH));
+
+        // The vector encoders read a few bytes past the line, so the final
+        // line is always encoded with the scalar encoder.
+        if (encodeLine && size >= LINE_INPUT_LENGTH + LINE_READ_AHEAD)
+        {
+            out = encodeLine(in, out);
+        }
+        else
+        {
+            out = encodeLineScalar(in, length, out);
+        }
+
+        in += length;
+        size -= length;
+
+        if (size > 0)
+        {
+            *out++ = '\r';
+            *out++ = '\n';
+        }
+    }
+}
+
+
+bool Base64::isSupported(Implementation implementation)
+{
+    switch (implementation)
+    {
+        case AUTO:
+        case SCALAR:
+            return true;
+#if defined(OFX_SMTP_X86)
+        case SSSE3:
+            return CPUFeatures::hasSSSE3();
+        case AVX2:
+            return CPUFeatures::hasAVX2();
+#endif
+        default:
+            return false;
+    }
+}
+
+
+Base64::Implementation Base64::defaultImplementation()
+{
+    if (isSupported(AVX2))
+        return AVX2;
+    else if (isSupported(SSSE3))
+        return SSSE3;
+
+    return SCALAR;
+}
+
+
+std::string Base64::toString(Implementation implementation)
+{
+    switch (implementation)
+    {
+        case AUTO:
+            return "AUTO";
+        case SCALAR:
+            return "SCALAR";
+        case SSSE3:
+            return "SSSE3";
+        case AVX2:
+            return "AVX2";
+    }
+
+    return "UNKNOWN";
+}
+
+
+} } // namespace ofx::SMTP
@@ -0,0 +1,96 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/SMTP/CPUFeatures.h"
+
+
+#if defined(OFX_SMTP_X86) && defined(_MSC_VER)
+    #include <immintrin.h>
+    #include <intrin.h>
+#endif
+
+
+namespace ofx {
+namespace SMTP {
+
+
+namespace {
+
+
+enum Feature
+{
+    SSE2,
+    SSSE3,
+    AVX2
+};
+
+
+bool detect(Feature feature)
+{
+#if !defined(OFX_SMTP_X86)
+    return false;
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int count = info[0];
+
+    if (count < 1)
+        return false;
+
+    __cpuid(info, 1);
+
+    if (feature == SSE2)
+        return (info[3] & (1 << 26)) != 0;
+    else if (feature == SSSE3)
+        return (info[2] & (1 << 9)) != 0;
+
+    // AVX2 also needs the operating system to save the YMM registers.
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+
+    if (count < 7 || !osxsave || (_xgetbv(0) & 0x6) != 0x6)
+        return false;
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+
+    if (feature == SSE2)
+        return __builtin_cpu_supports("sse2");
+    else if (feature == SSSE3)
+        return __builtin_cpu_supports("ssse3");
+
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+
+} // namespace
+
+
+bool CPUFeatures::hasSSE2()
+{
+    static const bool isSupported = detect(SSE2);
+    return isSupported;
+}
+
+
+bool CPUFeatures::hasSSSE3()
+{
+    static const bool isSupported = detect(SSSE3);
+    return isSupported;
+}
+
+
+bool CPUFeatures::hasAVX2()
+{
+    static const bool isSupported = detect(AVX2);
+    return isSupported;
+}
+
+
+} } // namespace ofx::SMTP
@@ -6,6 +6,8 @@
 
 
 #include "ofx/SMTP/Client.h"
+#include <algorithm>
+#include "Poco/Exception.h"
 #include "Poco/Net/MailMessage.h"
 
 
@@ -13,7 +15,47 @@ namespace ofx {
 namespace SMTP {
 
 
-Client::Client()
+/// \brief A delivery thread owned by a Client.
+class Client::Worker: public ofThread
+{
+public:
+    Worker(Client& client): _client(client)
+    {
+    }
+
+    void threadedFunction() override
+    {
+        _client.deliver(*this);
+    }
+
+    using ofThread::sleep;
+
+private:
+    Client& _client;
+
+};
+
+
+/// \brief A thread notifying the queued events of a Client.
+class Client::Dispatcher: public ofThread
+{
+public:
+    Dispatcher(Client& client): _client(client)
+    {
+    }
+
+    void threadedFunction() override
+    {
+        _client.dispatch(*this);
+    }
+
+private:
+    Client& _client;
+
+};
+
+
+Client::Client(): _isStarted(false), _waitingWorkers(0), _lastTicketId(0)
 {
     ofAddListener(ofEvents().exit, this, &Client::exit);
 }
@@ -22,16 +64,160 @@ Client::Client()
 Client::~Client()
 {
     ofRemoveListener(ofEvents().exit, this, &Client::exit);
-    waitForThread();
+    ofRemoveListener(ofEvents().update, this, &Client::update);
+
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        for (auto& worker: _workers)
+            worker->stopThread();
+
+        workers = std::move(_workers);
+    }
+
+    _messageReady.notify_all();
+
+    for (auto& worker: workers)
+        worker->waitForThread(false);
+
+    // Queued messages stay in the journal and the spool for the next run,
+    // but their tickets can only be completed by this Client.
+    std::vector<Outbox::Entry> entries;
+    Outbox::Entry entry;
+
+    while (_outbox.pop(entry))
+        entries.push_back(entry);
+
+    _retries.takeAll(entries);
+
+    const std::string reason = "The client was destroyed before the message was delivered.";
+
+    for (const auto& queued: entries)
+    {
+        if (!queued.ticket.isValid())
+            continue;
+
+        std::vector<std::string> recipients;
+
+        if (queued.wire)
+            recipients = queued.wire->recipients();
+        else if (queued.message)
+            recipients = WireMessage::envelopeRecipients(*queued.message);
+
+        queued.ticket.complete(DeliveryResultArgs(queued.message,
+                                                  recipients,
+                                                  DeliveryResultArgs::DROPPED,
+                                                  queued.attempts,
+                                                  reason));
+    }
+
+    for (const auto& spooled: _spool.takeTickets())
+    {
+        spooled.ticket.complete(DeliveryResultArgs(nullptr,
+                                                   spooled.recipients,
+                                                   DeliveryResultArgs::DROPPED,
+                                                   0,
+                                                   reason));
+    }
+
+    if (_dispatcher)
+    {
+        _dispatcher->stopThread();
+        _eventQueue.wake();
+        _dispatcher->waitForThread(false);
+    }
+
+    // Notify the events left by the workers.
+    while (dispatchEvents() > 0)
+    {
+    }
 }
 
 
 void Client::setup(const Settings& settings)
 {
-    if (!_isInited)
+    setup(std::vector<Settings>(1, settings));
+}
+
+
+void Client::setup(const std::vector<Settings>& relays)
+{
+    if (relays.empty())
+    {
+        ofLogError("Client::setup") << "At least one relay is required.";
+    }
+    else if (!_isInited)
     {
-        _settings = settings;
+        _settings = relays.front();
+
+        switch (_settings.eventDispatch())
+        {
+            case Settings::INLINE:
+                break;
+            case Settings::DISPATCHER_THREAD:
+                _dispatcher.reset(new Dispatcher(*this));
+                _dispatcher->startThread();
+                break;
+            case Settings::UPDATE_LOOP:
+                ofAddListener(ofEvents().update, this, &Client::update);
+                break;
+        }
+
+        if (!_settings.tlsSessionCacheFile().empty())
+        {
+            _tlsSessionCache.load(_settings.tlsSessionCacheFile());
+        }
+
+        _relays.setup(relays);
+
+        _resolver.setTTL(_settings.dnsCacheTTL());
+
+        _outbox.setCapacity(_settings.outboxCapacity(),
+                            _settings.outboxByteCapacity());
+
+        for (int i = 0; i < Settings::NUM_PRIORITIES; ++i)
+        {
+            Settings::Priority priority = Settings::Priority(i);
+            _outbox.setWeight(priority, _settings.priorityWeight(priority));
+        }
+
+        if (!_settings.spoolDirectory().empty())
+        {
+            _spool.open(_settings.spoolDirectory());
+        }
+        else if (Settings::SPILL == _settings.overflowPolicy())
+        {
+            ofLogWarning("Client::setup") << "The SPILL overflow policy needs a spool directory, messages will be rejected instead.";
+        }
+
+        if (!_settings.journalDirectory().empty())
+        {
+            std::vector<Outbox::Entry> entries;
+
+            _journal.open(_settings.journalDirectory(),
+                          _settings.journalSyncInterval(),
+                          _settings.journalSegmentSize(),
+                          entries);
+
+            // Messages from a previous run are queued regardless of the
+            // capacity. Spooled messages are already waiting in the spool.
+            for (const auto& entry: entries)
+            {
+                if (!_spool.contains(entry.journalId))
+                    _outbox.push(entry);
+            }
+        }
+
         _isInited = true;
+
+        // Deliver messages left by a previous run.
+        if (!_outbox.empty() || !_spool.empty())
+        {
+            start();
+            notifyWorker();
+        }
     }
     else
     {
@@ -42,15 +228,66 @@ void Client::setup(const Settings& settings)
 
 void Client::exit(ofEventArgs& args)
 {
-    _messageReady.set();
-    stopThread();
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        for (auto& worker: _workers)
+            worker->stopThread();
+    }
+
+    _messageReady.notify_all();
+
+    // Release producers waiting for room.
+    _outbox.close();
+
+    _journal.sync();
+}
+
+
+void Client::update(ofEventArgs&)
+{
+    dispatchEvents();
 }
 
 
-void Client::send(const std::string& to,
-                  const std::string& from,
-                  const std::string& subject,
-                  const std::string& body)
+std::size_t Client::dispatchEvents()
+{
+    std::vector<EventQueue::Event> batch;
+
+    if (_eventQueue.take(batch, _settings.maxEventBatchSize()) == 0)
+        return 0;
+
+    std::vector<DeliveryResultArgs> results;
+
+    for (auto& event: batch)
+    {
+        switch (event.type)
+        {
+            case EventQueue::Event::DELIVERY:
+                ofNotifyEvent(events.onSMTPDelivery, event.message, this);
+                break;
+            case EventQueue::Event::EXCEPTION:
+                ofNotifyEvent(events.onSMTPException, *event.error, this);
+                break;
+            case EventQueue::Event::RESULT:
+                ofNotifyEvent(events.onSMTPResult, *event.result, this);
+                results.push_back(*event.result);
+                break;
+        }
+    }
+
+    if (!results.empty())
+        ofNotifyEvent(events.onSMTPResultBatch, results, this);
+
+    return batch.size();
+}
+
+
+Client::SendResult Client::send(const std::string& to,
+                                const std::string& from,
+                                const std::string& subject,
+                                const std::string& body,
+                                Settings::Priority priority)
 {
     auto message = std::make_shared<Poco::Net::MailMessage>();
 
@@ -60,251 +297,1039 @@ void Client::send(const std::string& to,
     message->setContentType("text/plain; charset=UTF-8");
     message->setContent(body, Poco::Net::MailMessage::ENCODING_8BIT);
 
-    send(message);
+    return send(message, priority);
+}
+
+
+Client::SendResult Client::send(std::shared_ptr<Poco::Net::MailMessage> message,
+                                Settings::Priority priority)
+{
+    return post(message, priority, DeliveryTicket());
 }
 
 
-void Client::send(std::shared_ptr<Poco::Net::MailMessage> message)
+DeliveryTicket Client::sendTracked(std::shared_ptr<Poco::Net::MailMessage> message,
+                                   Settings::Priority priority)
+{
+    auto recipients = WireMessage::envelopeRecipients(*message);
+
+    DeliveryTicket ticket(++_lastTicketId, recipients.size());
+
+    if (REJECTED == post(message, priority, ticket))
+    {
+        ticket.complete(DeliveryResultArgs(message,
+                                           recipients,
+                                           DeliveryResultArgs::DROPPED,
+                                           0,
+                                           "The message could not be queued."));
+    }
+
+    return ticket;
+}
+
+
+Client::SendResult Client::post(std::shared_ptr<Poco::Net::MailMessage> message,
+                                Settings::Priority priority,
+                                const DeliveryTicket& ticket)
 {
     if (_isInited)
     {
         ofLogVerbose("Client::send") << "Pushing message to outbox.";
 
-        mutex.lock();
-        _outbox.push_back(message);
-        mutex.unlock();
+        Outbox::Entry entry;
+        entry.message = message;
+        entry.queued = std::chrono::steady_clock::now();
+        entry.priority = priority;
+        entry.ticket = ticket;
 
-        // signal the thread
-        _messageReady.set();
+        // Byte limits, spilling and journaling need the rendered message.
+        if (_settings.preRenderMessages()
+        ||  _settings.outboxByteCapacity() > 0
+        ||  (Settings::SPILL == _settings.overflowPolicy() && _spool.isOpen())
+        ||  _journal.isOpen())
+        {
+            // Render on the calling thread so workers only write bytes.
+            try
+            {
+                entry.wire = WireMessage::render(*message);
+                entry.size = entry.wire->size();
+            }
+            catch (const Poco::Exception& exc)
+            {
+                ofLogError("Client::send") << "Unable to render the message: " << exc.displayText();
 
-        // start the thread
-        start();
+                ErrorArgs args(exc, message);
+                notifyException(args);
 
+                ticket.complete(DeliveryResultArgs(message,
+                                                   WireMessage::envelopeRecipients(*message),
+                                                   DeliveryResultArgs::REJECTED,
+                                                   0,
+                                                   exc.displayText()));
+                return REJECTED;
+            }
+        }
+
+        return submit(entry);
     }
     else
     {
         ofLogError("Client::send") << "SMTP Client is not initialized.  Call setup().";
+        return REJECTED;
     }
 }
 
 
-void Client::threadedFunction()
+Client::SendResult Client::sendBulk(std::shared_ptr<Poco::Net::MailMessage> message,
+                                    const std::vector<std::string>& recipients,
+                                    Settings::Priority priority)
 {
-    while (isThreadRunning())
+    if (!_isInited)
+    {
+        ofLogError("Client::sendBulk") << "SMTP Client is not initialized.  Call setup().";
+        return REJECTED;
+    }
+
+    if (recipients.empty())
     {
-        using SS = Poco::Net::StreamSocket;
-        using SSS = Poco::Net::SecureStreamSocket;
-        using SMTP = Poco::Net::SMTPClientSession;
-        using SSMTP = Poco::Net::SecureSMTPClientSession;
-        using sSS = std::shared_ptr<SS>;
-        using sSSS = std::shared_ptr<SSS>;
-        using sSMTP = std::shared_ptr<SMTP>;
+        ofLogError("Client::sendBulk") << "No recipients.";
+        return REJECTED;
+    }
 
-        sSMTP smtp = nullptr;
+    // Render once. Every transaction shares the rendered content.
+    std::shared_ptr<const WireMessage> wire;
 
-        try
+    try
+    {
+        wire = WireMessage::render(*message);
+    }
+    catch (const Poco::Exception& exc)
+    {
+        ofLogError("Client::sendBulk") << "Unable to render the message: " << exc.displayText();
+
+        ErrorArgs args(exc, message);
+        notifyException(args);
+        return REJECTED;
+    }
+
+    std::size_t batchSize = _settings.maxRecipientsPerMessage();
+
+    if (batchSize == 0)
+        batchSize = recipients.size();
+
+    ofLogVerbose("Client::sendBulk") << "Pushing " << ((recipients.size() + batchSize - 1) / batchSize) << " transaction(s) to outbox.";
+
+    SendResult result = QUEUED;
+
+    for (std::size_t offset = 0; offset < recipients.size(); offset += batchSize)
+    {
+        std::size_t end = std::min(offset + batchSize, recipients.size());
+
+        Outbox::Entry entry;
+        entry.message = message;
+        entry.wire = wire->withRecipients(std::vector<std::string>(recipients.begin() + offset,
+                                                                   recipients.begin() + end));
+        entry.size = wire->size();
+        entry.queued = std::chrono::steady_clock::now();
+        entry.priority = priority;
+
+        // Report the least favourable outcome.
+        result = std::max(result, submit(entry));
+    }
+
+    return result;
+}
+
+
+Client::SendResult Client::sendMerge(const MessageTemplate& messageTemplate,
+                                     const std::vector<MessageTemplate::Recipient>& recipients,
+                                     Settings::Priority priority)
+{
+    if (!_isInited)
+    {
+        ofLogError("Client::sendMerge") << "SMTP Client is not initialized.  Call setup().";
+        return REJECTED;
+    }
+
+    if (!messageTemplate.isCompiled())
+    {
+        ofLogError("Client::sendMerge") << "The template is not compiled.  Call MessageTemplate::compile().";
+        return REJECTED;
+    }
+
+    if (recipients.empty())
+    {
+        ofLogError("Client::sendMerge") << "No recipients.";
+        return REJECTED;
+    }
+
+    ofLogVerbose("Client::sendMerge") << "Pushing " << recipients.size() << " message(s) to outbox.";
+
+    SendResult result = QUEUED;
+
+    for (const auto& recipient: recipients)
+    {
+        Outbox::Entry entry;
+        entry.wire = messageTemplate.render(recipient.address, recipient.fields);
+        entry.message = entry.wire->headers();
+        entry.size = entry.wire->size();
+        entry.queued = std::chrono::steady_clock::now();
+        entry.priority = priority;
+
+        // Report the least favourable outcome.
+        result = std::max(result, submit(entry));
+    }
+
+    return result;
+}
+
+
+Client::SendResult Client::submit(Outbox::Entry& entry)
+{
+    if (_journal.isOpen())
+    {
+        entry.journalId = _journal.append(*entry.wire, entry.priority, entry.attempts);
+
+        if (entry.journalId == 0)
         {
-            if (Settings::SSLTLS == _settings.encryptionType())
+            ofLogWarning("Client::submit") << "Unable to journal the message, it will not survive a restart.";
+        }
+    }
+
+    // start the workers
+    start();
+
+    SendResult result = enqueue(entry);
+
+    if (REJECTED != result)
+    {
+        _metrics.add(Metrics::MESSAGES_QUEUED);
+
+        // signal the workers
+        notifyWorker();
+    }
+    else
+    {
+        _journal.remove(entry.journalId);
+    }
+
+    return result;
+}
+
+
+Client::SendResult Client::enqueue(const Outbox::Entry& entry)
+{
+    bool isSpilling = Settings::SPILL == _settings.overflowPolicy() && _spool.isOpen();
+
+    // Keep the order of messages while older ones of the same priority are
+    // still spilled.
+    if (isSpilling && !_spool.empty(entry.priority))
+    {
+        return _spool.put(*entry.wire, entry.priority, entry.journalId, entry.ticket) ? SPILLED : REJECTED;
+    }
+
+    if (_outbox.tryPush(entry))
+    {
+        return QUEUED;
+    }
+
+    switch (_settings.overflowPolicy())
+    {
+        case Settings::BLOCK:
+        {
+            ofLogVerbose("Client::enqueue") << "Outbox is full, waiting.";
+            return _outbox.waitPush(entry) ? QUEUED_AFTER_BLOCKING : REJECTED;
+        }
+        case Settings::DROP_OLDEST:
+        {
+            if (!_outbox.fits(entry))
+                break;
+
+            Outbox::Entry dropped;
+
+            while (_outbox.evict(dropped, entry.priority))
             {
-                ofLogVerbose("Client::threadedFunction") << "Settings::SSLTLS: " << _settings.host() << ":" << _settings.port();
-                
-                // Create a Poco::Net::SecureStreamSocket pointer.
-                auto _socket = SSS(Poco::Net::SocketAddress(_settings.host(),
-                                                            _settings.port()),
-                                   _settings.host(),
-                                   ofSSLManager::getDefaultClientContext(),
-                                   _pSession);
-
-                // Save the session for future use if possible.
-                _pSession = _socket.currentSession();
-                smtp = std::make_shared<SMTP>(_socket);
-                smtp->setTimeout(_settings.timeout());
-                smtp->login();
+                ofLogWarning("Client::enqueue") << "Outbox is full, dropping the oldest message.";
+
+                ErrorArgs args(Poco::Exception("Outbox is full, message dropped."), dropped.message);
+                notifyException(args);
+
+                finish(dropped, DeliveryResultArgs::DROPPED, args.error().displayText());
+
+                if (_outbox.tryPush(entry))
+                    return QUEUED_AFTER_DROPPING;
             }
-            else if (Settings::STARTTLS == _settings.encryptionType())
-            {
-                ofLogVerbose("Client::threadedFunction") << "Settings::STARTTLS: " << _settings.host() << ":" << _settings.port();
 
-                auto _smtp = std::make_shared<SSMTP>(_settings.host(),
-                                                     _settings.port());
-                
-                _smtp->setTimeout(_settings.timeout());
-                _smtp->login();
+            // Workers took everything droppable, so there may be room now.
+            if (_outbox.tryPush(entry))
+                return QUEUED;
 
-                ofLogVerbose("Client::threadedFunction") << "startTLS ...";
-                if (!_smtp->startTLS(ofSSLManager::getDefaultClientContext()))
-                {
-                    ofLogWarning("Client::threadedFunction") << "startTLS failed.";
-                }
+            break;
+        }
+        case Settings::SPILL:
+        {
+            if (isSpilling && _spool.put(*entry.wire, entry.priority, entry.journalId, entry.ticket))
+                return SPILLED;
+
+            break;
+        }
+        case Settings::FAIL:
+            break;
+    }
+
+    ofLogWarning("Client::enqueue") << "Outbox is full, message rejected.";
+    return REJECTED;
+}
+
+
+bool Client::takeNext(Outbox::Entry& entry)
+{
+    bool isTaken = false;
+    Settings::Priority spooled;
+    std::vector<Spool::Tracked> unreadable;
+
+    // A spilled message goes before the outbox unless the outbox holds
+    // one that is at least as urgent.
+    if (_spool.mostUrgent(spooled))
+    {
+        bool isOutboxFirst = false;
+
+        for (int i = 0; i <= spooled; ++i)
+            isOutboxFirst = isOutboxFirst || _outbox.size(Settings::Priority(i)) > 0;
+
+        if (!isOutboxFirst)
+            isTaken = _spool.take(entry, unreadable);
+    }
+
+    if (!isTaken)
+        isTaken = _outbox.pop(entry) || _spool.take(entry, unreadable);
+
+    for (const auto& lost: unreadable)
+    {
+        _metrics.add(Metrics::MESSAGES_FAILED);
+
+        DeliveryResultArgs args(nullptr,
+                                lost.recipients,
+                                DeliveryResultArgs::DROPPED,
+                                0,
+                                "The spooled message could not be read.");
+        notifyResult(args);
+        lost.ticket.complete(args);
+    }
+
+    if (!isTaken)
+        return false;
+
+    auto now = std::chrono::steady_clock::now();
+
+    // Messages restored from disk are aged from the time they are restored.
+    if (entry.queued == std::chrono::steady_clock::time_point())
+        entry.queued = now;
+
+    if (entry.attempts == 0)
+    {
+        entry.started = now;
+        _metrics.record(Metrics::QUEUE_WAIT, now - entry.queued);
+    }
+
+    return true;
+}
+
+
+bool Client::hasMessages() const
+{
+    return !_outbox.empty() || !_spool.empty();
+}
+
+
+void Client::promoteRetries()
+{
+    std::vector<Outbox::Entry> due;
+
+    if (_retries.takeDue(RetryScheduler::Clock::now(), due))
+    {
+        // Retried messages are older than anything queued, so they go first,
+        // in the order they fell due.
+        for (auto iter = due.rbegin(); iter != due.rend(); ++iter)
+            _outbox.requeue(*iter);
+    }
+}
+
+
+void Client::deliver(Worker& worker)
+{
+    // The relay this worker is connected to. The connection is kept open
+    // between outbox drains when an idle timeout is configured.
+    std::shared_ptr<Relay> relay;
+    std::unique_ptr<Connection> connection;
 
-                smtp = _smtp;
+    auto isOpen = [&]() {
+        return connection && connection->isOpen();
+    };
+
+    while (worker.isThreadRunning())
+    {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+
+            auto ready = [&]() {
+                return !worker.isThreadRunning()
+                    || hasMessages()
+                    || _retries.nextDue() <= RetryScheduler::Clock::now();
+            };
+
+            // Wake for the next retry or keep alive, whichever comes first.
+            auto deadline = _retries.nextDue();
+
+            if (isOpen())
+                deadline = std::min(deadline, connection->nextKeepAlive());
+
+            // Producers only take the mutex to notify when a worker waits.
+            ++_waitingWorkers;
+
+            if (deadline == RetryScheduler::Clock::time_point::max())
+            {
+                _messageReady.wait(lock, ready);
             }
             else
             {
-                ofLogVerbose("Client::threadedFunction") << "Settings::NONE: " << _settings.host() << ":" << _settings.port();
-                smtp = std::make_shared<SMTP>(_settings.host(), _settings.port());
-                smtp->setTimeout(_settings.timeout());
-                smtp->login();
+                _messageReady.wait_until(lock, deadline, ready);
             }
 
-            ofLogVerbose("Client::threadedFunction") << "Setting timeout: " << _settings.timeout().totalMilliseconds();
-            
-            try
+            --_waitingWorkers;
+
+            if (!worker.isThreadRunning())
+                break;
+        }
+
+        promoteRetries();
+
+        if (!hasMessages())
+        {
+            if (isOpen() && RetryScheduler::Clock::now() >= connection->nextKeepAlive())
+                connection->keepAlive();
+
+            continue;
+        }
+
+        Outbox::Entry current;
+
+        try
+        {
+            // Make sure a reused session is still alive.
+            if (isOpen() && !connection->reset())
+            {
+                ofLogVerbose("Client::deliver") << "Session was dropped by the server, reconnecting.";
+            }
+
+            while (worker.isThreadRunning() && takeNext(current))
             {
-                if (_settings.credentials().loginMethod() != Poco::Net::SMTPClientSession::AUTH_NONE)
+                // Messages that were not rendered when queued are rendered
+                // here if they have base64 parts, so that the parts are
+                // encoded with the vectorized encoder.
+                if (!current.wire && WireMessage::hasBase64Parts(*current.message))
                 {
-                        ofLogVerbose("Client::threadedFunction") << "Logging on with credentials.";
-                        smtp->login(_settings.credentials().loginMethod(),
-                                    _settings.credentials().username(),
-                                    _settings.credentials().password());
-                    
+                    try
+                    {
+                        current.wire = WireMessage::render(*current.message);
+                    }
+                    catch (const Poco::Exception& exc)
+                    {
+                        ofLogError("Client::deliver") << "Unable to render the message: " << exc.displayText();
+
+                        ErrorArgs args(exc, current.message);
+                        notifyException(args);
+
+                        finish(current, DeliveryResultArgs::REJECTED, exc.displayText());
+                        current = Outbox::Entry();
+                        continue;
+                    }
+                }
+
+                // Leave a relay that failed on another connection.
+                if (isOpen() && !relay->isAvailable())
+                {
+                    connection->close();
+                }
+
+                if (!isOpen())
+                {
+                    relay = _relays.select();
+
+                    if (!relay)
+                    {
+                        // Every relay is cooling down. Wait for the first to
+                        // recover rather than time out on every message.
+                        _outbox.requeue(current);
+                        current = Outbox::Entry();
+                        sleepUntil(worker, _relays.nextAvailable());
+                        break;
+                    }
+
+                    connection.reset(new Connection(relay->settings(), _resolver, _metrics));
+                }
+
+                // Connection errors are errors of the relay, not of the
+                // message. The message goes back to the outbox without an
+                // attempt charged, even if the greeting, EHLO, STARTTLS or
+                // AUTH is refused with a permanent error.
+                if (!connection->isOpen())
+                {
+                    const Settings& settings = relay->settings();
+
+                    try
+                    {
+                        connection->open(_tlsSessionCache.get(settings.host(), settings.port()));
+                    }
+                    catch (const Poco::Exception& exc)
+                    {
+                        _metrics.add(Metrics::CONNECTION_ERRORS);
+
+                        connection->close();
+
+                        // Let the relay cool down rather than reconnect at once.
+                        relay->failed();
+
+                        ofLogError("Client::deliver") << "Unable to connect: " << exc.name() << " : " << exc.displayText();
+
+                        ErrorArgs args(exc, current.message);
+                        notifyException(args);
+
+                        _outbox.requeue(current);
+                        current = Outbox::Entry();
+                        break;
+                    }
+                    catch (...)
+                    {
+                        _metrics.add(Metrics::CONNECTION_ERRORS);
+
+                        _outbox.requeue(current);
+                        current = Outbox::Entry();
+                        throw;
+                    }
+
+                    _metrics.add(Metrics::CONNECTIONS);
+
+                    if (connection->isTLSSessionReused())
+                        _metrics.add(Metrics::TLS_RESUMPTIONS);
+
+                    // Save the session for future use if possible.
+                    _tlsSessionCache.put(settings.host(),
+                                         settings.port(),
+                                         connection->tlsSession());
+
+                    ConnectionArgs args(settings, connection->isTLSSessionReused());
+                    ofNotifyEvent(events.onSMTPConnect, args, this);
+                }
+
+                sleepUntil(worker, relay->rateLimiter().acquire());
+
+                if (!worker.isThreadRunning())
+                {
+                    _outbox.requeue(current);
+                    current = Outbox::Entry();
+                    break;
+                }
+
+                ++current.attempts;
+
+                auto start = Relay::Clock::now();
+
+                std::vector<Connection::Rejection> rejections;
+
+                if (current.wire)
+                {
+                    rejections = connection->send(*current.wire);
                 }
                 else
                 {
-                    // This will simply send a helo to the server, required in some circumstances.
-                    smtp->login();
+                    connection->send(*current.message);
                 }
-            }
-            catch (const Poco::Net::SMTPException& exc)
-            {
-                ofLogError("Client::threadedFunction") << exc.displayText() << ": Check your ofxSMTP::Credentials.";
-                // There will likely be additional exceptions.
-            }
 
-            while (getOutboxSize() > 0 && isThreadRunning())
-            {
-                mutex.lock();
-                _currentMessage = _outbox.front();
-                _outbox.pop_front();
-                mutex.unlock();
+                auto transfer = Relay::Clock::now() - start;
+
+                relay->succeeded(transfer);
+                relay->rateLimiter().succeeded();
 
-                smtp->sendMessage(*_currentMessage);
+                const Connection::Reply& reply = connection->lastReply();
 
-                ofNotifyEvent(events.onSMTPDelivery, _currentMessage, this);
+                if (!rejections.empty())
+                {
+                    finishRecipients(current, rejections, reply, transfer);
+                    current = Outbox::Entry();
+                    continue;
+                }
+
+                auto message = current.message;
+
+                finish(current, DeliveryResultArgs::DELIVERED, "", reply.code, reply.text, transfer);
 
-                _currentMessage.reset();
+                current = Outbox::Entry();
 
-                sleep(_settings.messageSendDelay().milliseconds());
+                notifyDelivery(message);
             }
 
-            ofLogVerbose("Client::threadedFunction") << "Closing session.";
-            
-            if (smtp)
-                smtp->close();
+            if (connection && _settings.idleTimeout().totalMicroseconds() <= 0)
+            {
+                connection->close();
+            }
         }
         catch (Poco::Net::SMTPException& exc)
         {
-            if (_currentMessage)
+            // The relay asks us to slow down.
+            if (relay && (421 == exc.code() || 451 == exc.code()))
             {
-                // 500 codes are permanent negative errors.
-                if (5 != (exc.code() / 100))
-                {
-                    mutex.lock();
-                    _outbox.push_front(_currentMessage);
-                    mutex.unlock();
-                }
+                relay->rateLimiter().throttled();
             }
 
-            if (smtp)
-                smtp->close();
+            // 421 means the server is closing the session. Other replies
+            // leave the session usable after a reset.
+            if (421 == exc.code() || _settings.idleTimeout().totalMicroseconds() <= 0)
+            {
+                connection->close();
+            }
 
-            ErrorArgs args(exc, _currentMessage);
-            ofNotifyEvent(events.onSMTPException, args, this);
+            if (relay && 421 == exc.code())
+            {
+                relay->failed();
+            }
 
-            _currentMessage.reset();
+            ErrorArgs args(exc, current.message);
+            notifyException(args);
 
+            // 500 codes are permanent negative errors.
+            if (5 == (exc.code() / 100))
+            {
+                if (current.message)
+                    finish(current, DeliveryResultArgs::REJECTED, exc.displayText(), exc.code());
+            }
+            else
+            {
+                retry(current, exc, 421 == exc.code());
+            }
         }
         catch (Poco::Net::SSLException& exc)
         {
-            if (_currentMessage)
-            {
-                mutex.lock();
-                _outbox.push_front(_currentMessage);
-                mutex.unlock();
-            }
+            if (connection)
+                connection->close();
+
+            if (relay)
+                relay->failed();
 
-            ofLogError("Client::threadedFunction") << exc.name() << " : " << exc.displayText();
+            ofLogError("Client::deliver") << exc.name() << " : " << exc.displayText();
 
             if (exc.displayText().find("SSL3_GET_SERVER_CERTIFICATE") != std::string::npos)
             {
-                ofLogError("Client::threadedFunction") << "\t\t" << "This may be because you asked your SSL context to verify the server's certificate, but your certificate authority (ca) file is missing.";
+                ofLogError("Client::deliver") << "\t\t" << "This may be because you asked your SSL context to verify the server's certificate, but your certificate authority (ca) file is missing.";
             }
 
-            ErrorArgs args(exc, _currentMessage);
-            ofNotifyEvent(events.onSMTPException, args, this);
+            ErrorArgs args(exc, current.message);
+            notifyException(args);
 
-            _currentMessage.reset();
-            
+            retry(current, exc, true);
         }
         catch (Poco::Net::NetException& exc)
         {
-            if (_currentMessage)
-            {
-                mutex.lock();
-                _outbox.push_front(_currentMessage);
-                mutex.unlock();
-            }
+            if (connection)
+                connection->close();
+
+            if (relay)
+                relay->failed();
+
+            ofLogError("Client::deliver") << exc.name() << " : " << exc.displayText();
 
-            ofLogError("Client::threadedFunction") << exc.name() << " : " << exc.displayText();
+            ErrorArgs args(exc, current.message);
+            notifyException(args);
 
-            ErrorArgs args(exc, _currentMessage);
-            ofNotifyEvent(events.onSMTPException,
-                          args,
-                          this);
+            retry(current, exc, true);
+        }
+        catch (Poco::TimeoutException& exc)
+        {
+            if (connection)
+                connection->close();
+
+            if (relay)
+                relay->failed();
+
+            ofLogError("Client::deliver") << exc.name() << " : " << exc.displayText();
 
-            _currentMessage.reset();
-            
+            ErrorArgs args(exc, current.message);
+            notifyException(args);
+
+            retry(current, exc, true);
         }
         catch (Poco::Exception &exc)
         {
-            if (_currentMessage)
-            {
-                mutex.lock();
-                _outbox.push_front(_currentMessage);
-                mutex.unlock();
-            }
+            // Other errors come from the message, e.g. a missing attachment,
+            // not the relay, so the relay's health is left alone and the
+            // message is retried with a backoff.
+            if (connection)
+                connection->close();
 
-            ofLogError("Client::threadedFunction") << exc.name() << " : " << exc.displayText();
+            ofLogError("Client::deliver") << exc.name() << " : " << exc.displayText();
 
-            ErrorArgs args(exc, _currentMessage);
-            ofNotifyEvent(events.onSMTPException, args, this);
+            ErrorArgs args(exc, current.message);
+            notifyException(args);
 
-            _currentMessage.reset();
-            
+            retry(current, exc, false);
         }
         catch (std::exception& exc)
         {
-            if (_currentMessage)
-            {
-                mutex.lock();
-                _outbox.push_front(_currentMessage);
-                mutex.unlock();
-            }
+            if (connection)
+                connection->close();
 
-            ofLogError("Client::threadedFunction") << exc.what();
+            ofLogError("Client::deliver") << exc.what();
 
-            ErrorArgs args(Poco::Exception(exc.what()), _currentMessage);
+            ErrorArgs args(Poco::Exception(exc.what()), current.message);
 
-            ofNotifyEvent(events.onSMTPException, args, this);
+            notifyException(args);
 
-            _currentMessage.reset();
-            
+            retry(current, args.error(), false);
         }
+    }
+}
+
+
+void Client::retry(const Outbox::Entry& entry,
+                   const Poco::Exception& exc,
+                   bool isRelayFailure)
+{
+    if (!entry.message)
+        return;
+
+    // Only SMTP errors carry a reply code.
+    auto pSMTPException = dynamic_cast<const Poco::Net::SMTPException*>(&exc);
+    int replyCode = pSMTPException ? pSMTPException->code() : 0;
+
+    auto now = RetryScheduler::Clock::now();
+    auto maxAge = std::chrono::microseconds(_settings.maxMessageAge().totalMicroseconds());
 
-        _messageReady.wait();
-        _messageReady.reset();
+    if (_settings.maxAttempts() > 0 && entry.attempts >= _settings.maxAttempts())
+    {
+        finish(entry, DeliveryResultArgs::TOO_MANY_ATTEMPTS, exc.displayText(), replyCode);
+    }
+    else if (maxAge.count() > 0 && now - entry.queued >= maxAge)
+    {
+        finish(entry, DeliveryResultArgs::EXPIRED, exc.displayText(), replyCode);
+    }
+    else if (isRelayFailure && _relays.hasAvailable())
+    {
+        ofLogVerbose("Client::retry") << "Failing over to another relay.";
+
+        // The message did nothing wrong, try it on another relay right away.
+        _metrics.add(Metrics::RETRIES);
+        _journal.setAttempts(entry.journalId, entry.attempts);
+        _outbox.requeue(entry);
+    }
+    else
+    {
+        auto delay = RetryScheduler::backoff(entry.attempts,
+                                             std::chrono::microseconds(_settings.retryDelay().totalMicroseconds()),
+                                             std::chrono::microseconds(_settings.maxRetryDelay().totalMicroseconds()));
+
+        ofLogVerbose("Client::retry") << "Retrying message in " << std::chrono::duration_cast<std::chrono::milliseconds>(delay).count() << " ms.";
+
+        _metrics.add(Metrics::RETRIES);
+        _journal.setAttempts(entry.journalId, entry.attempts);
+        _retries.schedule(entry, now + delay);
     }
 }
 
 
+void Client::finish(const Outbox::Entry& entry,
+                    DeliveryResultArgs::Outcome outcome,
+                    const std::string& reason,
+                    int replyCode,
+                    const std::string& reply,
+                    DeliveryResultArgs::Clock::duration transfer)
+{
+    _journal.remove(entry.journalId);
+
+    if (DeliveryResultArgs::DELIVERED == outcome)
+    {
+        _metrics.add(Metrics::MESSAGES_DELIVERED);
+        _metrics.record(Metrics::END_TO_END, std::chrono::steady_clock::now() - entry.queued);
+    }
+    else
+    {
+        _metrics.add(Metrics::MESSAGES_FAILED);
+    }
+
+    std::vector<std::string> recipients;
+
+    if (entry.wire)
+        recipients = entry.wire->recipients();
+    else if (entry.message)
+        recipients = WireMessage::envelopeRecipients(*entry.message);
+
+    DeliveryResultArgs args(entry.message,
+                            recipients,
+                            outcome,
+                            entry.attempts,
+                            reason,
+                            replyCode,
+                            reply,
+                            timings(entry, transfer));
+    notifyResult(args);
+
+    entry.ticket.complete(args);
+}
+
+
+void Client::finishRecipients(const Outbox::Entry& entry,
+                              const std::vector<Connection::Rejection>& rejections,
+                              const Connection::Reply& reply,
+                              DeliveryResultArgs::Clock::duration transfer)
+{
+    std::vector<std::string> delivered;
+    std::vector<std::string> transient;
+    const Poco::Net::SMTPException* pTransientError = nullptr;
+    bool isTransactionFull = true;
+
+    auto rejection = rejections.begin();
+
+    // Rejections are listed in envelope order.
+    for (const auto& recipient: entry.wire->recipients())
+    {
+        if (rejection == rejections.end() || rejection->recipient != recipient)
+        {
+            delivered.push_back(recipient);
+            continue;
+        }
+
+        if (5 == (rejection->error.code() / 100))
+        {
+            ofLogWarning("Client::finishRecipients") << rejection->error.displayText();
+
+            _metrics.add(Metrics::RECIPIENTS_REJECTED);
+
+            DeliveryResultArgs args(entry.message,
+                                    std::vector<std::string>(1, recipient),
+                                    DeliveryResultArgs::REJECTED,
+                                    entry.attempts,
+                                    rejection->error.displayText(),
+                                    rejection->error.code(),
+                                    "",
+                                    timings(entry, transfer));
+            notifyResult(args);
+
+            entry.ticket.complete(args);
+        }
+        else
+        {
+            transient.push_back(recipient);
+
+            if (!pTransientError)
+                pTransientError = &rejection->error;
+
+            isTransactionFull = isTransactionFull && 452 == rejection->error.code();
+        }
+
+        ++rejection;
+    }
+
+    Outbox::Entry remaining = entry;
+
+    if (!transient.empty() && transient.size() != entry.wire->recipients().size())
+    {
+        // Journal the recipients still to be delivered before the record of
+        // the whole transaction is removed.
+        remaining.wire = entry.wire->withRecipients(transient);
+        remaining.journalId = 0;
+
+        if (_journal.isOpen() && entry.journalId != 0)
+            remaining.journalId = _journal.append(*remaining.wire, remaining.priority, remaining.attempts);
+    }
+
+    if (remaining.journalId != entry.journalId)
+        _journal.remove(entry.journalId);
+
+    if (!delivered.empty())
+    {
+        _metrics.add(Metrics::MESSAGES_DELIVERED);
+        _metrics.record(Metrics::END_TO_END, std::chrono::steady_clock::now() - entry.queued);
+
+        DeliveryResultArgs args(entry.message,
+                                delivered,
+                                DeliveryResultArgs::DELIVERED,
+                                entry.attempts,
+                                "",
+                                reply.code,
+                                reply.text,
+                                timings(entry, transfer));
+        notifyResult(args);
+
+        entry.ticket.complete(args);
+
+        notifyDelivery(entry.message);
+    }
+
+    if (pTransientError)
+    {
+        ErrorArgs args(*pTransientError, entry.message);
+        notifyException(args);
+
+        if (isTransactionFull && !delivered.empty())
+        {
+            // 452 after some recipients were accepted means the server's
+            // limit per transaction was reached, not that it is busy. The
+            // rest go out in the next transaction.
+            --remaining.attempts;
+            _metrics.add(Metrics::RETRIES);
+            _outbox.requeue(remaining);
+        }
+        else
+        {
+            retry(remaining, *pTransientError, false);
+        }
+    }
+    else
+    {
+        _journal.remove(entry.journalId);
+    }
+}
+
+
+DeliveryResultArgs::Timings Client::timings(const Outbox::Entry& entry,
+                                            DeliveryResultArgs::Clock::duration transfer)
+{
+    auto now = DeliveryResultArgs::Clock::now();
+
+    DeliveryResultArgs::Timings timings;
+    timings.transfer = transfer;
+
+    if (entry.started != DeliveryResultArgs::Clock::time_point())
+        timings.queueWait = entry.started - entry.queued;
+
+    if (entry.queued != DeliveryResultArgs::Clock::time_point())
+        timings.total = now - entry.queued;
+
+    return timings;
+}
+
+
+void Client::sleepUntil(Worker& worker, RateLimiter::Clock::time_point time)
+{
+    // Sleep in short steps so that a stopped worker exits promptly.
+    while (worker.isThreadRunning())
+    {
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(time - RateLimiter::Clock::now());
+
+        if (remaining.count() <= 0)
+            break;
+
+        worker.sleep(int(std::min(remaining.count(), decltype(remaining.count())(100))));
+    }
+}
+
+
+void Client::dispatch(Dispatcher& dispatcher)
+{
+    while (dispatcher.isThreadRunning())
+    {
+        if (dispatchEvents() == 0)
+            _eventQueue.wait(std::chrono::milliseconds(100));
+    }
+}
+
+
+void Client::notifyDelivery(std::shared_ptr<Poco::Net::MailMessage> message)
+{
+    if (Settings::INLINE == _settings.eventDispatch())
+    {
+        ofNotifyEvent(events.onSMTPDelivery, message, this);
+        return;
+    }
+
+    EventQueue::Event event;
+    event.type = EventQueue::Event::DELIVERY;
+    event.message = message;
+    _eventQueue.push(std::move(event));
+}
+
+
+void Client::notifyException(const ErrorArgs& args)
+{
+    if (Settings::INLINE == _settings.eventDispatch())
+    {
+        ofNotifyEvent(events.onSMTPException, args, this);
+        return;
+    }
+
+    EventQueue::Event event;
+    event.type = EventQueue::Event::EXCEPTION;
+    event.error = std::make_shared<const ErrorArgs>(args);
+    _eventQueue.push(std::move(event));
+}
+
+
+void Client::notifyResult(const DeliveryResultArgs& args)
+{
+    if (Settings::INLINE == _settings.eventDispatch())
+    {
+        ofNotifyEvent(events.onSMTPResult, args, this);
+
+        // Only build the batch if someone listens.
+        if (events.onSMTPResultBatch.size() > 0)
+        {
+            std::vector<DeliveryResultArgs> results(1, args);
+            ofNotifyEvent(events.onSMTPResultBatch, results, this);
+        }
+
+        return;
+    }
+
+    EventQueue::Event event;
+    event.type = EventQueue::Event::RESULT;
+    event.result = std::make_shared<const DeliveryResultArgs>(args);
+    _eventQueue.push(std::move(event));
+}
+
+
+void Client::notifyWorker()
+{
+    // A worker that is about to wait has already checked the outbox under
+    // the mutex. Taking it here makes sure the notification is not lost.
+    if (_waitingWorkers > 0)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+    }
+
+    _messageReady.notify_one();
+}
+
+
 std::size_t Client::getOutboxSize() const
 {
-    std::unique_lock<std::mutex> lock(mutex);
-    return _outbox.size();
+    return _outbox.size() + _spool.size() + _retries.size();
+}
+
+
+std::size_t Client::getEventQueueSize() const
+{
+    return _eventQueue.size();
 }
 
     
     
+const Metrics& Client::getMetrics() const
+{
+    return _metrics;
+}
+
+
+const std::vector<std::shared_ptr<Relay>>& Client::getRelays() const
+{
+    return _relays.relays();
+}
+
+
+Outbox::LaneStats Client::getLaneStats(Settings::Priority priority) const
+{
+    return _outbox.laneStats(priority);
+}
+
+
 Settings Client::settings() const
 {
     return _settings;
@@ -313,14 +1338,22 @@ Settings Client::settings() const
 
 void Client::start()
 {
-    if (!isThreadRunning())
-    {
-        ofLogVerbose("Client::start") << "Starting thread.";
-        startThread(true);   // blocking, verbose
-    }
-    else
+    if (_isStarted)
+        return;
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    if (_workers.empty())
     {
-        ofLogVerbose("Client::start") << "New message queued, signalling.";
+        ofLogVerbose("Client::start") << "Starting " << _settings.maxConnections() << " worker(s).";
+
+        for (std::size_t i = 0; i < _settings.maxConnections(); ++i)
+        {
+            _workers.push_back(std::unique_ptr<Worker>(new Worker(*this)));
+            _workers.back()->startThread();
+        }
+
+        _isStarted = true;
     }
 }
 
@@ -0,0 +1,945 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/SMTP/Connection.h"
+#include "ofx/SMTP/DataEncoder.h"
+#include <algorithm>
+#include <sstream>
+#include "Poco/Environment.h"
+#include "Poco/String.h"
+#include "Poco/Net/SocketAddress.h"
+#include "Poco/Net/NetException.h"
+#include "ofLog.h"
+#include "ofSSLManager.h"
+
+
+namespace ofx {
+namespace SMTP {
+
+
+/// \brief An SMTP session exposing the EHLO reply and authentication steps.
+///
+/// Poco::Net::SMTPClientSession::login() always sends its own EHLO, so the
+/// server's capabilities are not available to the caller. This class lets
+/// the Connection send a single EHLO and authenticate afterwards.
+class Connection::ClientSession: public Poco::Net::SecureSMTPClientSession
+{
+public:
+    using Poco::Net::SecureSMTPClientSession::SecureSMTPClientSession;
+
+    /// \brief Send EHLO, falling back to HELO.
+    /// \param hostname The client host name.
+    /// \returns the server's reply.
+    std::string ehlo(const std::string& hostname)
+    {
+        std::string response;
+        login(hostname, response);
+        return response;
+    }
+
+    /// \brief Upgrade the connection with STARTTLS.
+    ///
+    /// Unlike Poco::Net::SecureSMTPClientSession::startTLS(), this resumes
+    /// the given TLS session if the server still knows it.
+    ///
+    /// \param hostname The server host name used for verification and SNI.
+    /// \param pContext The client TLS context.
+    /// \param pSession A TLS session to resume, or nullptr.
+    /// \returns false if the server refused STARTTLS.
+    bool startTLS(const std::string& hostname,
+                  Poco::Net::Context::Ptr pContext,
+                  Poco::Net::Session::Ptr pSession)
+    {
+        std::string response;
+        int status = sendCommand("STARTTLS", response);
+
+        if (2 != (status / 100))
+        {
+            ofLogVerbose("Connection::ClientSession::startTLS") << response;
+            return false;
+        }
+
+        socket() = Poco::Net::SecureStreamSocket::attach(socket(),
+                                                         hostname,
+                                                         pContext,
+                                                         pSession);
+        return true;
+    }
+
+    /// \brief Authenticate with the server after greeting it.
+    /// \param loginMethod The login method.
+    /// \param username The account username.
+    /// \param password The account password.
+    void authenticate(LoginMethod loginMethod,
+                      const std::string& username,
+                      const std::string& password)
+    {
+        switch (loginMethod)
+        {
+            case AUTH_NONE:
+                break;
+            case AUTH_CRAM_MD5:
+                loginUsingCRAMMD5(username, password);
+                break;
+            case AUTH_CRAM_SHA1:
+                loginUsingCRAMSHA1(username, password);
+                break;
+            case AUTH_LOGIN:
+                loginUsingLogin(username, password);
+                break;
+            case AUTH_PLAIN:
+                loginUsingPlain(username, password);
+                break;
+            case AUTH_XOAUTH2:
+                loginUsingXOAUTH2(username, password);
+                break;
+            default:
+                throw Poco::InvalidArgumentException("Unsupported SMTP authentication method");
+        }
+    }
+
+};
+
+
+Connection::Connection(const Settings& settings,
+                       Resolver& resolver,
+                       Metrics& metrics):
+    _settings(settings),
+    _resolver(resolver),
+    _metrics(metrics)
+{
+}
+
+
+Connection::~Connection()
+{
+    close();
+}
+
+
+void Connection::open(Poco::Net::Session::Ptr pSession)
+{
+    close();
+
+    _pTLSSession = nullptr;
+    _isTLSSessionReused = false;
+
+    if (Settings::SSLTLS == _settings.encryptionType())
+    {
+        ofLogVerbose("Connection::open") << "Settings::SSLTLS: " << _settings.host() << ":" << _settings.port();
+
+        Poco::Net::StreamSocket plainSocket = connect();
+
+        // Create a Poco::Net::SecureStreamSocket.
+        Poco::Net::SecureStreamSocket socket;
+
+        {
+            Metrics::Timer timer(_metrics, Metrics::TLS_HANDSHAKE);
+            socket = Poco::Net::SecureStreamSocket::attach(plainSocket,
+                                                           _settings.host(),
+                                                           ofSSLManager::getDefaultClientContext(),
+                                                           pSession);
+        }
+
+        _session.reset(new ClientSession(socket));
+        _session->setTimeout(_settings.timeout());
+        greet();
+        updateTLSSession();
+    }
+    else if (Settings::STARTTLS == _settings.encryptionType())
+    {
+        ofLogVerbose("Connection::open") << "Settings::STARTTLS: " << _settings.host() << ":" << _settings.port();
+
+        _session.reset(new ClientSession(connect()));
+        _session->setTimeout(_settings.timeout());
+        greet();
+
+        ofLogVerbose("Connection::open") << "startTLS ...";
+
+        bool isSecure = false;
+
+        {
+            Metrics::Timer timer(_metrics, Metrics::TLS_HANDSHAKE);
+            isSecure = _session->startTLS(_settings.host(),
+                                          ofSSLManager::getDefaultClientContext(),
+                                          pSession);
+        }
+
+        if (isSecure)
+        {
+            // The capabilities may change once the channel is secure.
+            greet();
+            updateTLSSession();
+        }
+        else
+        {
+            ofLogWarning("Connection::open") << "startTLS failed.";
+        }
+    }
+    else
+    {
+        ofLogVerbose("Connection::open") << "Settings::NONE: " << _settings.host() << ":" << _settings.port();
+        _session.reset(new ClientSession(connect()));
+        _session->setTimeout(_settings.timeout());
+        greet();
+    }
+
+    ofLogVerbose("Connection::open") << "Setting timeout: " << _settings.timeout().totalMilliseconds();
+
+    try
+    {
+        if (_settings.credentials().loginMethod() != Poco::Net::SMTPClientSession::AUTH_NONE)
+        {
+            ofLogVerbose("Connection::open") << "Logging on with credentials.";
+            Metrics::Timer timer(_metrics, Metrics::AUTH);
+            _session->authenticate(_settings.credentials().loginMethod(),
+                                   _settings.credentials().username(),
+                                   _settings.credentials().password());
+        }
+    }
+    catch (const Poco::Net::SMTPException& exc)
+    {
+        ofLogError("Connection::open") << exc.displayText() << ": Check your ofxSMTP::Credentials.";
+        // There will likely be additional exceptions.
+    }
+
+    _needsReset = false;
+    _lastTransaction = std::chrono::steady_clock::now();
+}
+
+
+Poco::Net::StreamSocket Connection::connect()
+{
+    std::vector<Poco::Net::SocketAddress> addresses;
+
+    {
+        Metrics::Timer timer(_metrics, Metrics::DNS);
+        addresses = _resolver.resolve(_settings.host(), _settings.port());
+    }
+
+    Metrics::Timer timer(_metrics, Metrics::CONNECT);
+
+    auto now = std::chrono::steady_clock::now();
+    auto deadline = now + std::chrono::microseconds(_settings.timeout().totalMicroseconds());
+    auto attemptDelay = std::chrono::microseconds(_settings.connectionAttemptDelay().totalMicroseconds());
+    auto nextAttempt = now;
+
+    std::vector<Poco::Net::StreamSocket> pending;
+    std::size_t next = 0;
+    std::string lastError = "No address";
+
+    while (true)
+    {
+        now = std::chrono::steady_clock::now();
+
+        if (next < addresses.size() && now >= nextAttempt)
+        {
+            try
+            {
+                Poco::Net::StreamSocket socket;
+                socket.connectNB(addresses[next]);
+                pending.push_back(socket);
+                nextAttempt = now + attemptDelay;
+            }
+            catch (const Poco::Exception& exc)
+            {
+                // For example an IPv6 address without an IPv6 route.
+                lastError = addresses[next].toString() + ": " + exc.displayText();
+                nextAttempt = now;
+            }
+
+            ++next;
+            continue;
+        }
+
+        if (pending.empty())
+        {
+            if (next < addresses.size())
+                continue;
+
+            throw Poco::Net::NetException("Unable to connect to " + _settings.host(), lastError);
+        }
+
+        if (now >= deadline)
+        {
+            for (auto& socket: pending)
+                socket.close();
+
+            throw Poco::TimeoutException("Unable to connect to " + _settings.host(), "Timed out");
+        }
+
+        auto wait = deadline;
+
+        if (next < addresses.size())
+            wait = std::min(wait, nextAttempt);
+
+        Poco::Net::Socket::SocketList readList;
+        Poco::Net::Socket::SocketList writeList(pending.begin(), pending.end());
+        Poco::Net::Socket::SocketList exceptList(pending.begin(), pending.end());
+
+        Poco::Net::Socket::select(readList,
+                                  writeList,
+                                  exceptList,
+                                  Poco::Timespan(std::chrono::duration_cast<std::chrono::microseconds>(wait - now).count()));
+
+        for (auto iter = pending.begin(); iter != pending.end();)
+        {
+            bool isWritable = std::find(writeList.begin(), writeList.end(), *iter) != writeList.end();
+            bool isFailed = std::find(exceptList.begin(), exceptList.end(), *iter) != exceptList.end();
+
+            if (!isWritable && !isFailed)
+            {
+                ++iter;
+                continue;
+            }
+
+            int error = 0;
+            iter->getOption(SOL_SOCKET, SO_ERROR, error);
+
+            if (!isFailed && error == 0)
+            {
+                Poco::Net::StreamSocket socket = *iter;
+                Poco::Net::SocketAddress address = socket.peerAddress();
+
+                for (auto& other: pending)
+                {
+                    if (!(other == socket))
+                        other.close();
+                }
+
+                socket.setBlocking(true);
+
+                _resolver.succeeded(_settings.host(), address.host());
+
+                ofLogVerbose("Connection::connect") << "Connected to " << address.toString() << ".";
+
+                return socket;
+            }
+
+            lastError = "Connection failed (" + std::to_string(error) + ")";
+            iter->close();
+            iter = pending.erase(iter);
+
+            // Start the next attempt at once.
+            nextAttempt = std::chrono::steady_clock::now();
+        }
+    }
+}
+
+
+void Connection::greet()
+{
+    Metrics::Timer timer(_metrics, Metrics::EHLO);
+
+    _capabilities.clear();
+
+    std::istringstream lines(_session->ehlo(Poco::Environment::nodeName()));
+    std::string line;
+
+    // Skip the greeting line and parse the "250-KEYWORD params" lines.
+    std::getline(lines, line);
+
+    while (std::getline(lines, line))
+    {
+        if (line.size() > 4)
+        {
+            std::string capability = Poco::trim(line.substr(4));
+            std::string::size_type space = capability.find(' ');
+            std::string keyword = Poco::toUpper(capability.substr(0, space));
+            std::string parameters = (space == std::string::npos) ? "" : capability.substr(space + 1);
+            _capabilities[keyword] = parameters;
+        }
+    }
+
+    ofLogVerbose("Connection::greet") << "Server advertised " << _capabilities.size() << " capabilities.";
+}
+
+
+void Connection::updateTLSSession()
+{
+    // The session is read after the first server reply so that session
+    // tickets sent after a TLS 1.3 handshake have been received.
+    Poco::Net::SecureStreamSocket socket(_session->socket());
+
+    // Save the session for future use if possible.
+    _pTLSSession = socket.currentSession();
+    _isTLSSessionReused = socket.sessionWasReused();
+
+    ofLogVerbose("Connection::updateTLSSession") << "TLS session " << (_isTLSSessionReused ? "resumed." : "negotiated.");
+}
+
+
+void Connection::close()
+{
+    if (_session)
+    {
+        ofLogVerbose("Connection::close") << "Closing session.";
+
+        try
+        {
+            _session->close();
+        }
+        catch (const Poco::Exception& exc)
+        {
+            ofLogVerbose("Connection::close") << exc.displayText();
+        }
+
+        _session.reset();
+    }
+}
+
+
+bool Connection::isOpen() const
+{
+    return _session != nullptr;
+}
+
+
+void Connection::send(const Poco::Net::MailMessage& message)
+{
+    beginTransaction();
+
+    try
+    {
+        bool isChunking = hasCapability("CHUNKING");
+
+        sendEnvelope(WireMessage::envelopeSender(message) + bodyParameter(isChunking),
+                     WireMessage::envelopeRecipients(message));
+
+        if (isChunking)
+        {
+            Metrics::Timer timer(_metrics, Metrics::DATA);
+
+            // Stream the message in BDAT chunks as it is generated.
+            ChunkWriter writer(*this);
+            DataEncoderStream stream(DataEncoder::CANONICAL,
+                                     [&](const std::string& block, bool isLast) {
+                                         writer.write(block.data(), block.size(), isLast);
+                                     },
+                                     BDAT_CHUNK_SIZE);
+            message.write(stream);
+            stream.close();
+            writer.finish();
+        }
+        else
+        {
+            sendData(message);
+        }
+    }
+    catch (...)
+    {
+        _needsReset = true;
+        throw;
+    }
+
+    _lastTransaction = std::chrono::steady_clock::now();
+}
+
+
+std::vector<Connection::Rejection> Connection::send(const WireMessage& message)
+{
+    beginTransaction();
+
+    std::vector<Rejection> rejections;
+
+    try
+    {
+        bool isChunking = hasCapability("CHUNKING");
+
+        sendEnvelope(message.sender() + bodyParameter(isChunking),
+                     message.recipients(),
+                     &rejections);
+
+        if (rejections.size() == message.recipients().size())
+        {
+            // The transaction has no recipients and must be reset.
+            _needsReset = true;
+            _lastTransaction = std::chrono::steady_clock::now();
+            return rejections;
+        }
+
+        if (isChunking)
+        {
+            Metrics::Timer timer(_metrics, Metrics::DATA);
+
+            // The canonical content is sent unchanged, in chunks of
+            // BDAT_CHUNK_SIZE.
+            ChunkWriter writer(*this);
+            std::string chunk;
+            chunk.reserve(BDAT_CHUNK_SIZE);
+
+            message.write([&](const char* data, std::size_t size) {
+                while (size > 0)
+                {
+                    std::size_t length = std::min(size, std::size_t(BDAT_CHUNK_SIZE) - chunk.size());
+                    chunk.append(data, length);
+                    data += length;
+                    size -= length;
+
+                    if (chunk.size() == std::size_t(BDAT_CHUNK_SIZE))
+                    {
+                        writer.write(chunk.data(), chunk.size(), false);
+                        chunk.clear();
+                    }
+                }
+            });
+
+            writer.write(chunk.data(), chunk.size(), true);
+            writer.finish();
+        }
+        else
+        {
+            sendData(message);
+        }
+    }
+    catch (...)
+    {
+        _needsReset = true;
+        throw;
+    }
+
+    _lastTransaction = std::chrono::steady_clock::now();
+
+    return rejections;
+}
+
+
+void Connection::beginTransaction()
+{
+    if (!_session)
+    {
+        throw Poco::IllegalStateException("Connection is not open.");
+    }
+
+    if (_needsReset)
+    {
+        std::string response;
+        int status = _session->sendCommand("RSET", response);
+
+        if (2 != (status / 100))
+        {
+            throw Poco::Net::SMTPException("Cannot reset session", response, status);
+        }
+
+        _needsReset = false;
+    }
+
+    _lastReply = Reply();
+}
+
+
+std::string Connection::bodyParameter(bool isChunking) const
+{
+    // BINARYMIME may only be declared for BDAT transfers (RFC 3030).
+    if (isChunking && hasCapability("BINARYMIME"))
+        return " BODY=BINARYMIME";
+    else if (hasCapability("8BITMIME"))
+        return " BODY=8BITMIME";
+
+    return "";
+}
+
+
+void Connection::sendEnvelope(const std::string& sender,
+                              const std::vector<std::string>& recipients,
+                              std::vector<Rejection>* pRejections)
+{
+    Metrics::Timer timer(_metrics, Metrics::ENVELOPE);
+
+    if (hasCapability("PIPELINING"))
+    {
+        sendEnvelopePipelined(sender, recipients, pRejections);
+        return;
+    }
+
+    std::string response;
+    int status = _session->sendCommand("MAIL FROM:" + sender, response);
+
+    if (2 != (status / 100))
+    {
+        throw Poco::Net::SMTPException("Cannot send message", response, status);
+    }
+
+    std::unique_ptr<Poco::Net::SMTPException> error;
+
+    for (const auto& recipient: recipients)
+    {
+        status = _session->sendCommand("RCPT TO:<" + recipient + ">", response);
+
+        rejectRecipient(recipient, status, response, pRejections, error);
+
+        if (error)
+        {
+            error->rethrow();
+        }
+    }
+}
+
+
+void Connection::sendEnvelopePipelined(const std::string& sender,
+                                       const std::vector<std::string>& recipients,
+                                       std::vector<Rejection>* pRejections)
+{
+    Poco::Net::DialogSocket& socket = _session->socket();
+
+    // Write the whole envelope at once.
+    std::string commands = "MAIL FROM:" + sender + "\r\n";
+
+    for (const auto& recipient: recipients)
+        commands += "RCPT TO:<" + recipient + ">\r\n";
+
+    socket.sendString(commands);
+
+    // Read every reply, in order, even after a failure so that the session
+    // stays in sync.
+    std::string response;
+    int status = socket.receiveStatusMessage(response);
+
+    std::unique_ptr<Poco::Net::SMTPException> error;
+
+    if (2 != (status / 100))
+    {
+        error.reset(new Poco::Net::SMTPException("Cannot send message", response, status));
+    }
+
+    for (const auto& recipient: recipients)
+    {
+        status = socket.receiveStatusMessage(response);
+
+        // Recipients refused after MAIL FROM failed say nothing about the
+        // recipient.
+        if (!error)
+        {
+            rejectRecipient(recipient, status, response, pRejections, error);
+        }
+    }
+
+    if (error)
+    {
+        error->rethrow();
+    }
+}
+
+
+void Connection::rejectRecipient(const std::string& recipient,
+                                 int status,
+                                 const std::string& response,
+                                 std::vector<Rejection>* pRejections,
+                                 std::unique_ptr<Poco::Net::SMTPException>& error)
+{
+    if (2 == (status / 100) || error)
+        return;
+
+    Poco::Net::SMTPException exc("Recipient rejected: <" + recipient + ">", response, status);
+
+    // 421 means the server is closing the session, not that it refused
+    // this recipient.
+    if (pRejections && 421 != status)
+    {
+        pRejections->push_back(Rejection { recipient, exc });
+    }
+    else
+    {
+        error.reset(new Poco::Net::SMTPException(exc));
+    }
+}
+
+
+void Connection::sendData(const Poco::Net::MailMessage& message)
+{
+    Metrics::Timer timer(_metrics, Metrics::DATA);
+
+    std::string response;
+    int status = _session->sendCommand("DATA", response);
+
+    if (3 != (status / 100))
+    {
+        throw Poco::Net::SMTPException("Cannot send message data", response, status);
+    }
+
+    // Stream the message as it is generated, dot-stuffed in blocks rather
+    // than byte by byte.
+    DataEncoderStream stream(DataEncoder::DOT_STUFFED,
+                             [&](const std::string& block, bool) {
+                                 write(block.data(), block.size());
+                             });
+    message.write(stream);
+    stream.close();
+
+    status = _session->socket().receiveStatusMessage(response);
+
+    if (2 != (status / 100))
+    {
+        throw Poco::Net::SMTPException("The server rejected the message", response, status);
+    }
+
+    _lastReply.code = status;
+    _lastReply.text = response;
+}
+
+
+void Connection::sendData(const WireMessage& message)
+{
+    Metrics::Timer timer(_metrics, Metrics::DATA);
+
+    std::string response;
+    int status = _session->sendCommand("DATA", response);
+
+    if (3 != (status / 100))
+    {
+        throw Poco::Net::SMTPException("Cannot send message data", response, status);
+    }
+
+    if (message.hasDotLines())
+    {
+        DataEncoderStream stream(DataEncoder::DOT_STUFFED,
+                                 [&](const std::string& block, bool) {
+                                     write(block.data(), block.size());
+                                 });
+        message.write([&](const char* data, std::size_t size) {
+            stream.write(data, std::streamsize(size));
+        });
+        stream.close();
+    }
+    else
+    {
+        // The content ends with CRLF and needs no stuffing.
+        message.write([&](const char* data, std::size_t size) {
+            write(data, size);
+        });
+        write(".\r\n", 3);
+    }
+
+    status = _session->socket().receiveStatusMessage(response);
+
+    if (2 != (status / 100))
+    {
+        throw Poco::Net::SMTPException("The server rejected the message", response, status);
+    }
+
+    _lastReply.code = status;
+    _lastReply.text = response;
+}
+
+
+void Connection::write(const char* data, std::size_t size)
+{
+    Poco::Net::DialogSocket& socket = _session->socket();
+
+    _metrics.add(Metrics::BYTES_SENT, size);
+
+    while (size > 0)
+    {
+        int length = int(std::min(size, std::size_t(WRITE_CHUNK_SIZE)));
+        int sent = socket.sendBytes(data, length);
+
+        if (sent <= 0)
+        {
+            throw Poco::Net::NetException("Unable to write message data");
+        }
+
+        data += sent;
+        size -= std::size_t(sent);
+    }
+}
+
+
+Connection::ChunkWriter::ChunkWriter(Connection& connection):
+    _connection(connection),
+    _isPipelined(connection.hasCapability("PIPELINING"))
+{
+}
+
+
+void Connection::ChunkWriter::write(const char* data, std::size_t size, bool isLast)
+{
+    // RFC 3030: no chunk may follow a rejected one. Read the replies of the
+    // chunks already sent and fail, the transaction is then reset.
+    if (_error)
+    {
+        finish();
+    }
+
+    // Send the chunk header and data in a single write.
+    _frame = "BDAT " + std::to_string(size) + (isLast ? " LAST\r\n" : "\r\n");
+    _frame.append(data, size);
+    _connection.write(_frame.data(), _frame.size());
+
+    ++_pending;
+
+    // Without PIPELINING every chunk must be acknowledged before the next.
+    // With it, a few chunks are kept in flight.
+    while (_pending > (_isPipelined ? std::size_t(MAX_CHUNKS_IN_FLIGHT) : 0))
+    {
+        receive();
+    }
+}
+
+
+void Connection::ChunkWriter::finish()
+{
+    while (_pending > 0)
+    {
+        receive();
+    }
+
+    if (_error)
+    {
+        _error->rethrow();
+    }
+}
+
+
+void Connection::ChunkWriter::receive()
+{
+    std::string response;
+    int status = _connection._session->socket().receiveStatusMessage(response);
+
+    --_pending;
+
+    if (2 != (status / 100))
+    {
+        if (!_isPipelined)
+        {
+            throw Poco::Net::SMTPException("The server rejected the message", response, status);
+        }
+
+        // Keep reading the replies of chunks already sent.
+        if (!_error)
+        {
+            _error.reset(new Poco::Net::SMTPException("The server rejected the message", response, status));
+        }
+    }
+    else
+    {
+        // The reply to the last chunk accepts the message.
+        _connection._lastReply.code = status;
+        _connection._lastReply.text = response;
+    }
+}
+
+
+const Connection::Reply& Connection::lastReply() const
+{
+    return _lastReply;
+}
+
+
+bool Connection::reset()
+{
+    if (!_session)
+        return false;
+
+    try
+    {
+        std::string response;
+        int status = _session->sendCommand("RSET", response);
+
+        if (2 == (status / 100))
+        {
+            _needsReset = false;
+            _lastTransaction = std::chrono::steady_clock::now();
+            return true;
+        }
+
+        ofLogVerbose("Connection::reset") << "Session rejected RSET: " << response;
+    }
+    catch (const Poco::Exception& exc)
+    {
+        ofLogVerbose("Connection::reset") << "Session dropped: " << exc.displayText();
+    }
+
+    close();
+    return false;
+}
+
+
+bool Connection::keepAlive()
+{
+    if (!_session)
+        return false;
+
+    auto idle = std::chrono::steady_clock::now() - _lastTransaction;
+
+    if (idle >= std::chrono::microseconds(_settings.idleTimeout().totalMicroseconds()))
+    {
+        ofLogVerbose("Connection::keepAlive") << "Idle timeout.";
+        close();
+        return false;
+    }
+
+    try
+    {
+        std::string response;
+        int status = _session->sendCommand("NOOP", response);
+
+        if (2 == (status / 100))
+        {
+            // A NOOP is not a transaction, it does not extend the idle time.
+            _lastKeepAlive = std::chrono::steady_clock::now();
+            return true;
+        }
+
+        ofLogVerbose("Connection::keepAlive") << "Session rejected NOOP: " << response;
+    }
+    catch (const Poco::Exception& exc)
+    {
+        ofLogVerbose("Connection::keepAlive") << "Session dropped: " << exc.displayText();
+    }
+
+    close();
+    return false;
+}
+
+
+bool Connection::hasCapability(const std::string& keyword) const
+{
+    return _capabilities.find(keyword) != _capabilities.end();
+}
+
+
+const std::map<std::string, std::string>& Connection::capabilities() const
+{
+    return _capabilities;
+}
+
+
+std::chrono::steady_clock::time_point Connection::nextKeepAlive() const
+{
+    // The idle timeout is measured from the last transaction, NOOPs are
+    // scheduled from the last transaction or NOOP, whichever is later.
+    auto next = _lastTransaction + std::chrono::microseconds(_settings.idleTimeout().totalMicroseconds());
+
+    if (_settings.keepAliveInterval().totalMicroseconds() > 0)
+    {
+        next = std::min(next,
+                        std::max(_lastTransaction, _lastKeepAlive) + std::chrono::microseconds(_settings.keepAliveInterval().totalMicroseconds()));
+    }
+
+    return next;
+}
+
+
+Poco::Net::Session::Ptr Connection::tlsSession() const
+{
+    return _pTLSSession;
+}
+
+
+bool Connection::isTLSSessionReused() const
+{
+    return _isTLSSessionReused;
+}
+
+
+Settings Connection::settings() const
+{
+    return _settings;
+}
+
+
+} } // namespace ofx::SMTP
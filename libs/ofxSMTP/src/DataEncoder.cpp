@@ -0,0 +1,313 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/SMTP/DataEncoder.h"
+#include "ofx/SMTP/CPUFeatures.h"
+#include <cstring>
+
+
+#if defined(OFX_SMTP_X86)
+    #include <immintrin.h>
+#endif
+
+
+namespace ofx {
+namespace SMTP {
+
+
+namespace {
+
+
+/// \brief Find the next line feed.
+/// \returns a pointer to the line feed, or end.
+typedef const char* (*LineFeedFinder)(const char* begin, const char* end);
+
+
+const char* findLineFeedScalar(const char* begin, const char* end)
+{
+    const void* p = std::memchr(begin, '\n', std::size_t(end - begin));
+    return p ? static_cast<const char*>(p) : end;
+}
+
+
+#if defined(OFX_SMTP_X86)
+
+
+OFX_SMTP_TARGET("sse2")
+const char* findLineFeedSSE2(const char* begin, const char* end)
+{
+    const __m128i lf = _mm_set1_epi8('\n');
+
+    for (; end - begin >= 16; begin += 16)
+    {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+        unsigned mask = unsigned(_mm_movemask_epi8(_mm_cmpeq_epi8(block, lf)));
+
+        if (mask != 0)
+        {
+#if defined(_MSC_VER)
+            unsigned long index;
+            _BitScanForward(&index, mask);
+            return begin + index;
+#else
+            return begin + __builtin_ctz(mask);
+#endif
+        }
+    }
+
+    return findLineFeedScalar(begin, end);
+}
+
+
+OFX_SMTP_TARGET("avx2")
+const char* findLineFeedAVX2(const char* begin, const char* end)
+{
+    const __m256i lf = _mm256_set1_epi8('\n');
+
+    for (; end - begin >= 32; begin += 32)
+    {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+        unsigned mask = unsigned(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, lf)));
+
+        if (mask != 0)
+        {
+#if defined(_MSC_VER)
+            unsigned long index;
+            _BitScanForward(&index, mask);
+            return begin + index;
+#else
+            return begin + __builtin_ctz(mask);
+#endif
+        }
+    }
+
+    return findLineFeedScalar(begin, end);
+}
+
+
+#endif
+
+
+LineFeedFinder lineFeedFinder()
+{
+#if defined(OFX_SMTP_X86)
+    if (CPUFeatures::hasAVX2())
+        return findLineFeedAVX2;
+    else if (CPUFeatures::hasSSE2())
+        return findLineFeedSSE2;
+#endif
+
+    return findLineFeedScalar;
+}
+
+
+} // namespace
+
+
+DataEncoder::DataEncoder(Mode mode): _mode(mode)
+{
+}
+
+
+DataEncoder::~DataEncoder()
+{
+}
+
+
+void DataEncoder::encode(const char* data, std::size_t size, std::string& output)
+{
+    static const LineFeedFinder findLineFeed = lineFeedFinder();
+
+    output.reserve(output.size() + size + size / 64);
+
+    const char* end = data + size;
+    const char* span = data;
+    const char* p = data;
+
+    // Only the first byte of a line and the byte before a line feed need to
+    // be looked at. Everything in between is copied in spans.
+    while (p != end)
+    {
+        if (_isLineStart)
+        {
+            _isLineStart = false;
+
+            if (*p == '.')
+            {
+                _hasDotLines = true;
+
+                if (_mode == DOT_STUFFED)
+                {
+                    output.append(span, p);
+                    output.push_back('.');
+                    span = p;
+                }
+            }
+        }
+
+        const char* lf = findLineFeed(p, end);
+
+        if (lf == end)
+        {
+            _isCR = (end[-1] == '\r');
+            break;
+        }
+
+        if (!(lf == p ? _isCR : lf[-1] == '\r'))
+        {
+            // Bare LF, copy the pending span and insert the CR.
+            output.append(span, lf);
+            output.push_back('\r');
+            span = lf;
+        }
+
+        _isLineStart = true;
+        _isCR = false;
+        p = lf + 1;
+    }
+
+    output.append(span, end);
+}
+
+
+void DataEncoder::finish(std::string& output)
+{
+    if (!_isLineStart)
+    {
+        output.append(_isCR ? "\n" : "\r\n");
+        _isLineStart = true;
+        _isCR = false;
+    }
+
+    if (_mode == DOT_STUFFED)
+    {
+        output.append(".\r\n");
+    }
+}
+
+
+bool DataEncoder::hasDotLines() const
+{
+    return _hasDotLines;
+}
+
+
+std::string DataEncoder::encode(Mode mode, const std::string& data)
+{
+    std::string output;
+    DataEncoder encoder(mode);
+    encoder.encode(data.data(), data.size(), output);
+    encoder.finish(output);
+    return output;
+}
+
+
+DataEncoderStream::StreamBuf::StreamBuf(DataEncoder::Mode mode,
+                                         Sink sink,
+                                         std::size_t blockSize):
+    _encoder(mode),
+    _sink(sink),
+    _blockSize(blockSize),
+    _input(blockSize)
+{
+    setp(_input.data(), _input.data() + _input.size());
+}
+
+
+void DataEncoderStream::StreamBuf::close()
+{
+    if (_isClosed)
+        return;
+
+    _isClosed = true;
+
+    encodePending();
+    _encoder.finish(_output);
+    _sink(_output, true);
+    _output.clear();
+}
+
+
+const DataEncoder& DataEncoderStream::StreamBuf::encoder() const
+{
+    return _encoder;
+}
+
+
+DataEncoderStream::StreamBuf::int_type DataEncoderStream::StreamBuf::overflow(int_type c)
+{
+    if (_isClosed)
+        return traits_type::eof();
+
+    encodePending();
+
+    if (!traits_type::eq_int_type(c, traits_type::eof()))
+    {
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+    }
+
+    return traits_type::not_eof(c);
+}
+
+
+int DataEncoderStream::StreamBuf::sync()
+{
+    if (!_isClosed)
+        encodePending();
+
+    return 0;
+}
+
+
+void DataEncoderStream::StreamBuf::encodePending()
+{
+    std::size_t size = std::size_t(pptr() - pbase());
+
+    if (size > 0)
+    {
+        _encoder.encode(pbase(), size, _output);
+        setp(_input.data(), _input.data() + _input.size());
+    }
+
+    if (_output.size() >= _blockSize)
+    {
+        _sink(_output, false);
+        _output.clear();
+    }
+}
+
+
+DataEncoderStream::DataEncoderStream(DataEncoder::Mode mode,
+                                     Sink sink,
+                                     std::size_t blockSize):
+    std::ostream(nullptr),
+    _streamBuf(mode, sink, blockSize)
+{
+    rdbuf(&_streamBuf);
+}
+
+
+DataEncoderStream::~DataEncoderStream()
+{
+}
+
+
+void DataEncoderStream::close()
+{
+    flush();
+    _streamBuf.close();
+}
+
+
+const DataEncoder& DataEncoderStream::encoder() const
+{
+    return _streamBuf.encoder();
+}
+
+
+} } // namespace ofx::SMTP
@@ -0,0 +1,160 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/SMTP/DeliveryTicket.h"
+#include <algorithm>
+#include <chrono>
+
+
+namespace ofx {
+namespace SMTP {
+
+
+DeliveryTicket::DeliveryTicket()
+{
+}
+
+
+DeliveryTicket::DeliveryTicket(uint64_t id, std::size_t recipients):
+    _state(std::make_shared<State>())
+{
+    _state->id = id;
+    _state->pending = std::max(recipients, std::size_t(1));
+}
+
+
+DeliveryTicket::~DeliveryTicket()
+{
+}
+
+
+bool DeliveryTicket::isValid() const
+{
+    return _state != nullptr;
+}
+
+
+uint64_t DeliveryTicket::id() const
+{
+    return _state ? _state->id : 0;
+}
+
+
+bool DeliveryTicket::isDone() const
+{
+    if (!_state)
+        return false;
+
+    std::unique_lock<std::mutex> lock(_state->mutex);
+    return _state->pending == 0;
+}
+
+
+void DeliveryTicket::wait() const
+{
+    if (!_state)
+        return;
+
+    std::unique_lock<std::mutex> lock(_state->mutex);
+    _state->completed.wait(lock, [&]() { return _state->pending == 0; });
+}
+
+
+bool DeliveryTicket::wait(const Poco::Timespan& timeout) const
+{
+    if (!_state)
+        return false;
+
+    std::unique_lock<std::mutex> lock(_state->mutex);
+    return _state->completed.wait_for(lock,
+                                      std::chrono::microseconds(timeout.totalMicroseconds()),
+                                      [&]() { return _state->pending == 0; });
+}
+
+
+std::vector<DeliveryResultArgs> DeliveryTicket::results() const
+{
+    if (!_state)
+        return std::vector<DeliveryResultArgs>();
+
+    std::unique_lock<std::mutex> lock(_state->mutex);
+    return _state->results;
+}
+
+
+bool DeliveryTicket::isDelivered() const
+{
+    if (!_state)
+        return false;
+
+    std::unique_lock<std::mutex> lock(_state->mutex);
+
+    if (_state->pending > 0)
+        return false;
+
+    for (const auto& result: _state->results)
+    {
+        if (DeliveryResultArgs::DELIVERED != result.outcome())
+            return false;
+    }
+
+    return true;
+}
+
+
+void DeliveryTicket::then(Continuation continuation) const
+{
+    if (!_state || !continuation)
+        return;
+
+    {
+        std::unique_lock<std::mutex> lock(_state->mutex);
+
+        if (_state->pending > 0)
+        {
+            _state->continuations.push_back(continuation);
+            return;
+        }
+    }
+
+    continuation(*this);
+}
+
+
+void DeliveryTicket::complete(const DeliveryResultArgs& result) const
+{
+    if (!_state)
+        return;
+
+    std::vector<Continuation> continuations;
+
+    {
+        std::unique_lock<std::mutex> lock(_state->mutex);
+
+        if (_state->pending == 0)
+            return;
+
+        _state->results.push_back(result);
+
+        // A message without envelope recipients completes at once.
+        _state->pending -= std::min(_state->pending, std::max(result.recipients().size(), std::size_t(1)));
+
+        if (_state->pending > 0)
+            return;
+
+        continuations.swap(_state->continuations);
+    }
+
+    _state->completed.notify_all();
+
+    // Call without the lock, continuations may use the ticket.
+    for (const auto& continuation: continuations)
+        continuation(*this);
+}
+
+
+} } // namespace ofx::SMTP
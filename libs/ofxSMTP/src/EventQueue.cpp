@@ -0,0 +1,144 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/SMTP/EventQueue.h"
+
+
+namespace ofx {
+namespace SMTP {
+
+
+EventQueue::EventQueue(): _head(nullptr), _size(0), _isWaiting(false)
+{
+}
+
+
+EventQueue::~EventQueue()
+{
+    destroy(_head.exchange(nullptr));
+    destroy(_taken);
+}
+
+
+void EventQueue::push(Event event)
+{
+    Node* node = new Node;
+    node->event = std::move(event);
+    node->next = _head.load(std::memory_order_relaxed);
+
+    while (!_head.compare_exchange_weak(node->next, node))
+    {
+    }
+
+    _size.fetch_add(1, std::memory_order_relaxed);
+
+    // The consumer announces that it waits before it looks at the head, so
+    // either it sees the node or we see it waiting. Taking the mutex makes
+    // sure it is waiting on the condition before it is notified.
+    if (_isWaiting)
+    {
+        std::unique_lock<std::mutex> lock(_waitMutex);
+        _eventReady.notify_one();
+    }
+}
+
+
+std::size_t EventQueue::take(std::vector<Event>& events, std::size_t maxEvents)
+{
+    std::unique_lock<std::mutex> lock(_takeMutex);
+
+    std::size_t count = 0;
+
+    while (count < maxEvents)
+    {
+        if (!_taken)
+        {
+            // The pushed nodes are newest first, reverse them.
+            Node* node = _head.exchange(nullptr, std::memory_order_acquire);
+
+            while (node)
+            {
+                Node* next = node->next;
+                node->next = _taken;
+                _taken = node;
+                node = next;
+            }
+
+            if (!_taken)
+                break;
+        }
+
+        Node* node = _taken;
+        _taken = node->next;
+
+        events.push_back(std::move(node->event));
+        delete node;
+        ++count;
+    }
+
+    _size.fetch_sub(count, std::memory_order_relaxed);
+
+    return count;
+}
+
+
+bool EventQueue::wait(Clock::duration timeout)
+{
+    if (!empty())
+        return true;
+
+    std::unique_lock<std::mutex> lock(_waitMutex);
+
+    _isWaiting = true;
+
+    _eventReady.wait_for(lock, timeout, [&]() {
+        return _isWoken || !empty();
+    });
+
+    _isWaiting = false;
+    _isWoken = false;
+
+    return !empty();
+}
+
+
+void EventQueue::wake()
+{
+    std::unique_lock<std::mutex> lock(_waitMutex);
+    _isWoken = true;
+    _eventReady.notify_all();
+}
+
+
+bool EventQueue::empty() const
+{
+    if (_head.load() != nullptr)
+        return false;
+
+    std::unique_lock<std::mutex> lock(_takeMutex);
+    return _taken == nullptr;
+}
+
+
+std::size_t EventQueue::size() const
+{
+    return _size.load(std::memory_order_relaxed);
+}
+
+
+void EventQueue::destroy(Node* node)
+{
+    while (node)
+    {
+        Node* next = node->next;
+        delete node;
+        node = next;
+    }
+}
+
+
+} } // namespace ofx::SMTP
@@ -6,6 +6,7 @@
 
 
 #include "ofx/SMTP/Events.h"
+#include "Poco/String.h"
 
 
 namespace ofx {
@@ -54,4 +55,156 @@ std::shared_ptr<Poco::Net::MailMessage> ErrorArgs::getMessage() const
 }
 
 
+ConnectionArgs::ConnectionArgs(const Settings& settings,
+                               bool isTLSSessionReused):
+    _settings(settings),
+    _isTLSSessionReused(isTLSSessionReused)
+{
+}
+
+
+ConnectionArgs::~ConnectionArgs()
+{
+}
+
+
+const Settings& ConnectionArgs::settings() const
+{
+    return _settings;
+}
+
+
+bool ConnectionArgs::isTLSSessionReused() const
+{
+    return _isTLSSessionReused;
+}
+
+
+DeliveryResultArgs::Timings::Timings():
+    queueWait(Clock::duration::zero()),
+    transfer(Clock::duration::zero()),
+    total(Clock::duration::zero())
+{
+}
+
+
+DeliveryResultArgs::DeliveryResultArgs(std::shared_ptr<Poco::Net::MailMessage> message,
+                                       const std::vector<std::string>& recipients,
+                                       Outcome outcome,
+                                       std::size_t attempts,
+                                       const std::string& reason,
+                                       int replyCode,
+                                       const std::string& reply,
+                                       const Timings& timings):
+    _message(message),
+    _recipients(recipients),
+    _outcome(outcome),
+    _attempts(attempts),
+    _reason(reason),
+    _replyCode(replyCode),
+    _reply(reply),
+    _timings(timings)
+{
+}
+
+
+DeliveryResultArgs::~DeliveryResultArgs()
+{
+}
+
+
+std::shared_ptr<Poco::Net::MailMessage> DeliveryResultArgs::message() const
+{
+    return _message;
+}
+
+
+const std::vector<std::string>& DeliveryResultArgs::recipients() const
+{
+    return _recipients;
+}
+
+
+DeliveryResultArgs::Outcome DeliveryResultArgs::outcome() const
+{
+    return _outcome;
+}
+
+
+std::size_t DeliveryResultArgs::attempts() const
+{
+    return _attempts;
+}
+
+
+const std::string& DeliveryResultArgs::reason() const
+{
+    return _reason;
+}
+
+
+int DeliveryResultArgs::replyCode() const
+{
+    return _replyCode;
+}
+
+
+const std::string& DeliveryResultArgs::reply() const
+{
+    return _reply;
+}
+
+
+std::string DeliveryResultArgs::queueId() const
+{
+    // Postfix and Sendmail say "queued as ID", Exim "id=ID".
+    std::string reply = Poco::toLower(_reply);
+    std::size_t start = std::string::npos;
+
+    for (const std::string& marker: { std::string("queued as "), std::string("id=") })
+    {
+        std::size_t position = reply.find(marker);
+
+        if (position != std::string::npos)
+        {
+            start = position + marker.size();
+            break;
+        }
+    }
+
+    if (start == std::string::npos)
+        return "";
+
+    std::size_t end = _reply.find_first_of(" \t\r\n", start);
+
+    return _reply.substr(start, end == std::string::npos ? std::string::npos : end - start);
+}
+
+
+const DeliveryResultArgs::Timings& DeliveryResultArgs::timings() const
+{
+    return _timings;
+}
+
+
+std::string DeliveryResultArgs::toString(Outcome outcome)
+{
+    switch (outcome)
+    {
+        case DELIVERED:
+            return "DELIVERED";
+        case REJECTED:
+            return "REJECTED";
+        case TOO_MANY_ATTEMPTS:
+            return "TOO_MANY_ATTEMPTS";
+        case EXPIRED:
+            return "EXPIRED";
+        case DROPPED:
+            return "DROPPED";
+    }
+
+    return "UNKNOWN";
+}
+
+
 } } // namespace ofx::SMTP
@@ -0,0 +1,600 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/SMTP/Journal.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include "Poco/Checksum.h"
+#include "Poco/Exception.h"
+#include "Poco/File.h"
+#include "Poco/Path.h"
+#include "ofLog.h"
+#include "ofUtils.h"
+
+
+#if defined(_WIN32)
+    #include <io.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+
+namespace ofx {
+namespace SMTP {
+
+
+namespace {
+
+
+const std::string EXTENSION = ".wal";
+
+
+/// \brief length (4), checksum (4), type (1), id (8).
+const std::size_t HEADER_SIZE = 17;
+
+
+void putUInt32(char* data, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+        data[i] = char((value >> (8 * i)) & 0xFF);
+}
+
+
+void putUInt64(char* data, uint64_t value)
+{
+    for (int i = 0; i < 8; ++i)
+        data[i] = char((value >> (8 * i)) & 0xFF);
+}
+
+
+uint32_t getUInt32(const char* data)
+{
+    uint32_t value = 0;
+
+    for (int i = 0; i < 4; ++i)
+        value |= uint32_t(uint8_t(data[i])) << (8 * i);
+
+    return value;
+}
+
+
+uint64_t getUInt64(const char* data)
+{
+    uint64_t value = 0;
+
+    for (int i = 0; i < 8; ++i)
+        value |= uint64_t(uint8_t(data[i])) << (8 * i);
+
+    return value;
+}
+
+
+uint32_t checksum(const char* header, const std::string& payload)
+{
+    // The type and id are covered along with the payload.
+    Poco::Checksum crc(Poco::Checksum::TYPE_CRC32);
+    crc.update(header + 8, unsigned(HEADER_SIZE - 8));
+    crc.update(payload);
+    return crc.checksum();
+}
+
+
+bool syncFile(std::FILE* file)
+{
+#if defined(_WIN32)
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+
+void syncDirectory(const std::string& directory)
+{
+#if !defined(_WIN32)
+    // Make the creation of a new segment durable.
+    int fd = ::open(directory.c_str(), O_RDONLY);
+
+    if (fd >= 0)
+    {
+        fsync(fd);
+        ::close(fd);
+    }
+#endif
+}
+
+
+} // namespace
+
+
+Journal::Journal()
+{
+}
+
+
+Journal::~Journal()
+{
+    close();
+}
+
+
+bool Journal::open(const std::string& directory,
+                   const Poco::Timespan& syncInterval,
+                   std::size_t segmentSize,
+                   std::vector<Outbox::Entry>& entries)
+{
+    close();
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    _directory = ofToDataPath(directory, true);
+    _syncInterval = syncInterval;
+    _segmentSize = segmentSize;
+    _liveCounts.clear();
+    _messages.clear();
+    _nextId = 1;
+    _segment = 0;
+    _isClosing = false;
+
+    std::vector<uint64_t> segments;
+
+    try
+    {
+        Poco::File(_directory).createDirectories();
+
+        std::vector<std::string> files;
+        Poco::File(_directory).list(files);
+
+        for (const auto& file: files)
+        {
+            if (file.size() > EXTENSION.size()
+            &&  file.compare(file.size() - EXTENSION.size(), EXTENSION.size(), EXTENSION) == 0)
+            {
+                std::string digits = file.substr(0, file.size() - EXTENSION.size());
+                uint64_t segment = std::strtoull(digits.c_str(), nullptr, 10);
+
+                // Only names written by path() are segments.
+                if (digits.find_first_not_of("0123456789") != std::string::npos
+                ||  Poco::Path(path(segment)).getFileName() != file)
+                {
+                    ofLogWarning("Journal::open") << "Ignoring " << file << ", not a segment file name.";
+                    continue;
+                }
+
+                segments.push_back(segment);
+            }
+        }
+    }
+    catch (const std::exception& exc)
+    {
+        ofLogError("Journal::open") << "Unable to open " << _directory << ": " << exc.what();
+        _directory.clear();
+        return false;
+    }
+
+    std::sort(segments.begin(), segments.end());
+
+    std::map<uint64_t, Outbox::Entry> replayed;
+
+    for (auto segment: segments)
+    {
+        _liveCounts[segment] = 0;
+        replay(segment, replayed);
+        _segment = segment + 1;
+    }
+
+    for (auto& entry: replayed)
+    {
+        ++_liveCounts[_messages[entry.first]];
+
+        entry.second.message = entry.second.wire->headers();
+        entry.second.size = entry.second.wire->size();
+        entry.second.journalId = entry.first;
+        entries.push_back(entry.second);
+    }
+
+    // Replayed segments are never appended to. Start a new one.
+    if (!rotate(lock))
+    {
+        _directory.clear();
+        return false;
+    }
+
+    collectGarbage();
+
+    if (_syncInterval.totalMicroseconds() > 0)
+    {
+        _flusher = std::thread(&Journal::flush, this);
+    }
+
+    ofLogVerbose("Journal::open") << "Replaying " << entries.size() << " journaled message(s).";
+    return true;
+}
+
+
+void Journal::close()
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        if (!_file)
+            return;
+
+        _isClosing = true;
+    }
+
+    _condition.notify_all();
+
+    if (_flusher.joinable())
+        _flusher.join();
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    waitForSync(lock, _written);
+
+    std::fclose(_file);
+    _file = nullptr;
+    _directory.clear();
+}
+
+
+bool Journal::isOpen() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _file != nullptr;
+}
+
+
+uint64_t Journal::append(const WireMessage& message,
+                         Settings::Priority priority,
+                         std::size_t attempts)
+{
+    char attributes[5];
+    attributes[0] = char(priority);
+    putUInt32(attributes + 1, uint32_t(attempts));
+
+    std::ostringstream payload;
+    payload.write(attributes, sizeof(attributes));
+    message.serialize(payload);
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    if (!_file || _isClosing)
+        return 0;
+
+    if (_segmentBytes >= _segmentSize && !rotate(lock))
+        return 0;
+
+    uint64_t id = _nextId++;
+    uint64_t position = write(lock, ENTRY, id, payload.str());
+
+    if (position == 0)
+        return 0;
+
+    _messages[id] = _segment;
+    ++_liveCounts[_segment];
+
+    if (_syncInterval.totalMicroseconds() <= 0)
+    {
+        waitForSync(lock, position);
+    }
+
+    return id;
+}
+
+
+void Journal::setAttempts(uint64_t id, std::size_t attempts)
+{
+    if (id == 0)
+        return;
+
+    std::string payload(4, '\0');
+    putUInt32(&payload[0], uint32_t(attempts));
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    if (_file && _messages.find(id) != _messages.end())
+        write(lock, ATTEMPTS, id, payload);
+}
+
+
+void Journal::remove(uint64_t id)
+{
+    if (id == 0)
+        return;
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    auto iter = _messages.find(id);
+
+    if (!_file || iter == _messages.end())
+        return;
+
+    uint64_t segment = iter->second;
+    _messages.erase(iter);
+
+    // A lost tombstone only means the message is delivered again, so
+    // tombstones do not wait for a sync.
+    write(lock, TOMBSTONE, id, std::string());
+
+    --_liveCounts[segment];
+
+    collectGarbage();
+
+    if (_segmentBytes >= _segmentSize)
+        rotate(lock);
+}
+
+
+void Journal::sync()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    if (_file)
+        waitForSync(lock, _written);
+}
+
+
+std::size_t Journal::size() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _messages.size();
+}
+
+
+void Journal::replay(uint64_t segment,
+                     std::map<uint64_t, Outbox::Entry>& entries)
+{
+    std::ifstream file(path(segment), std::ios::in | std::ios::binary | std::ios::ate);
+
+    uint64_t remaining = file ? uint64_t(std::max(std::streamoff(file.tellg()), std::streamoff(0))) : 0;
+    file.seekg(0);
+
+    char header[HEADER_SIZE];
+
+    while (remaining >= HEADER_SIZE && file.read(header, HEADER_SIZE))
+    {
+        remaining -= HEADER_SIZE;
+
+        uint32_t length = getUInt32(header);
+        uint32_t crc = getUInt32(header + 4);
+        RecordType type = RecordType(uint8_t(header[8]));
+        uint64_t id = getUInt64(header + 9);
+
+        // A torn header may claim any length. Never allocate more than the
+        // segment holds.
+        if (length > remaining)
+        {
+            ofLogWarning("Journal::replay") << "Ignoring incomplete record in " << path(segment);
+            break;
+        }
+
+        remaining -= length;
+
+        std::string payload(length, '\0');
+
+        if ((length > 0 && !file.read(&payload[0], length)) || crc != checksum(header, payload))
+        {
+            // A torn record at the end of a segment was never acknowledged.
+            ofLogWarning("Journal::replay") << "Ignoring incomplete record in " << path(segment);
+            break;
+        }
+
+        _nextId = std::max(_nextId, id + 1);
+
+        if (MESSAGE == type || ENTRY == type)
+        {
+            try
+            {
+                Outbox::Entry entry;
+                std::size_t offset = 0;
+
+                if (ENTRY == type)
+                {
+                    if (payload.size() < 5 || uint8_t(payload[0]) >= Settings::NUM_PRIORITIES)
+                        throw Poco::DataFormatException("Malformed entry");
+
+                    entry.priority = Settings::Priority(uint8_t(payload[0]));
+                    entry.attempts = getUInt32(payload.data() + 1);
+                    offset = 5;
+                }
+
+                std::istringstream stream(payload.substr(offset));
+                entry.wire = WireMessage::deserialize(stream);
+                entries[id] = entry;
+                _messages[id] = segment;
+            }
+            catch (const std::exception& exc)
+            {
+                ofLogError("Journal::replay") << "Skipping unreadable message " << id << ": " << exc.what();
+            }
+        }
+        else if (ATTEMPTS == type)
+        {
+            auto iter = entries.find(id);
+
+            if (iter != entries.end() && payload.size() == 4)
+                iter->second.attempts = getUInt32(payload.data());
+        }
+        else if (TOMBSTONE == type)
+        {
+            entries.erase(id);
+            _messages.erase(id);
+        }
+    }
+}
+
+
+uint64_t Journal::write(std::unique_lock<std::mutex>& lock,
+                        RecordType type,
+                        uint64_t id,
+                        const std::string& payload)
+{
+    char header[HEADER_SIZE];
+    putUInt32(header, uint32_t(payload.size()));
+    header[8] = char(type);
+    putUInt64(header + 9, id);
+    putUInt32(header + 4, checksum(header, payload));
+
+    if (std::fwrite(header, 1, HEADER_SIZE, _file) != HEADER_SIZE
+    ||  std::fwrite(payload.data(), 1, payload.size(), _file) != payload.size()
+    ||  std::fflush(_file) != 0)
+    {
+        ofLogError("Journal::write") << "Unable to write to " << path(_segment);
+
+        // Replay stops at the partial record, so nothing may follow it in
+        // this segment. Later records go to a new one.
+        std::clearerr(_file);
+        rotate(lock);
+        return 0;
+    }
+
+    _segmentBytes += HEADER_SIZE + payload.size();
+    _written += HEADER_SIZE + payload.size();
+
+    _condition.notify_all();
+
+    return _written;
+}
+
+
+bool Journal::rotate(std::unique_lock<std::mutex>& lock)
+{
+    if (_file)
+    {
+        // Everything in the old segment must be durable before it is
+        // closed, and no other thread may be syncing it.
+        waitForSync(lock, _written);
+
+        while (_isSyncing)
+            _condition.wait(lock);
+
+        std::fclose(_file);
+        _file = nullptr;
+        ++_segment;
+    }
+
+    _file = std::fopen(path(_segment).c_str(), "ab");
+
+    if (!_file)
+    {
+        ofLogError("Journal::rotate") << "Unable to create " << path(_segment);
+        return false;
+    }
+
+    syncDirectory(_directory);
+
+    _liveCounts[_segment] = 0;
+    _segmentBytes = 0;
+    return true;
+}
+
+
+void Journal::waitForSync(std::unique_lock<std::mutex>& lock, uint64_t position)
+{
+    while (_synced < position && _file)
+    {
+        if (_isSyncing)
+        {
+            _condition.wait(lock);
+        }
+        else
+        {
+            syncUnlocked(lock);
+        }
+    }
+}
+
+
+void Journal::syncUnlocked(std::unique_lock<std::mutex>& lock)
+{
+    // This thread syncs every record written so far on behalf of all
+    // waiting threads. Others may keep appending meanwhile.
+    _isSyncing = true;
+
+    uint64_t position = _written;
+    std::FILE* file = _file;
+
+    lock.unlock();
+    bool isSynced = syncFile(file);
+    lock.lock();
+
+    if (!isSynced)
+    {
+        ofLogError("Journal::sync") << "Unable to sync " << path(_segment);
+    }
+
+    // Failures are not retried forever, the records are with the OS.
+    _synced = std::max(_synced, position);
+    _isSyncing = false;
+
+    _condition.notify_all();
+}
+
+
+void Journal::collectGarbage()
+{
+    while (!_liveCounts.empty())
+    {
+        auto oldest = _liveCounts.begin();
+
+        if (oldest->first == _segment || oldest->second > 0)
+            break;
+
+        try
+        {
+            Poco::File(path(oldest->first)).remove();
+        }
+        catch (const Poco::Exception& exc)
+        {
+            ofLogError("Journal::collectGarbage") << exc.displayText();
+            break;
+        }
+
+        _liveCounts.erase(oldest);
+    }
+}
+
+
+void Journal::flush()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    auto interval = std::chrono::microseconds(_syncInterval.totalMicroseconds());
+
+    while (!_isClosing)
+    {
+        // Wait for a record, then give others the interval to join it.
+        _condition.wait(lock, [&]() { return _isClosing || _synced < _written; });
+
+        if (_isClosing)
+            break;
+
+        _condition.wait_for(lock, interval, [&]() { return _isClosing; });
+
+        if (_synced < _written && !_isSyncing)
+        {
+            syncUnlocked(lock);
+        }
+    }
+}
+
+
+std::string Journal::path(uint64_t segment) const
+{
+    std::ostringstream filename;
+    filename << std::setw(20) << std::setfill('0') << segment << EXTENSION;
+    return Poco::Path(Poco::Path(_directory), filename.str()).toString();
+}
+
+
+} } // namespace ofx::SMTP
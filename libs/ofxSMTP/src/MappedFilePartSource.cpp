@@ -0,0 +1,96 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/SMTP/MappedFilePartSource.h"
+#include "Poco/File.h"
+#include "Poco/MemoryStream.h"
+#include "Poco/Path.h"
+
+
+namespace ofx {
+namespace SMTP {
+
+
+MappedFilePartSource::MappedFilePartSource(const std::string& path):
+    _filename(Poco::Path(path).getFileName())
+{
+    map(path);
+}
+
+
+MappedFilePartSource::MappedFilePartSource(const std::string& path,
+                                           const std::string& mediaType):
+    Poco::Net::PartSource(mediaType),
+    _filename(Poco::Path(path).getFileName())
+{
+    map(path);
+}
+
+
+MappedFilePartSource::MappedFilePartSource(const std::string& path,
+                                           const std::string& filename,
+                                           const std::string& mediaType):
+    Poco::Net::PartSource(mediaType),
+    _filename(filename)
+{
+    map(path);
+}
+
+
+MappedFilePartSource::~MappedFilePartSource()
+{
+}
+
+
+std::istream& MappedFilePartSource::stream()
+{
+    // A fresh stream is returned on every call so the part can be written
+    // more than once.
+    _pStream.reset(new Poco::MemoryInputStream(data(), std::streamsize(_size)));
+    return *_pStream;
+}
+
+
+const std::string& MappedFilePartSource::filename() const
+{
+    return _filename;
+}
+
+
+std::streamsize MappedFilePartSource::getContentLength() const
+{
+    return std::streamsize(_size);
+}
+
+
+const char* MappedFilePartSource::data() const
+{
+    return _pMemory ? _pMemory->begin() : nullptr;
+}
+
+
+std::size_t MappedFilePartSource::size() const
+{
+    return _size;
+}
+
+
+void MappedFilePartSource::map(const std::string& path)
+{
+    Poco::File file(path);
+
+    _size = std::size_t(file.getSize());
+
+    // An empty file cannot be mapped.
+    if (_size > 0)
+    {
+        _pMemory = std::make_shared<const Poco::SharedMemory>(file, Poco::SharedMemory::AM_READ);
+    }
+}
+
+
+} } // namespace ofx::SMTP
@@ -0,0 +1,493 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/SMTP/MessageTemplate.h"
+#include "ofx/SMTP/Base64.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iomanip>
+#include <sstream>
+#include "Poco/DateTimeFormat.h"
+#include "Poco/DateTimeFormatter.h"
+#include "Poco/Exception.h"
+#include "Poco/String.h"
+#include "Poco/Timestamp.h"
+#include "Poco/Net/StringPartSource.h"
+#include "ofLog.h"
+
+
+namespace ofx {
+namespace SMTP {
+
+
+namespace {
+
+
+/// \brief The marker slots that are not fields.
+enum
+{
+    SUBJECT_SLOT,
+    RECIPIENT_SLOT,
+    DATE_SLOT,
+    FIRST_FIELD_SLOT
+};
+
+
+/// \brief The number of hex digits of a marker slot.
+const std::size_t SLOT_DIGITS = 8;
+
+
+/// \returns the text with line breaks replaced by spaces, so it can not
+///          start a new header.
+std::string singleLine(std::string text)
+{
+    for (auto& c: text)
+    {
+        if (c == '\r' || c == '\n')
+            c = ' ';
+    }
+
+    return text;
+}
+
+
+} // namespace
+
+
+MessageTemplate::MessageTemplate()
+{
+}
+
+
+MessageTemplate::~MessageTemplate()
+{
+}
+
+
+void MessageTemplate::setSender(const std::string& sender)
+{
+    if (isMutable("MessageTemplate::setSender"))
+        _sender = sender;
+}
+
+
+void MessageTemplate::setSubject(const std::string& subject)
+{
+    if (isMutable("MessageTemplate::setSubject"))
+        _subject = subject;
+}
+
+
+void MessageTemplate::setContent(const std::string& content,
+                                 const std::string& mediaType)
+{
+    if (isMutable("MessageTemplate::setContent"))
+    {
+        _content = content;
+        _mediaType = mediaType;
+    }
+}
+
+
+void MessageTemplate::setHeader(const std::string& name, const std::string& value)
+{
+    if (isMutable("MessageTemplate::setHeader"))
+        _headers.push_back(std::make_pair(name, value));
+}
+
+
+void MessageTemplate::addPart(const std::string& name,
+                              Poco::Net::PartSource* pSource,
+                              Poco::Net::MailMessage::ContentDisposition disposition,
+                              Poco::Net::MailMessage::ContentTransferEncoding encoding)
+{
+    Part part;
+    part.name = name;
+    part.source.reset(pSource);
+    part.disposition = disposition;
+    part.encoding = encoding;
+
+    if (isMutable("MessageTemplate::addPart"))
+        _parts.push_back(std::move(part));
+}
+
+
+void MessageTemplate::addAttachment(const std::string& name,
+                                    Poco::Net::PartSource* pSource,
+                                    Poco::Net::MailMessage::ContentTransferEncoding encoding)
+{
+    addPart(name, pSource, Poco::Net::MailMessage::CONTENT_ATTACHMENT, encoding);
+}
+
+
+void MessageTemplate::compile()
+{
+    static std::atomic<uint64_t> templateCount(0);
+
+    if (!isMutable("MessageTemplate::compile"))
+        return;
+
+    // Fields, the subject, the recipient and the date are rendered as
+    // unique markers, then the rendered message is split at the markers.
+    std::ostringstream prefixStream;
+    prefixStream << "ofxSMTP-merge-"
+                 << std::hex << std::setw(16) << std::setfill('0')
+                 << templateCount++ << "-";
+
+    const std::string prefix = prefixStream.str();
+
+    auto marker = [&](std::size_t slot) {
+        std::ostringstream stream;
+        stream << prefix << std::hex << std::setw(SLOT_DIGITS) << std::setfill('0') << slot;
+        return stream.str();
+    };
+
+    _subjectTokens = parse(_subject);
+
+    std::string content;
+
+    for (const auto& token: parse(_content))
+    {
+        if (token.field == NO_FIELD)
+            content.append(token.text);
+        else
+            content.append(marker(FIRST_FIELD_SLOT + token.field));
+    }
+
+    Poco::Net::MailMessage message;
+    message.setSender(_sender);
+    message.setSubject(marker(SUBJECT_SLOT));
+    message.addRecipient(Poco::Net::MailRecipient(Poco::Net::MailRecipient::PRIMARY_RECIPIENT,
+                                                  marker(RECIPIENT_SLOT)));
+    message.set(Poco::Net::MailMessage::HEADER_DATE, marker(DATE_SLOT));
+
+    for (const auto& header: _headers)
+        message.set(header.first, header.second);
+
+    if (_parts.empty())
+    {
+        message.setContentType(_mediaType);
+        message.setContent(content, Poco::Net::MailMessage::ENCODING_8BIT);
+    }
+    else
+    {
+        message.addContent(new Poco::Net::StringPartSource(content, _mediaType),
+                           Poco::Net::MailMessage::ENCODING_8BIT);
+
+        for (auto& part: _parts)
+        {
+            message.addPart(part.name,
+                            part.source.release(),
+                            part.disposition,
+                            part.encoding);
+        }
+
+        _parts.clear();
+    }
+
+    auto wire = WireMessage::render(message);
+
+    for (const auto& segment: wire->_segments)
+    {
+        if (!segment.text)
+        {
+            Piece piece;
+            piece.segment = segment;
+            _pieces.push_back(piece);
+            continue;
+        }
+
+        const std::string& text = *segment.text;
+        std::size_t offset = 0;
+
+        while (offset < text.size())
+        {
+            std::size_t position = text.find(prefix, offset);
+            std::size_t end = position == std::string::npos ? text.size() : position;
+
+            if (end > offset)
+            {
+                Piece piece;
+
+                if (offset == 0 && end == text.size())
+                    piece.segment.text = segment.text;
+                else
+                    piece.segment.text = std::make_shared<const std::string>(text.substr(offset, end - offset));
+
+                _pieces.push_back(piece);
+            }
+
+            if (position == std::string::npos)
+                break;
+
+            std::size_t slot = std::stoul(text.substr(position + prefix.size(), SLOT_DIGITS), nullptr, 16);
+
+            Piece piece;
+
+            switch (slot)
+            {
+                case SUBJECT_SLOT:
+                    piece.type = Piece::SUBJECT;
+                    break;
+                case RECIPIENT_SLOT:
+                    piece.type = Piece::RECIPIENT;
+                    break;
+                case DATE_SLOT:
+                    piece.type = Piece::DATE;
+                    break;
+                default:
+                    piece.type = Piece::FIELD;
+                    piece.field = slot - FIRST_FIELD_SLOT;
+
+                    if (piece.field >= _fields.size())
+                        throw Poco::IllegalStateException("Unknown template field");
+
+                    break;
+            }
+
+            _pieces.push_back(piece);
+
+            offset = position + prefix.size() + SLOT_DIGITS;
+        }
+    }
+
+    _envelopeSender = wire->sender();
+    _hasDotLines = wire->hasDotLines();
+    _isCompiled = true;
+}
+
+
+bool MessageTemplate::isCompiled() const
+{
+    return _isCompiled;
+}
+
+
+const std::vector<std::string>& MessageTemplate::fields() const
+{
+    return _fields;
+}
+
+
+std::shared_ptr<const WireMessage> MessageTemplate::render(const std::string& recipient,
+                                                           const Fields& fields) const
+{
+    if (!_isCompiled)
+    {
+        throw Poco::IllegalStateException("The template is not compiled");
+    }
+
+    std::shared_ptr<WireMessage> wire(new WireMessage());
+
+    wire->_sender = _envelopeSender;
+    wire->_recipients.push_back(singleLine(recipient));
+    wire->_hasDotLines = _hasDotLines;
+
+    // Short pieces are gathered here and written as a single segment.
+    std::string text;
+
+    auto flush = [&]() {
+        if (text.empty())
+            return;
+
+        WireMessage::Segment segment;
+        segment.text = std::make_shared<const std::string>(std::move(text));
+        wire->_size += segment.text->size();
+        wire->_segments.push_back(segment);
+        text.clear();
+    };
+
+    // A field value may start a line with '.' where the template did not.
+    bool isLineStart = true;
+
+    for (const auto& piece: _pieces)
+    {
+        switch (piece.type)
+        {
+            case Piece::CONTENT:
+            {
+                if (!piece.segment.text)
+                {
+                    flush();
+                    wire->_segments.push_back(piece.segment);
+                    wire->_size += Base64::encodedSize(piece.segment.fileSize);
+                    isLineStart = false;
+                    break;
+                }
+
+                const std::string& literal = *piece.segment.text;
+
+                if (isLineStart && literal.front() == '.')
+                    wire->_hasDotLines = true;
+
+                if (literal.size() >= SHARED_TEXT_SIZE)
+                {
+                    flush();
+                    wire->_segments.push_back(piece.segment);
+                    wire->_size += literal.size();
+                }
+                else
+                {
+                    text.append(literal);
+                }
+
+                isLineStart = literal.back() == '\n';
+                break;
+            }
+            case Piece::SUBJECT:
+                text.append(Poco::Net::MailMessage::encodeWord(singleLine(renderSubject(fields)), "UTF-8"));
+                isLineStart = false;
+                break;
+            case Piece::RECIPIENT:
+                text.append(wire->_recipients.front());
+                isLineStart = false;
+                break;
+            case Piece::DATE:
+                text.append(Poco::DateTimeFormatter::format(Poco::Timestamp(), Poco::DateTimeFormat::RFC1123_FORMAT));
+                isLineStart = false;
+                break;
+            case Piece::FIELD:
+            {
+                auto iter = fields.find(_fields[piece.field]);
+
+                if (iter == fields.end() || iter->second.empty())
+                    break;
+
+                std::size_t start = text.size();
+
+                appendCanonical(iter->second, text);
+
+                if ((isLineStart && text[start] == '.') || text.find("\n.", start) != std::string::npos)
+                    wire->_hasDotLines = true;
+
+                isLineStart = text.back() == '\n';
+                break;
+            }
+        }
+    }
+
+    flush();
+
+    return wire;
+}
+
+
+std::string MessageTemplate::renderSubject(const Fields& fields) const
+{
+    std::string subject;
+
+    for (const auto& token: _subjectTokens)
+    {
+        if (token.field == NO_FIELD)
+        {
+            subject.append(token.text);
+            continue;
+        }
+
+        auto iter = fields.find(_fields[token.field]);
+
+        if (iter != fields.end())
+            subject.append(iter->second);
+    }
+
+    return subject;
+}
+
+
+std::vector<MessageTemplate::Token> MessageTemplate::parse(const std::string& text)
+{
+    std::vector<Token> tokens;
+    std::size_t offset = 0;
+
+    auto literal = [&](std::size_t end) {
+        if (end > offset)
+        {
+            Token token;
+            token.text = text.substr(offset, end - offset);
+            token.field = NO_FIELD;
+            tokens.push_back(token);
+        }
+    };
+
+    while (offset < text.size())
+    {
+        std::size_t open = text.find("{{", offset);
+        std::size_t close = open == std::string::npos ? open : text.find("}}", open + 2);
+
+        if (close == std::string::npos)
+            break;
+
+        std::string name = Poco::trim(text.substr(open + 2, close - open - 2));
+
+        // "{{}}" is not a field.
+        if (name.empty())
+        {
+            literal(close + 2);
+            offset = close + 2;
+            continue;
+        }
+
+        literal(open);
+
+        auto iter = std::find(_fields.begin(), _fields.end(), name);
+
+        Token token;
+        token.field = std::size_t(iter - _fields.begin());
+        tokens.push_back(token);
+
+        if (iter == _fields.end())
+            _fields.push_back(name);
+
+        offset = close + 2;
+    }
+
+    literal(text.size());
+
+    return tokens;
+}
+
+
+bool MessageTemplate::isMutable(const std::string& function) const
+{
+    if (_isCompiled)
+    {
+        ofLogError(function) << "The template is already compiled.";
+        return false;
+    }
+
+    return true;
+}
+
+
+void MessageTemplate::appendCanonical(const std::string& value, std::string& text)
+{
+    for (std::size_t i = 0; i < value.size(); ++i)
+    {
+        char c = value[i];
+
+        if (c == '\r')
+        {
+            // A CR is a line break, with or without its LF.
+            text.append("\r\n");
+
+            if (i + 1 < value.size() && value[i + 1] == '\n')
+                ++i;
+        }
+        else if (c == '\n')
+        {
+            text.append("\r\n");
+        }
+        else
+        {
+            text.push_back(c);
+        }
+    }
+}
+
+
+} } // namespace ofx::SMTP
@@ -0,0 +1,326 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/SMTP/Metrics.h"
+#include <algorithm>
+#include <sstream>
+
+
+#if defined(_MSC_VER)
+    #include <intrin.h>
+#endif
+
+
+namespace ofx {
+namespace SMTP {
+
+
+namespace {
+
+
+/// \returns the bucket of a duration in microseconds.
+std::size_t bucketIndex(uint64_t micros)
+{
+    // Bucket i holds (2^(i-1), 2^i], so its bound is inclusive like the
+    // "le" bound of a Prometheus bucket.
+    if (micros <= 1)
+        return 0;
+
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse64(&index, micros - 1);
+    std::size_t width = std::size_t(index) + 1;
+#else
+    std::size_t width = std::size_t(64 - __builtin_clzll(micros - 1));
+#endif
+
+    return std::min(width, std::size_t(Histogram::NUM_BUCKETS - 1));
+}
+
+
+/// \returns a duration in seconds.
+double seconds(Histogram::Clock::duration duration)
+{
+    return std::chrono::duration<double>(duration).count();
+}
+
+
+} // namespace
+
+
+Histogram::Histogram(): _count(0), _sum(0)
+{
+    for (auto& bucket: _buckets)
+        bucket = 0;
+}
+
+
+Histogram::~Histogram()
+{
+}
+
+
+void Histogram::record(Clock::duration duration)
+{
+    auto micros = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+    uint64_t value = micros > 0 ? uint64_t(micros) : 0;
+
+    _buckets[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    _count.fetch_add(1, std::memory_order_relaxed);
+    _sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+
+uint64_t Histogram::count() const
+{
+    return _count.load(std::memory_order_relaxed);
+}
+
+
+Histogram::Clock::duration Histogram::sum() const
+{
+    return std::chrono::microseconds(_sum.load(std::memory_order_relaxed));
+}
+
+
+Histogram::Clock::duration Histogram::quantile(double quantile) const
+{
+    std::array<uint64_t, NUM_BUCKETS> counts;
+    uint64_t total = 0;
+
+    // Read the buckets once, they may change while we look.
+    for (std::size_t i = 0; i < NUM_BUCKETS; ++i)
+    {
+        counts[i] = _buckets[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+
+    if (total == 0)
+        return Clock::duration::zero();
+
+    double rank = std::min(std::max(quantile, 0.0), 1.0) * double(total);
+    uint64_t cumulative = 0;
+
+    for (std::size_t i = 0; i < NUM_BUCKETS; ++i)
+    {
+        if (counts[i] == 0 || double(cumulative + counts[i]) < rank)
+        {
+            cumulative += counts[i];
+            continue;
+        }
+
+        // The last bucket is unbounded, report its lower bound.
+        if (i == NUM_BUCKETS - 1)
+            return bucketBound(i - 1);
+
+        double lower = i == 0 ? 0 : double(uint64_t(1) << (i - 1));
+        double upper = double(uint64_t(1) << i);
+        double fraction = (rank - double(cumulative)) / double(counts[i]);
+
+        return std::chrono::microseconds(uint64_t(lower + fraction * (upper - lower)));
+    }
+
+    return bucketBound(NUM_BUCKETS - 2);
+}
+
+
+uint64_t Histogram::bucketCount(std::size_t bucket) const
+{
+    return _buckets[bucket].load(std::memory_order_relaxed);
+}
+
+
+Histogram::Clock::duration Histogram::bucketBound(std::size_t bucket)
+{
+    if (bucket >= NUM_BUCKETS - 1)
+        return Clock::duration::max();
+
+    return std::chrono::microseconds(uint64_t(1) << bucket);
+}
+
+
+Metrics::Timer::Timer(Metrics& metrics, Phase phase):
+    _metrics(metrics),
+    _phase(phase),
+    _start(Histogram::Clock::now())
+{
+}
+
+
+Metrics::Timer::~Timer()
+{
+    _metrics.record(_phase, Histogram::Clock::now() - _start);
+}
+
+
+Metrics::Metrics()
+{
+    for (auto& counter: _counters)
+        counter = 0;
+}
+
+
+Metrics::~Metrics()
+{
+}
+
+
+void Metrics::record(Phase phase, Histogram::Clock::duration duration)
+{
+    _phases[phase].record(duration);
+}
+
+
+void Metrics::add(Counter counter, uint64_t value)
+{
+    _counters[counter].fetch_add(value, std::memory_order_relaxed);
+}
+
+
+const Histogram& Metrics::histogram(Phase phase) const
+{
+    return _phases[phase];
+}
+
+
+uint64_t Metrics::counter(Counter counter) const
+{
+    return _counters[counter].load(std::memory_order_relaxed);
+}
+
+
+ofJson Metrics::toJSON() const
+{
+    ofJson counters = ofJson::object();
+
+    for (int i = 0; i < NUM_COUNTERS; ++i)
+        counters[toString(Counter(i))] = counter(Counter(i));
+
+    ofJson phases = ofJson::object();
+
+    for (int i = 0; i < NUM_PHASES; ++i)
+    {
+        const Histogram& histogram = _phases[i];
+
+        phases[toString(Phase(i))] = {
+            { "count", histogram.count() },
+            { "sum", seconds(histogram.sum()) },
+            { "p50", seconds(histogram.quantile(0.5)) },
+            { "p90", seconds(histogram.quantile(0.9)) },
+            { "p99", seconds(histogram.quantile(0.99)) }
+        };
+    }
+
+    return {
+        { "counters", counters },
+        { "phases", phases }
+    };
+}
+
+
+std::string Metrics::toPrometheus(const std::string& prefix) const
+{
+    std::ostringstream out;
+
+    for (int i = 0; i < NUM_COUNTERS; ++i)
+    {
+        std::string name = prefix + "_" + toString(Counter(i)) + "_total";
+
+        out << "# TYPE " << name << " counter\n";
+        out << name << " " << counter(Counter(i)) << "\n";
+    }
+
+    std::string name = prefix + "_phase_duration_seconds";
+
+    out << "# HELP " << name << " Time spent in each phase of message delivery.\n";
+    out << "# TYPE " << name << " histogram\n";
+
+    for (int i = 0; i < NUM_PHASES; ++i)
+    {
+        const Histogram& histogram = _phases[i];
+        std::string phase = "phase=\"" + toString(Phase(i)) + "\"";
+        uint64_t cumulative = 0;
+
+        for (std::size_t bucket = 0; bucket < Histogram::NUM_BUCKETS; ++bucket)
+        {
+            cumulative += histogram.bucketCount(bucket);
+
+            out << name << "_bucket{" << phase << ",le=\"";
+
+            if (bucket == Histogram::NUM_BUCKETS - 1)
+                out << "+Inf";
+            else
+                out << seconds(Histogram::bucketBound(bucket));
+
+            out << "\"} " << cumulative << "\n";
+        }
+
+        out << name << "_sum{" << phase << "} " << seconds(histogram.sum()) << "\n";
+        out << name << "_count{" << phase << "} " << cumulative << "\n";
+    }
+
+    return out.str();
+}
+
+
+std::string Metrics::toString(Phase phase)
+{
+    switch (phase)
+    {
+        case DNS:
+            return "dns";
+        case CONNECT:
+            return "connect";
+        case TLS_HANDSHAKE:
+            return "tls_handshake";
+        case EHLO:
+            return "ehlo";
+        case AUTH:
+            return "auth";
+        case ENVELOPE:
+            return "envelope";
+        case DATA:
+            return "data";
+        case QUEUE_WAIT:
+            return "queue_wait";
+        case END_TO_END:
+            return "end_to_end";
+    }
+
+    return "unknown";
+}
+
+
+std::string Metrics::toString(Counter counter)
+{
+    switch (counter)
+    {
+        case MESSAGES_QUEUED:
+            return "messages_queued";
+        case MESSAGES_DELIVERED:
+            return "messages_delivered";
+        case MESSAGES_FAILED:
+            return "messages_failed";
+        case RECIPIENTS_REJECTED:
+            return "recipients_rejected";
+        case BYTES_SENT:
+            return "bytes_sent";
+        case RETRIES:
+            return "retries";
+        case CONNECTIONS:
+            return "connections";
+        case CONNECTION_ERRORS:
+            return "connection_errors";
+        case TLS_RESUMPTIONS:
+            return "tls_resumptions";
+    }
+
+    return "unknown";
+}
+
+
+} } // namespace ofx::SMTP
@@ -0,0 +1,377 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/SMTP/Outbox.h"
+#include <algorithm>
+
+
+namespace ofx {
+namespace SMTP {
+
+
+Outbox::Outbox():
+    _size(0),
+    _bytes(0),
+    _waitingProducers(0),
+    _isClosed(false)
+{
+}
+
+
+Outbox::~Outbox()
+{
+    for (auto& lane: _lanes)
+    {
+        Node* node = lane.incoming.exchange(nullptr);
+
+        while (node)
+        {
+            Node* next = node->next;
+            delete node;
+            node = next;
+        }
+    }
+}
+
+
+void Outbox::setCapacity(std::size_t messages, std::size_t bytes)
+{
+    _capacity = messages;
+    _byteCapacity = bytes;
+}
+
+
+void Outbox::setWeight(Settings::Priority priority, std::size_t weight)
+{
+    _lanes[priority].weight = std::max(weight, std::size_t(1));
+}
+
+
+void Outbox::push(const Entry& entry)
+{
+    // Count the message first so the size never drops below zero when a
+    // worker takes it right away.
+    ++_size;
+    _bytes += entry.size;
+
+    link(entry);
+}
+
+
+bool Outbox::tryPush(const Entry& entry)
+{
+    if (!reserve(entry.size))
+        return false;
+
+    link(entry);
+    return true;
+}
+
+
+bool Outbox::waitPush(const Entry& entry)
+{
+    if (!fits(entry))
+        return false;
+
+    if (tryPush(entry))
+        return true;
+
+    bool isReserved = false;
+
+    {
+        std::unique_lock<std::mutex> lock(_spaceMutex);
+
+        // Workers only take the mutex to notify when a producer waits.
+        ++_waitingProducers;
+
+        _spaceAvailable.wait(lock, [&]() {
+            isReserved = !_isClosed && reserve(entry.size);
+            return isReserved || _isClosed;
+        });
+
+        --_waitingProducers;
+    }
+
+    if (isReserved)
+        link(entry);
+
+    return isReserved;
+}
+
+
+void Outbox::close()
+{
+    {
+        std::unique_lock<std::mutex> lock(_spaceMutex);
+        _isClosed = true;
+    }
+
+    _spaceAvailable.notify_all();
+}
+
+
+bool Outbox::fits(const Entry& entry) const
+{
+    return _byteCapacity == 0 || entry.size <= _byteCapacity;
+}
+
+
+void Outbox::requeue(const Entry& entry)
+{
+    std::unique_lock<std::mutex> lock(_readyMutex);
+    Lane& lane = this->lane(entry);
+    lane.ready.push_front(entry);
+    lane.ready.front().enqueued = std::chrono::steady_clock::now();
+    ++lane.size;
+    ++_size;
+    _bytes += entry.size;
+}
+
+
+bool Outbox::pop(Entry& entry)
+{
+    {
+        std::unique_lock<std::mutex> lock(_readyMutex);
+
+        bool isEmpty = true;
+
+        for (auto& lane: _lanes)
+        {
+            takeIncoming(lane);
+            isEmpty = isEmpty && lane.ready.empty();
+        }
+
+        if (isEmpty)
+            return false;
+
+        // Deficit round robin. A lane keeps the turn until it has taken its
+        // weight in messages or is empty, then the next non-empty lane gets
+        // a new turn.
+        while (_lanes[_currentLane].ready.empty() || _lanes[_currentLane].deficit == 0)
+        {
+            _lanes[_currentLane].deficit = 0;
+            _currentLane = (_currentLane + 1) % _lanes.size();
+
+            if (!_lanes[_currentLane].ready.empty())
+                _lanes[_currentLane].deficit = _lanes[_currentLane].weight;
+        }
+
+        Lane& lane = _lanes[_currentLane];
+
+        entry = std::move(lane.ready.front());
+        lane.ready.pop_front();
+        --lane.deficit;
+        --lane.size;
+
+        if (entry.enqueued != std::chrono::steady_clock::time_point())
+        {
+            auto wait = std::chrono::steady_clock::now() - entry.enqueued;
+
+            // An exponential moving average over roughly the last 16 messages.
+            lane.averageWait = lane.taken == 0 ? wait : lane.averageWait + (wait - lane.averageWait) / 16;
+            lane.maxWait = std::max(lane.maxWait, wait);
+        }
+
+        ++lane.taken;
+    }
+
+    release(entry.size);
+    return true;
+}
+
+
+bool Outbox::evict(Entry& entry, Settings::Priority priority)
+{
+    {
+        std::unique_lock<std::mutex> lock(_readyMutex);
+
+        Lane* victim = nullptr;
+
+        for (std::size_t i = _lanes.size(); i-- > std::size_t(priority);)
+        {
+            takeIncoming(_lanes[i]);
+
+            if (!_lanes[i].ready.empty())
+            {
+                victim = &_lanes[i];
+                break;
+            }
+        }
+
+        if (!victim)
+            return false;
+
+        entry = std::move(victim->ready.front());
+        victim->ready.pop_front();
+        --victim->size;
+    }
+
+    release(entry.size);
+    return true;
+}
+
+
+std::size_t Outbox::size() const
+{
+    return _size.load();
+}
+
+
+std::size_t Outbox::size(Settings::Priority priority) const
+{
+    return _lanes[priority].size.load();
+}
+
+
+std::size_t Outbox::bytes() const
+{
+    return _bytes.load();
+}
+
+
+bool Outbox::empty() const
+{
+    return _size.load() == 0;
+}
+
+
+Outbox::LaneStats Outbox::laneStats(Settings::Priority priority) const
+{
+    std::unique_lock<std::mutex> lock(_readyMutex);
+
+    const Lane& lane = _lanes[priority];
+
+    LaneStats stats;
+    stats.size = lane.size.load();
+    stats.taken = lane.taken;
+    stats.averageWait = lane.averageWait;
+    stats.maxWait = lane.maxWait;
+
+    // The oldest message is at the front of the ready queue or, if that is
+    // empty, at the bottom of the incoming stack. Linked nodes do not change
+    // and are only freed with _readyMutex held.
+    const Entry* oldest = nullptr;
+
+    if (!lane.ready.empty())
+    {
+        oldest = &lane.ready.front();
+    }
+    else
+    {
+        for (Node* node = lane.incoming.load(std::memory_order_acquire); node; node = node->next)
+            oldest = &node->entry;
+    }
+
+    if (oldest && oldest->enqueued != std::chrono::steady_clock::time_point())
+    {
+        stats.oldestWait = std::chrono::steady_clock::now() - oldest->enqueued;
+    }
+
+    return stats;
+}
+
+
+bool Outbox::reserve(std::size_t size)
+{
+    std::size_t count = _size.load();
+
+    do
+    {
+        if (_capacity > 0 && count >= _capacity)
+            return false;
+    }
+    while (!_size.compare_exchange_weak(count, count + 1));
+
+    std::size_t bytes = _bytes.load();
+
+    do
+    {
+        if (_byteCapacity > 0 && bytes + size > _byteCapacity)
+        {
+            --_size;
+            return false;
+        }
+    }
+    while (!_bytes.compare_exchange_weak(bytes, bytes + size));
+
+    return true;
+}
+
+
+void Outbox::link(const Entry& entry)
+{
+    Lane& lane = this->lane(entry);
+
+    // Count the message before it can be taken.
+    ++lane.size;
+
+    Node* node = new Node();
+    node->entry = entry;
+    node->entry.enqueued = std::chrono::steady_clock::now();
+    node->next = lane.incoming.load(std::memory_order_relaxed);
+
+    // Only push is a compare-and-swap. Consumers take the whole stack with
+    // an exchange, so nodes are never popped individually and ABA cannot
+    // occur.
+    while (!lane.incoming.compare_exchange_weak(node->next,
+                                                node,
+                                                std::memory_order_release,
+                                                std::memory_order_relaxed))
+    {
+    }
+}
+
+
+Outbox::Lane& Outbox::lane(const Entry& entry)
+{
+    std::size_t priority = std::size_t(entry.priority);
+    return _lanes[priority < _lanes.size() ? priority : std::size_t(Settings::NORMAL)];
+}
+
+
+void Outbox::release(std::size_t size)
+{
+    _bytes -= size;
+    --_size;
+
+    if (_waitingProducers > 0)
+    {
+        {
+            std::unique_lock<std::mutex> lock(_spaceMutex);
+        }
+
+        _spaceAvailable.notify_all();
+    }
+}
+
+
+void Outbox::takeIncoming(Lane& lane)
+{
+    Node* node = lane.incoming.exchange(nullptr, std::memory_order_acquire);
+
+    // The stack holds the newest message first, so reverse it.
+    Node* oldest = nullptr;
+
+    while (node)
+    {
+        Node* next = node->next;
+        node->next = oldest;
+        oldest = node;
+        node = next;
+    }
+
+    while (oldest)
+    {
+        lane.ready.push_back(std::move(oldest->entry));
+        Node* next = oldest->next;
+        delete oldest;
+        oldest = next;
+    }
+}
+
+
+} } // namespace ofx::SMTP
@@ -0,0 +1,116 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/SMTP/RateLimiter.h"
+#include <algorithm>
+#include <limits>
+
+
+namespace ofx {
+namespace SMTP {
+
+
+RateLimiter::RateLimiter()
+{
+}
+
+
+RateLimiter::~RateLimiter()
+{
+}
+
+
+void RateLimiter::setup(double rate, std::size_t burst, double minRate, double maxRate)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    _rate = std::max(rate, 0.0);
+    _burst = double(std::max(burst, std::size_t(1)));
+    _minRate = std::min(std::max(minRate, 0.0), _rate);
+    _maxRate = maxRate > 0 ? std::max(maxRate, _rate) : std::numeric_limits<double>::infinity();
+    _tokens = _burst;
+    _updated = Clock::now();
+    _decreased = Clock::time_point();
+}
+
+
+RateLimiter::Clock::time_point RateLimiter::acquire()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    Clock::time_point now = Clock::now();
+
+    if (_rate <= 0)
+        return now;
+
+    refill(now);
+
+    _tokens -= 1;
+
+    if (_tokens >= 0)
+        return now;
+
+    // Wait for the reserved token to be earned.
+    return now + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(-_tokens / _rate));
+}
+
+
+void RateLimiter::succeeded()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    if (_rate <= 0 || _rate >= _maxRate)
+        return;
+
+    refill(Clock::now());
+
+    _rate = std::min(_rate + 1 / _rate, _maxRate);
+}
+
+
+void RateLimiter::throttled()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    if (_rate <= 0)
+        return;
+
+    Clock::time_point now = Clock::now();
+
+    // Workers sending in parallel often see the same throttling episode.
+    // Only decrease once per interval between two messages, at least once a
+    // second.
+    auto interval = std::max(std::chrono::duration<double>(1 / _rate),
+                             std::chrono::duration<double>(1));
+
+    if (now - _decreased < interval)
+        return;
+
+    refill(now);
+
+    _rate = std::max(_rate / 2, _minRate);
+    _tokens = std::min(_tokens, 0.0);
+    _decreased = now;
+}
+
+
+double RateLimiter::rate() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _rate;
+}
+
+
+void RateLimiter::refill(Clock::time_point now)
+{
+    std::chrono::duration<double> elapsed = now - _updated;
+    _tokens = std::min(_tokens + elapsed.count() * _rate, _burst);
+    _updated = now;
+}
+
+
+} } // namespace ofx::SMTP
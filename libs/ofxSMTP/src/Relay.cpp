@@ -0,0 +1,124 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/SMTP/Relay.h"
+#include <algorithm>
+
+
+namespace ofx {
+namespace SMTP {
+
+
+namespace {
+
+
+/// \brief The weight of a new sample in the moving averages.
+const double SMOOTHING = 0.2;
+
+
+} // namespace
+
+
+const Relay::Clock::duration Relay::INITIAL_COOLDOWN = std::chrono::seconds(1);
+const Relay::Clock::duration Relay::MAX_COOLDOWN = std::chrono::minutes(1);
+
+
+Relay::Relay(const Settings& settings): _settings(settings)
+{
+    _rateLimiter.setup(_settings.sendRate(),
+                       _settings.sendBurst(),
+                       _settings.minSendRate(),
+                       _settings.maxSendRate());
+}
+
+
+Relay::~Relay()
+{
+}
+
+
+const Settings& Relay::settings() const
+{
+    return _settings;
+}
+
+
+RateLimiter& Relay::rateLimiter()
+{
+    return _rateLimiter;
+}
+
+
+void Relay::succeeded(Clock::duration latency)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    _latency += SMOOTHING * (std::chrono::duration<double>(latency).count() - _latency);
+    _errorRate -= SMOOTHING * _errorRate;
+    _failures = 0;
+    _availableAt = Clock::time_point();
+}
+
+
+void Relay::failed()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    _errorRate += SMOOTHING * (1 - _errorRate);
+
+    Clock::duration cooldown = INITIAL_COOLDOWN;
+
+    for (std::size_t i = 0; i < _failures && cooldown < MAX_COOLDOWN; ++i)
+        cooldown *= 2;
+
+    ++_failures;
+
+    _availableAt = Clock::now() + std::min(cooldown, MAX_COOLDOWN);
+}
+
+
+bool Relay::isAvailable(Clock::time_point now) const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return now >= _availableAt;
+}
+
+
+Relay::Clock::time_point Relay::availableAt() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _availableAt;
+}
+
+
+Relay::Clock::duration Relay::latency() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(_latency));
+}
+
+
+double Relay::errorRate() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _errorRate;
+}
+
+
+double Relay::score() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    // A relay that keeps failing still gets a trickle of traffic, so that
+    // its recovery is noticed.
+    double health = std::max(1 - _errorRate, 0.01);
+
+    return double(_settings.relayWeight()) * health * health / std::max(_latency, 0.001);
+}
+
+
+} } // namespace ofx::SMTP
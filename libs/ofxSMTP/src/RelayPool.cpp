@@ -0,0 +1,111 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/SMTP/RelayPool.h"
+#include <algorithm>
+#include <random>
+
+
+namespace ofx {
+namespace SMTP {
+
+
+RelayPool::RelayPool()
+{
+}
+
+
+RelayPool::~RelayPool()
+{
+}
+
+
+void RelayPool::setup(const std::vector<Settings>& relays)
+{
+    _relays.clear();
+
+    for (const auto& settings: relays)
+        _relays.push_back(std::make_shared<Relay>(settings));
+}
+
+
+std::shared_ptr<Relay> RelayPool::select() const
+{
+    static thread_local std::mt19937 generator(std::random_device{}());
+
+    auto now = Relay::Clock::now();
+
+    std::vector<double> scores(_relays.size(), 0.0);
+    double total = 0;
+
+    for (std::size_t i = 0; i < _relays.size(); ++i)
+    {
+        if (_relays[i]->isAvailable(now))
+        {
+            scores[i] = _relays[i]->score();
+            total += scores[i];
+        }
+    }
+
+    if (total > 0)
+    {
+        std::uniform_real_distribution<double> distribution(0, total);
+        double pick = distribution(generator);
+
+        for (std::size_t i = 0; i < _relays.size(); ++i)
+        {
+            if (scores[i] > 0 && (pick -= scores[i]) <= 0)
+                return _relays[i];
+        }
+
+        // Rounding may leave a tiny remainder.
+        for (std::size_t i = _relays.size(); i-- > 0;)
+        {
+            if (scores[i] > 0)
+                return _relays[i];
+        }
+    }
+
+    // No weighted relay is available, fall back to the backups in order.
+    for (const auto& relay: _relays)
+    {
+        if (relay->isAvailable(now))
+            return relay;
+    }
+
+    return nullptr;
+}
+
+
+bool RelayPool::hasAvailable() const
+{
+    auto now = Relay::Clock::now();
+
+    return std::any_of(_relays.begin(), _relays.end(), [&](const std::shared_ptr<Relay>& relay) {
+        return relay->isAvailable(now);
+    });
+}
+
+
+Relay::Clock::time_point RelayPool::nextAvailable() const
+{
+    auto next = Relay::Clock::time_point::max();
+
+    for (const auto& relay: _relays)
+        next = std::min(next, relay->availableAt());
+
+    return next;
+}
+
+
+const std::vector<std::shared_ptr<Relay>>& RelayPool::relays() const
+{
+    return _relays;
+}
+
+
+} } // namespace ofx::SMTP
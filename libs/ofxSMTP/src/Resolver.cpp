@@ -0,0 +1,177 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/SMTP/Resolver.h"
+#include <algorithm>
+#include "Poco/Net/DNS.h"
+#include "Poco/Net/HostEntry.h"
+#include "Poco/Net/NetException.h"
+#include "ofLog.h"
+
+
+namespace ofx {
+namespace SMTP {
+
+
+Resolver::Resolver()
+{
+}
+
+
+Resolver::~Resolver()
+{
+}
+
+
+void Resolver::setTTL(const Poco::Timespan& ttl)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _ttl = std::chrono::microseconds(ttl.totalMicroseconds());
+}
+
+
+std::vector<Poco::Net::SocketAddress> Resolver::resolve(const std::string& host,
+                                                        uint16_t port)
+{
+    std::vector<Poco::Net::IPAddress> addresses;
+    Poco::Net::IPAddress literal;
+
+    if (Poco::Net::IPAddress::tryParse(host, literal))
+    {
+        addresses.push_back(literal);
+    }
+    else
+    {
+        Entry stale;
+
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+
+            auto iter = _entries.find(host);
+
+            if (iter != _entries.end())
+            {
+                if (Clock::now() < iter->second.expires)
+                    addresses = iter->second.addresses;
+                else
+                    stale = iter->second;
+            }
+        }
+
+        if (addresses.empty())
+        {
+            // Resolve without holding the lock, lookups may be slow.
+            try
+            {
+                addresses = interleave(Poco::Net::DNS::hostByName(host).addresses());
+            }
+            catch (const Poco::Net::NetException& exc)
+            {
+                if (stale.addresses.empty())
+                    throw;
+
+                ofLogWarning("Resolver::resolve") << exc.displayText() << ", using expired addresses of " << host << ".";
+            }
+
+            std::unique_lock<std::mutex> lock(_mutex);
+
+            if (addresses.empty())
+            {
+                addresses = stale.addresses;
+            }
+            else
+            {
+                // Keep trying the address that worked last, if it is still
+                // listed.
+                if (!stale.addresses.empty())
+                {
+                    auto preferred = std::find(addresses.begin(), addresses.end(), stale.addresses.front());
+
+                    if (preferred != addresses.end())
+                        std::rotate(addresses.begin(), preferred, preferred + 1);
+                }
+
+                ofLogVerbose("Resolver::resolve") << host << " has " << addresses.size() << " address(es).";
+            }
+
+            Entry& entry = _entries[host];
+            entry.addresses = addresses;
+            entry.expires = Clock::now() + _ttl;
+        }
+    }
+
+    std::vector<Poco::Net::SocketAddress> result;
+
+    for (const auto& address: addresses)
+        result.push_back(Poco::Net::SocketAddress(address, port));
+
+    return result;
+}
+
+
+void Resolver::succeeded(const std::string& host, const Poco::Net::IPAddress& address)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    auto iter = _entries.find(host);
+
+    if (iter == _entries.end())
+        return;
+
+    auto& addresses = iter->second.addresses;
+    auto preferred = std::find(addresses.begin(), addresses.end(), address);
+
+    if (preferred != addresses.end())
+        std::rotate(addresses.begin(), preferred, preferred + 1);
+}
+
+
+void Resolver::clear()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _entries.clear();
+}
+
+
+std::size_t Resolver::size() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _entries.size();
+}
+
+
+std::vector<Poco::Net::IPAddress> Resolver::interleave(const std::vector<Poco::Net::IPAddress>& addresses)
+{
+    std::vector<Poco::Net::IPAddress> first;
+    std::vector<Poco::Net::IPAddress> second;
+
+    // Start with the family of the first address, as the system resolver
+    // sorted them by preference.
+    for (const auto& address: addresses)
+    {
+        if (first.empty() || address.family() == first.front().family())
+            first.push_back(address);
+        else
+            second.push_back(address);
+    }
+
+    std::vector<Poco::Net::IPAddress> result;
+
+    for (std::size_t i = 0; i < std::max(first.size(), second.size()); ++i)
+    {
+        if (i < first.size())
+            result.push_back(first[i]);
+
+        if (i < second.size())
+            result.push_back(second[i]);
+    }
+
+    return result;
+}
+
+
+} } // namespace ofx::SMTP
@@ -0,0 +1,158 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/SMTP/RetryScheduler.h"
+#include <algorithm>
+#include <random>
+
+
+namespace ofx {
+namespace SMTP {
+
+
+RetryScheduler::RetryScheduler(Clock::duration tick, std::size_t slots):
+    _tick(std::max(tick, Clock::duration(1))),
+    _start(Clock::now()),
+    _slots(std::max(slots, std::size_t(1)))
+{
+}
+
+
+RetryScheduler::~RetryScheduler()
+{
+}
+
+
+void RetryScheduler::schedule(const Outbox::Entry& entry, Clock::time_point due)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    // A message is never due before the ticks already taken.
+    uint64_t tick = std::max(tickOf(due), _currentTick);
+
+    _slots[tick % _slots.size()].push_back({ tick, entry });
+    ++_size;
+}
+
+
+bool RetryScheduler::takeDue(Clock::time_point now, std::vector<Outbox::Entry>& entries)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    if (_size == 0)
+    {
+        // Nothing can be due before the next schedule() call.
+        _currentTick = std::max(_currentTick, tickOf(now));
+        return false;
+    }
+
+    uint64_t nowTick = tickOf(now);
+    std::size_t count = entries.size();
+
+    // Visit each slot at most once, even after a long pause.
+    uint64_t last = std::min(nowTick, _currentTick + _slots.size() - 1);
+
+    for (uint64_t tick = _currentTick; tick <= last; ++tick)
+    {
+        auto& slot = _slots[tick % _slots.size()];
+
+        // Messages due in a later revolution stay in the slot.
+        auto iter = std::stable_partition(slot.begin(), slot.end(), [&](const Timer& timer) {
+            return timer.tick > nowTick;
+        });
+
+        for (auto due = iter; due != slot.end(); ++due)
+            entries.push_back(due->entry);
+
+        _size -= std::size_t(slot.end() - iter);
+        slot.erase(iter, slot.end());
+    }
+
+    _currentTick = nowTick + 1;
+
+    return entries.size() > count;
+}
+
+
+RetryScheduler::Clock::time_point RetryScheduler::nextDue() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    if (_size == 0)
+        return Clock::time_point::max();
+
+    uint64_t next = UINT64_MAX;
+
+    // The first slot holding a message due in this revolution wins.
+    for (std::size_t i = 0; i < _slots.size(); ++i)
+    {
+        uint64_t tick = _currentTick + i;
+
+        for (const auto& timer: _slots[tick % _slots.size()])
+        {
+            next = std::min(next, timer.tick);
+        }
+
+        if (next <= tick)
+            break;
+    }
+
+    return _start + _tick * next;
+}
+
+
+std::size_t RetryScheduler::size() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _size;
+}
+
+
+void RetryScheduler::takeAll(std::vector<Outbox::Entry>& entries)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    for (auto& slot: _slots)
+    {
+        for (auto& timer: slot)
+            entries.push_back(timer.entry);
+
+        slot.clear();
+    }
+
+    _size = 0;
+}
+
+
+RetryScheduler::Clock::duration RetryScheduler::backoff(std::size_t attempts,
+                                                        Clock::duration initialDelay,
+                                                        Clock::duration maxDelay)
+{
+    static thread_local std::mt19937_64 generator(std::random_device{}());
+
+    Clock::duration delay = std::max(initialDelay, Clock::duration(1));
+
+    for (std::size_t i = 1; i < attempts && delay < maxDelay; ++i)
+        delay *= 2;
+
+    delay = std::min(delay, std::max(maxDelay, initialDelay));
+
+    std::uniform_int_distribution<Clock::rep> jitter(delay.count() / 2, delay.count());
+    return Clock::duration(jitter(generator));
+}
+
+
+uint64_t RetryScheduler::tickOf(Clock::time_point time) const
+{
+    if (time <= _start)
+        return 0;
+
+    return uint64_t((time - _start) / _tick);
+}
+
+
+} } // namespace ofx::SMTP
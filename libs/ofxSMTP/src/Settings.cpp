@@ -6,6 +6,8 @@
 
 
 #include "ofx/SMTP/Settings.h"
+#include "ofx/SMTP/Journal.h"
+#include <algorithm>
 #include "Poco/UTF8String.h"
 #include "Poco/Version.h"
 #include "Poco/SAX/InputSource.h"
@@ -22,7 +24,16 @@ namespace SMTP {
 
 
 const Poco::Timespan Settings::DEFAULT_TIMEOUT = Poco::Timespan(30 * Poco::Timespan::SECONDS);
-const Poco::Timespan Settings::DEFAULT_MESSAGE_SEND_DELAY= Poco::Timespan(100 * Poco::Timespan::MILLISECONDS);
+const Poco::Timespan Settings::DEFAULT_MESSAGE_SEND_DELAY= Poco::Timespan(0);
+const Poco::Timespan Settings::DEFAULT_IDLE_TIMEOUT = Poco::Timespan(0);
+const Poco::Timespan Settings::DEFAULT_KEEP_ALIVE_INTERVAL = Poco::Timespan(15 * Poco::Timespan::SECONDS);
+const Poco::Timespan Settings::DEFAULT_CONNECTION_ATTEMPT_DELAY = Poco::Timespan(250 * Poco::Timespan::MILLISECONDS);
+const Poco::Timespan Settings::DEFAULT_DNS_CACHE_TTL = Poco::Timespan(60 * Poco::Timespan::SECONDS);
+const Poco::Timespan Settings::DEFAULT_RETRY_DELAY = Poco::Timespan(1 * Poco::Timespan::SECONDS);
+const Poco::Timespan Settings::DEFAULT_MAX_RETRY_DELAY = Poco::Timespan(5 * Poco::Timespan::MINUTES);
+const Poco::Timespan Settings::DEFAULT_MAX_MESSAGE_AGE = Poco::Timespan(1 * Poco::Timespan::DAYS);
+const double Settings::DEFAULT_MIN_SEND_RATE = 0.1;
+const Poco::Timespan Settings::DEFAULT_JOURNAL_SYNC_INTERVAL = Poco::Timespan(20 * Poco::Timespan::MILLISECONDS);
 
 
 Settings::Settings(const std::string& host,
@@ -36,8 +47,13 @@ Settings::Settings(const std::string& host,
     _credentials(credentials),
     _encryptionType(encryptionType),
     _timeout(timeout),
-    _messageSendDelay(messageSendDelay)
+    _messageSendDelay(messageSendDelay),
+    _journalSegmentSize(Journal::DEFAULT_SEGMENT_SIZE)
 {
+    if (_messageSendDelay.totalMicroseconds() > 0)
+    {
+        _sendRate = double(Poco::Timespan::SECONDS) / double(_messageSendDelay.totalMicroseconds());
+    }
 }
 
 
@@ -118,6 +134,330 @@ Poco::Timespan Settings::getMessageSendDelay() const
 }
 
 
+void Settings::setPriorityWeight(Priority priority, std::size_t weight)
+{
+    _priorityWeights[priority] = std::max(weight, std::size_t(1));
+}
+
+
+std::size_t Settings::priorityWeight(Priority priority) const
+{
+    return _priorityWeights[priority];
+}
+
+
+void Settings::setRetryDelay(const Poco::Timespan& delay)
+{
+    _retryDelay = delay;
+}
+
+
+Poco::Timespan Settings::retryDelay() const
+{
+    return _retryDelay;
+}
+
+
+void Settings::setMaxRetryDelay(const Poco::Timespan& delay)
+{
+    _maxRetryDelay = delay;
+}
+
+
+Poco::Timespan Settings::maxRetryDelay() const
+{
+    return _maxRetryDelay;
+}
+
+
+void Settings::setMaxAttempts(std::size_t attempts)
+{
+    _maxAttempts = attempts;
+}
+
+
+std::size_t Settings::maxAttempts() const
+{
+    return _maxAttempts;
+}
+
+
+void Settings::setMaxMessageAge(const Poco::Timespan& age)
+{
+    _maxMessageAge = age;
+}
+
+
+Poco::Timespan Settings::maxMessageAge() const
+{
+    return _maxMessageAge;
+}
+
+
+void Settings::setRelayWeight(std::size_t weight)
+{
+    _relayWeight = weight;
+}
+
+
+std::size_t Settings::relayWeight() const
+{
+    return _relayWeight;
+}
+
+
+void Settings::setSendRate(double rate)
+{
+    _sendRate = std::max(rate, 0.0);
+}
+
+
+double Settings::sendRate() const
+{
+    return _sendRate;
+}
+
+
+void Settings::setSendBurst(std::size_t burst)
+{
+    _sendBurst = std::max(burst, std::size_t(1));
+}
+
+
+std::size_t Settings::sendBurst() const
+{
+    return _sendBurst;
+}
+
+
+void Settings::setMinSendRate(double rate)
+{
+    _minSendRate = std::max(rate, 0.0);
+}
+
+
+double Settings::minSendRate() const
+{
+    return _minSendRate;
+}
+
+
+void Settings::setMaxSendRate(double rate)
+{
+    _maxSendRate = std::max(rate, 0.0);
+}
+
+
+double Settings::maxSendRate() const
+{
+    return _maxSendRate;
+}
+
+
+void Settings::setMaxConnections(std::size_t maxConnections)
+{
+    _maxConnections = std::max(std::size_t(1), maxConnections);
+}
+
+
+std::size_t Settings::maxConnections() const
+{
+    return _maxConnections;
+}
+
+
+void Settings::setIdleTimeout(const Poco::Timespan& idleTimeout)
+{
+    _idleTimeout = idleTimeout;
+}
+
+
+Poco::Timespan Settings::idleTimeout() const
+{
+    return _idleTimeout;
+}
+
+
+void Settings::setKeepAliveInterval(const Poco::Timespan& keepAliveInterval)
+{
+    _keepAliveInterval = keepAliveInterval;
+}
+
+
+Poco::Timespan Settings::keepAliveInterval() const
+{
+    return _keepAliveInterval;
+}
+
+
+void Settings::setMaxRecipientsPerMessage(std::size_t maxRecipients)
+{
+    _maxRecipientsPerMessage = maxRecipients;
+}
+
+
+std::size_t Settings::maxRecipientsPerMessage() const
+{
+    return _maxRecipientsPerMessage;
+}
+
+
+void Settings::setConnectionAttemptDelay(const Poco::Timespan& connectionAttemptDelay)
+{
+    _connectionAttemptDelay = connectionAttemptDelay;
+}
+
+
+Poco::Timespan Settings::connectionAttemptDelay() const
+{
+    return _connectionAttemptDelay;
+}
+
+
+void Settings::setDNSCacheTTL(const Poco::Timespan& dnsCacheTTL)
+{
+    _dnsCacheTTL = dnsCacheTTL;
+}
+
+
+Poco::Timespan Settings::dnsCacheTTL() const
+{
+    return _dnsCacheTTL;
+}
+
+
+void Settings::setPreRenderMessages(bool preRenderMessages)
+{
+    _preRenderMessages = preRenderMessages;
+}
+
+
+bool Settings::preRenderMessages() const
+{
+    return _preRenderMessages;
+}
+
+
+void Settings::setTLSSessionCacheFile(const std::string& filename)
+{
+    _tlsSessionCacheFile = filename;
+}
+
+
+std::string Settings::tlsSessionCacheFile() const
+{
+    return _tlsSessionCacheFile;
+}
+
+
+void Settings::setOutboxCapacity(std::size_t capacity)
+{
+    _outboxCapacity = capacity;
+}
+
+
+std::size_t Settings::outboxCapacity() const
+{
+    return _outboxCapacity;
+}
+
+
+void Settings::setOutboxByteCapacity(std::size_t capacity)
+{
+    _outboxByteCapacity = capacity;
+}
+
+
+std::size_t Settings::outboxByteCapacity() const
+{
+    return _outboxByteCapacity;
+}
+
+
+void Settings::setOverflowPolicy(OverflowPolicy policy)
+{
+    _overflowPolicy = policy;
+}
+
+
+Settings::OverflowPolicy Settings::overflowPolicy() const
+{
+    return _overflowPolicy;
+}
+
+
+void Settings::setSpoolDirectory(const std::string& directory)
+{
+    _spoolDirectory = directory;
+}
+
+
+std::string Settings::spoolDirectory() const
+{
+    return _spoolDirectory;
+}
+
+
+void Settings::setJournalDirectory(const std::string& directory)
+{
+    _journalDirectory = directory;
+}
+
+
+std::string Settings::journalDirectory() const
+{
+    return _journalDirectory;
+}
+
+
+void Settings::setJournalSyncInterval(const Poco::Timespan& interval)
+{
+    _journalSyncInterval = interval;
+}
+
+
+Poco::Timespan Settings::journalSyncInterval() const
+{
+    return _journalSyncInterval;
+}
+
+
+void Settings::setJournalSegmentSize(std::size_t size)
+{
+    _journalSegmentSize = size;
+}
+
+
+std::size_t Settings::journalSegmentSize() const
+{
+    return _journalSegmentSize;
+}
+
+
+void Settings::setEventDispatch(EventDispatch dispatch)
+{
+    _eventDispatch = dispatch;
+}
+
+
+Settings::EventDispatch Settings::eventDispatch() const
+{
+    return _eventDispatch;
+}
+
+
+void Settings::setMaxEventBatchSize(std::size_t size)
+{
+    _maxEventBatchSize = std::max(size, std::size_t(1));
+}
+
+
+std::size_t Settings::maxEventBatchSize() const
+{
+    return _maxEventBatchSize;
+}
+
+
 Settings Settings::fromJSON(const ofJson& json)
 {
     Settings s;
@@ -157,20 +497,138 @@ Settings Settings::loadFromJSON(const std::string& filename)
     
 Settings Settings::load(const Poco::Util::AbstractConfiguration& config)
 {
-    
-    
-    
-    return Settings(config.getString("host"),
-                    config.getUInt("port", DEFAULT_SMTP_PORT),
-                    Credentials(config.getString("authentication.username", ""),
-                                config.getString("authentication.password", ""),
-                                Credentials::from_string(config.getString("authentication.type", "AUTH_NONE"))),
-                    from_string(config.getString("encryption", "NONE")),
-                    Poco::Timespan(config.getInt("timeout", 30000) * Poco::Timespan::MILLISECONDS),
-                    Poco::Timespan(config.getInt("message-send-delay", 100) * Poco::Timespan::MILLISECONDS));
+    Settings settings;
+
+    loadRelay(settings, config, "");
+
+    settings.setMaxConnections(config.getUInt("max-connections", DEFAULT_MAX_CONNECTIONS));
+    settings.setRetryDelay(Poco::Timespan(config.getInt("retry-delay", 1000) * Poco::Timespan::MILLISECONDS));
+    settings.setMaxRetryDelay(Poco::Timespan(config.getInt("max-retry-delay", 300000) * Poco::Timespan::MILLISECONDS));
+    settings.setMaxAttempts(config.getUInt("max-attempts", DEFAULT_MAX_ATTEMPTS));
+    settings.setMaxMessageAge(Poco::Timespan(config.getInt("max-message-age", 86400000) * Poco::Timespan::MILLISECONDS));
+    settings.setIdleTimeout(Poco::Timespan(config.getInt("idle-timeout", 0) * Poco::Timespan::MILLISECONDS));
+    settings.setKeepAliveInterval(Poco::Timespan(config.getInt("keep-alive-interval", 15000) * Poco::Timespan::MILLISECONDS));
+    settings.setConnectionAttemptDelay(Poco::Timespan(config.getInt("connection-attempt-delay", 250) * Poco::Timespan::MILLISECONDS));
+    settings.setDNSCacheTTL(Poco::Timespan(config.getInt("dns-cache-ttl", 60000) * Poco::Timespan::MILLISECONDS));
+    settings.setMaxRecipientsPerMessage(config.getUInt("max-recipients-per-message", DEFAULT_MAX_RECIPIENTS_PER_MESSAGE));
+    settings.setTLSSessionCacheFile(config.getString("tls-session-cache", ""));
+    settings.setPreRenderMessages(config.getBool("pre-render-messages", false));
+    settings.setOutboxCapacity(config.getUInt64("outbox-capacity", 0));
+    settings.setOutboxByteCapacity(config.getUInt64("outbox-byte-capacity", 0));
+    settings.setOverflowPolicy(overflowPolicyFromString(config.getString("overflow-policy", "BLOCK")));
+    settings.setSpoolDirectory(config.getString("spool-directory", ""));
+    settings.setJournalDirectory(config.getString("journal-directory", ""));
+    settings.setJournalSyncInterval(Poco::Timespan(config.getInt("journal-sync-interval", 20) * Poco::Timespan::MILLISECONDS));
+    settings.setJournalSegmentSize(config.getUInt64("journal-segment-size", Journal::DEFAULT_SEGMENT_SIZE));
+    settings.setEventDispatch(eventDispatchFromString(config.getString("event-dispatch", "INLINE")));
+    settings.setMaxEventBatchSize(config.getUInt64("max-event-batch-size", DEFAULT_MAX_EVENT_BATCH_SIZE));
+
+    for (int i = 0; i < NUM_PRIORITIES; ++i)
+    {
+        Priority priority = Priority(i);
+        settings.setPriorityWeight(priority, config.getUInt("priority-weights." + priorityToString(priority), settings.priorityWeight(priority)));
+    }
+
+    return settings;
 }
-    
-    
+
+
+std::vector<Settings> Settings::loadAllFromXML(const std::string& filename)
+{
+    try
+    {
+        Poco::AutoPtr<Poco::Util::XMLConfiguration> pConf(new Poco::Util::XMLConfiguration(ofToDataPath(filename, true)));
+        return loadAll(*pConf);
+    }
+    catch (const Poco::Exception& exc)
+    {
+        ofLogError("Settings::loadAllFromXML") << exc.displayText();
+        return { Settings() };
+    }
+}
+
+
+std::vector<Settings> Settings::loadAllFromJSON(const std::string& filename)
+{
+    try
+    {
+        Poco::AutoPtr<Poco::Util::JSONConfiguration> pConf(new Poco::Util::JSONConfiguration(ofToDataPath(filename, true)));
+        return loadAll(*pConf);
+    }
+    catch (const Poco::Exception& exc)
+    {
+        ofLogError("Settings::loadAllFromJSON") << exc.displayText();
+        return { Settings() };
+    }
+}
+
+
+std::vector<Settings> Settings::loadAll(const Poco::Util::AbstractConfiguration& config)
+{
+    std::vector<Settings> relays = { load(config) };
+
+    for (std::size_t i = 0; ; ++i)
+    {
+        // JSON arrays and repeated XML elements are indexed differently.
+        std::string json = "relays[" + ofToString(i) + "].";
+        std::string xml = "relays.relay[" + ofToString(i) + "].";
+
+        std::string prefix;
+
+        if (config.has(json + "host"))
+            prefix = json;
+        else if (config.has(xml + "host"))
+            prefix = xml;
+        else
+            break;
+
+        Settings relay = relays.front();
+        loadRelay(relay, config, prefix);
+        relays.push_back(relay);
+    }
+
+    return relays;
+}
+
+
+void Settings::loadRelay(Settings& settings,
+                         const Poco::Util::AbstractConfiguration& config,
+                         const std::string& prefix)
+{
+    settings._host = config.getString(prefix + "host");
+    settings._port = uint16_t(config.getUInt(prefix + "port", prefix.empty() ? unsigned(DEFAULT_SMTP_PORT) : settings._port));
+
+    if (prefix.empty() || config.has(prefix + "authentication"))
+    {
+        settings._credentials = Credentials(config.getString(prefix + "authentication.username", ""),
+                                            config.getString(prefix + "authentication.password", ""),
+                                            Credentials::from_string(config.getString(prefix + "authentication.type", "AUTH_NONE")));
+    }
+
+    if (prefix.empty() || config.has(prefix + "encryption"))
+    {
+        settings._encryptionType = from_string(config.getString(prefix + "encryption", "NONE"));
+    }
+
+    settings._timeout = Poco::Timespan(config.getInt(prefix + "timeout", int(settings._timeout.totalMilliseconds())) * Poco::Timespan::MILLISECONDS);
+
+    // The legacy delay between messages sets the initial send rate.
+    if (config.has(prefix + "message-send-delay"))
+    {
+        settings._messageSendDelay = Poco::Timespan(config.getInt(prefix + "message-send-delay") * Poco::Timespan::MILLISECONDS);
+
+        auto delay = settings._messageSendDelay.totalMicroseconds();
+        settings.setSendRate(delay > 0 ? double(Poco::Timespan::SECONDS) / double(delay) : 0);
+    }
+
+    settings.setSendRate(config.getDouble(prefix + "send-rate", settings.sendRate()));
+    settings.setSendBurst(config.getUInt(prefix + "send-burst", unsigned(settings.sendBurst())));
+    settings.setMinSendRate(config.getDouble(prefix + "min-send-rate", settings.minSendRate()));
+    settings.setMaxSendRate(config.getDouble(prefix + "max-send-rate", settings.maxSendRate()));
+    settings.setRelayWeight(config.getUInt(prefix + "weight", unsigned(settings.relayWeight())));
+}
+
+
 Settings::EncryptionType Settings::from_string(const std::string& method)
 {
     if (method == "NONE")
@@ -208,6 +666,68 @@ std::string Settings::to_string(const Settings::EncryptionType& method)
 }
 
 
+std::string Settings::priorityToString(Priority priority)
+{
+    switch (priority)
+    {
+        case URGENT:
+            return "urgent";
+        case HIGH:
+            return "high";
+        case NORMAL:
+            return "normal";
+        case BULK:
+            return "bulk";
+    }
+
+    return "normal";
+}
+
+
+Settings::OverflowPolicy Settings::overflowPolicyFromString(const std::string& policy)
+{
+    if (policy == "BLOCK")
+    {
+        return OverflowPolicy::BLOCK;
+    }
+    else if (policy == "FAIL")
+    {
+        return OverflowPolicy::FAIL;
+    }
+    else if (policy == "DROP_OLDEST")
+    {
+        return OverflowPolicy::DROP_OLDEST;
+    }
+    else if (policy == "SPILL")
+    {
+        return OverflowPolicy::SPILL;
+    }
+
+    ofLogError("Settings::overflowPolicyFromString") << "Unknown policy: " << policy;
+    return OverflowPolicy::BLOCK;
+}
+
+
+Settings::EventDispatch Settings::eventDispatchFromString(const std::string& dispatch)
+{
+    if (dispatch == "INLINE")
+    {
+        return EventDispatch::INLINE;
+    }
+    else if (dispatch == "DISPATCHER_THREAD")
+    {
+        return EventDispatch::DISPATCHER_THREAD;
+    }
+    else if (dispatch == "UPDATE_LOOP")
+    {
+        return EventDispatch::UPDATE_LOOP;
+    }
+
+    ofLogError("Settings::eventDispatchFromString") << "Unknown dispatch: " << dispatch;
+    return EventDispatch::INLINE;
+}
+
+
 
 SSLTLSSettings::SSLTLSSettings(const std::string& host,
                                uint16_t port,
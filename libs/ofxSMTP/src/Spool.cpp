@@ -0,0 +1,440 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/SMTP/Spool.h"
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include "Poco/Exception.h"
+#include "Poco/File.h"
+#include "Poco/Path.h"
+#include "ofLog.h"
+#include "ofUtils.h"
+
+
+namespace ofx {
+namespace SMTP {
+
+
+namespace {
+
+
+const std::string EXTENSION = ".msg";
+
+
+/// \brief The extension of a file that is still being written.
+const std::string TEMPORARY_EXTENSION = ".tmp";
+
+
+const std::string HEADER = "ofxSMTP-spool 2";
+
+
+/// \brief The header of files written without the priority.
+const std::string HEADER_V1 = "ofxSMTP-spool 1";
+
+
+/// \returns the file name of a sequence number.
+std::string fileName(uint64_t sequence)
+{
+    std::ostringstream filename;
+    filename << std::setw(20) << std::setfill('0') << sequence << EXTENSION;
+    return filename.str();
+}
+
+
+/// \param filename A file name.
+/// \param extension An extension.
+/// \returns true if the file name ends with the extension.
+bool hasExtension(const std::string& filename, const std::string& extension)
+{
+    return filename.size() > extension.size()
+        && filename.compare(filename.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+
+/// \brief Remove a file, logging any failure.
+/// \param path The path of the file.
+/// \param module The module to log with.
+void removeFile(const std::string& path, const std::string& module)
+{
+    try
+    {
+        Poco::File(path).remove();
+    }
+    catch (const Poco::Exception& exc)
+    {
+        ofLogError(module) << exc.displayText();
+    }
+}
+
+
+/// \brief Parse the sequence number of a spool file name.
+/// \param filename The file name.
+/// \param sequence Set to the sequence number.
+/// \returns false if the name is not that of a spool file.
+bool parseFileName(const std::string& filename, uint64_t& sequence)
+{
+    if (!hasExtension(filename, EXTENSION))
+        return false;
+
+    std::string digits = filename.substr(0, filename.size() - EXTENSION.size());
+
+    if (digits.find_first_not_of("0123456789") != std::string::npos)
+        return false;
+
+    sequence = std::strtoull(digits.c_str(), nullptr, 10);
+
+    // Also rejects numbers out of range.
+    return fileName(sequence) == filename;
+}
+
+
+/// \brief Read the spool header of a file.
+/// \param file The file. It is left at the message.
+/// \param journalId Set to the Journal id, or 0.
+/// \param priority Set to the priority of the message.
+/// \returns false if the file has no valid header.
+bool readHeader(std::istream& file,
+                uint64_t& journalId,
+                Settings::Priority& priority)
+{
+    std::string line;
+
+    journalId = 0;
+    priority = Settings::NORMAL;
+
+    if (!std::getline(file, line) || (line != HEADER + "\r" && line != HEADER_V1 + "\r"))
+        return false;
+
+    bool hasPriority = line == HEADER + "\r";
+
+    if (!std::getline(file, line) || line.empty() || line.back() != '\r')
+        return false;
+
+    journalId = std::strtoull(line.c_str(), nullptr, 10);
+
+    if (hasPriority)
+    {
+        if (!std::getline(file, line) || line.empty() || line.back() != '\r')
+            return false;
+
+        unsigned long value = std::strtoul(line.c_str(), nullptr, 10);
+
+        if (value >= Settings::NUM_PRIORITIES)
+            return false;
+
+        priority = Settings::Priority(value);
+    }
+
+    return true;
+}
+
+
+} // namespace
+
+
+Spool::Spool(): _size(0)
+{
+}
+
+
+Spool::~Spool()
+{
+}
+
+
+bool Spool::open(const std::string& directory)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    _directory = ofToDataPath(directory, true);
+    _journalIds.clear();
+
+    for (auto& sequences: _sequences)
+        sequences.clear();
+
+    _nextSequence = 0;
+
+    try
+    {
+        Poco::File(_directory).createDirectories();
+
+        std::vector<std::string> files;
+        Poco::File(_directory).list(files);
+
+        for (const auto& file: files)
+        {
+            uint64_t sequence = 0;
+
+            if (!parseFileName(file, sequence))
+            {
+                if (hasExtension(file, EXTENSION))
+                {
+                    ofLogWarning("Spool::open") << "Ignoring " << file << ", not a spool file name.";
+                }
+                else if (hasExtension(file, EXTENSION + TEMPORARY_EXTENSION))
+                {
+                    // Left behind by a put() that did not finish.
+                    ofLogWarning("Spool::open") << "Removing incomplete " << file;
+                    removeFile(Poco::Path(Poco::Path(_directory), file).toString(), "Spool::open");
+                }
+
+                continue;
+            }
+
+            _nextSequence = std::max(_nextSequence, sequence + 1);
+
+            std::ifstream stream(path(sequence), std::ios::in | std::ios::binary);
+            uint64_t journalId = 0;
+            Settings::Priority priority = Settings::NORMAL;
+
+            if (!readHeader(stream, journalId, priority))
+            {
+                ofLogError("Spool::open") << "Ignoring corrupt " << path(sequence);
+                continue;
+            }
+
+            _sequences[priority].push_back(sequence);
+
+            if (journalId != 0)
+                _journalIds.insert(journalId);
+        }
+    }
+    catch (const std::exception& exc)
+    {
+        ofLogError("Spool::open") << "Unable to open " << _directory << ": " << exc.what();
+        _directory.clear();
+        _journalIds.clear();
+        _size = 0;
+
+        for (auto& sequences: _sequences)
+            sequences.clear();
+
+        return false;
+    }
+
+    std::size_t size = 0;
+
+    for (auto& sequences: _sequences)
+    {
+        std::sort(sequences.begin(), sequences.end());
+        size += sequences.size();
+    }
+
+    _size = size;
+
+    ofLogVerbose("Spool::open") << "Found " << size << " spooled message(s).";
+    return true;
+}
+
+
+bool Spool::isOpen() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return !_directory.empty();
+}
+
+
+bool Spool::put(const WireMessage& message,
+                Settings::Priority priority,
+                uint64_t journalId,
+                const DeliveryTicket& ticket)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    if (_directory.empty())
+        return false;
+
+    std::string directory = _directory;
+    uint64_t sequence = _nextSequence++;
+    std::string filename = path(sequence);
+    std::string temporary = filename + TEMPORARY_EXTENSION;
+
+    // Write under a temporary name without holding the lock, so that a
+    // failed write never leaves a partial message for take() or open().
+    lock.unlock();
+
+    std::ofstream file(temporary, std::ios::out | std::ios::binary | std::ios::trunc);
+    file << HEADER << "\r\n" << journalId << "\r\n" << int(priority) << "\r\n";
+    message.serialize(file);
+    file.close();
+
+    if (!file)
+    {
+        ofLogError("Spool::put") << "Unable to write " << temporary;
+        removeFile(temporary, "Spool::put");
+        return false;
+    }
+
+    lock.lock();
+
+    try
+    {
+        if (_directory != directory)
+            throw Poco::IllegalStateException("The spool was reopened");
+
+        Poco::File(temporary).renameTo(filename);
+    }
+    catch (const Poco::Exception& exc)
+    {
+        lock.unlock();
+        ofLogError("Spool::put") << "Unable to move " << temporary << ": " << exc.displayText();
+        removeFile(temporary, "Spool::put");
+        return false;
+    }
+
+    // Concurrent puts may finish out of order.
+    auto& sequences = _sequences[priority];
+    sequences.insert(std::upper_bound(sequences.begin(), sequences.end(), sequence), sequence);
+
+    if (journalId != 0)
+        _journalIds.insert(journalId);
+
+    if (ticket.isValid())
+    {
+        Tracked& tracked = _tickets[sequence];
+        tracked.ticket = ticket;
+        tracked.recipients = message.recipients();
+    }
+
+    ++_size;
+    return true;
+}
+
+
+bool Spool::take(Outbox::Entry& entry, std::vector<Tracked>& unreadable)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    while (_size > 0)
+    {
+        // The most urgent priority with a message.
+        auto sequences = std::find_if(_sequences.begin(), _sequences.end(),
+                                      [](const std::deque<uint64_t>& lane) {
+            return !lane.empty();
+        });
+
+        if (sequences == _sequences.end())
+            break;
+
+        uint64_t sequence = sequences->front();
+        sequences->pop_front();
+        --_size;
+
+        std::string filename = path(sequence);
+
+        auto ticket = _tickets.find(sequence);
+
+        Tracked tracked;
+
+        if (ticket != _tickets.end())
+        {
+            tracked = std::move(ticket->second);
+            _tickets.erase(ticket);
+        }
+
+        entry.ticket = tracked.ticket;
+
+        try
+        {
+            std::ifstream file(filename, std::ios::in | std::ios::binary);
+
+            if (!readHeader(file, entry.journalId, entry.priority))
+                throw Poco::DataFormatException("Missing spool header");
+
+            _journalIds.erase(entry.journalId);
+            entry.wire = WireMessage::deserialize(file);
+            entry.message = entry.wire->headers();
+            entry.size = entry.wire->size();
+        }
+        catch (const std::exception& exc)
+        {
+            ofLogError("Spool::take") << "Skipping unreadable " << filename << ": " << exc.what();
+            entry = Outbox::Entry();
+
+            if (tracked.ticket.isValid())
+                unreadable.push_back(std::move(tracked));
+        }
+
+        removeFile(filename, "Spool::take");
+
+        if (entry.wire)
+            return true;
+    }
+
+    return false;
+}
+
+
+std::size_t Spool::size() const
+{
+    return _size.load();
+}
+
+
+bool Spool::empty() const
+{
+    return _size.load() == 0;
+}
+
+
+bool Spool::empty(Settings::Priority priority) const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _sequences[priority].empty();
+}
+
+
+bool Spool::mostUrgent(Settings::Priority& priority) const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    for (int i = 0; i < Settings::NUM_PRIORITIES; ++i)
+    {
+        if (!_sequences[i].empty())
+        {
+            priority = Settings::Priority(i);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+bool Spool::contains(uint64_t journalId) const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _journalIds.find(journalId) != _journalIds.end();
+}
+
+
+std::vector<Spool::Tracked> Spool::takeTickets()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    std::vector<Tracked> tracked;
+
+    for (auto& ticket: _tickets)
+        tracked.push_back(ticket.second);
+
+    _tickets.clear();
+
+    return tracked;
+}
+
+
+std::string Spool::path(uint64_t sequence) const
+{
+    return Poco::Path(Poco::Path(_directory), fileName(sequence)).toString();
+}
+
+
+} } // namespace ofx::SMTP
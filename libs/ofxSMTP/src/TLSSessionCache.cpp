@@ -0,0 +1,277 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/SMTP/TLSSessionCache.h"
+#include <cerrno>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <openssl/ssl.h>
+#include "Poco/Base64Decoder.h"
+#include "Poco/Base64Encoder.h"
+#include "Poco/Exception.h"
+#include "Poco/File.h"
+#include "Poco/StreamCopier.h"
+#include "ofJson.h"
+#include "ofLog.h"
+#include "ofUtils.h"
+
+
+#if !defined(_WIN32)
+    #include <fcntl.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+
+namespace ofx {
+namespace SMTP {
+
+
+namespace {
+
+
+/// \brief Write a file only its owner can read.
+/// \param filename The file name.
+/// \param data The content of the file.
+/// \returns true if the whole content was written.
+bool writePrivateFile(const std::string& filename, const std::string& data)
+{
+#if defined(_WIN32)
+    std::ofstream file(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+    file << data;
+    return bool(file);
+#else
+    int fd = ::open(filename.c_str(), O_CREAT | O_WRONLY | O_TRUNC, S_IRUSR | S_IWUSR);
+
+    if (fd < 0)
+        return false;
+
+    // A file left behind by an older version may be readable by others.
+    bool isWritten = fchmod(fd, S_IRUSR | S_IWUSR) == 0;
+
+    const char* p = data.data();
+    std::size_t remaining = data.size();
+
+    while (isWritten && remaining > 0)
+    {
+        ssize_t count = ::write(fd, p, remaining);
+
+        if (count < 0)
+        {
+            isWritten = errno == EINTR;
+            continue;
+        }
+
+        p += count;
+        remaining -= count;
+    }
+
+    return ::close(fd) == 0 && isWritten;
+#endif
+}
+
+
+} // namespace
+
+
+TLSSessionCache::TLSSessionCache()
+{
+}
+
+
+TLSSessionCache::~TLSSessionCache()
+{
+}
+
+
+Poco::Net::Session::Ptr TLSSessionCache::get(const std::string& host,
+                                             uint16_t port)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    auto iter = _sessions.find(key(host, port));
+
+    if (iter == _sessions.end())
+        return nullptr;
+
+    if (iter->second.expires <= std::time(nullptr))
+    {
+        _sessions.erase(iter);
+        return nullptr;
+    }
+
+    return iter->second.session;
+}
+
+
+void TLSSessionCache::put(const std::string& host,
+                          uint16_t port,
+                          Poco::Net::Session::Ptr pSession)
+{
+    if (!pSession)
+        return;
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    Entry& entry = _sessions[key(host, port)];
+
+    if (entry.session == pSession)
+        return;
+
+    entry.session = pSession;
+    entry.expires = expiration(pSession);
+
+    if (!_filename.empty())
+        saveUnlocked();
+}
+
+
+bool TLSSessionCache::load(const std::string& filename)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    _filename = ofToDataPath(filename, true);
+
+    if (!Poco::File(_filename).exists())
+        return true;
+
+    try
+    {
+        std::ifstream file(_filename);
+        ofJson json = ofJson::parse(file);
+
+        std::time_t now = std::time(nullptr);
+
+        for (auto iter = json["sessions"].begin(); iter != json["sessions"].end(); ++iter)
+        {
+            std::time_t expires = iter.value().value("expires", std::time_t(0));
+
+            if (expires <= now)
+                continue;
+
+            std::istringstream encoded(iter.value().value("session", ""));
+            Poco::Base64Decoder decoder(encoded);
+            std::string der;
+            Poco::StreamCopier::copyToString(decoder, der);
+
+            const unsigned char* data = reinterpret_cast<const unsigned char*>(der.data());
+            SSL_SESSION* pSSLSession = d2i_SSL_SESSION(nullptr, &data, long(der.size()));
+
+            if (pSSLSession)
+            {
+                Entry entry;
+                entry.session = new Poco::Net::Session(pSSLSession);
+                entry.expires = expires;
+                _sessions[iter.key()] = entry;
+            }
+        }
+
+        ofLogVerbose("TLSSessionCache::load") << "Loaded " << _sessions.size() << " TLS session(s).";
+        return true;
+    }
+    catch (const std::exception& exc)
+    {
+        ofLogError("TLSSessionCache::load") << "Unable to load " << _filename << ": " << exc.what();
+        return false;
+    }
+}
+
+
+bool TLSSessionCache::save() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return saveUnlocked();
+}
+
+
+std::size_t TLSSessionCache::size() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _sessions.size();
+}
+
+
+std::string TLSSessionCache::key(const std::string& host, uint16_t port)
+{
+    return host + ":" + std::to_string(port);
+}
+
+
+std::time_t TLSSessionCache::expiration(Poco::Net::Session::Ptr pSession)
+{
+    SSL_SESSION* pSSLSession = pSession->sslSession();
+    return std::time_t(SSL_SESSION_get_time(pSSLSession) + SSL_SESSION_get_timeout(pSSLSession));
+}
+
+
+bool TLSSessionCache::saveUnlocked() const
+{
+    if (_filename.empty())
+        return false;
+
+    ofJson sessions = ofJson::object();
+
+    std::time_t now = std::time(nullptr);
+
+    for (const auto& entry: _sessions)
+    {
+        if (entry.second.expires <= now)
+            continue;
+
+        SSL_SESSION* pSSLSession = entry.second.session->sslSession();
+
+        int length = i2d_SSL_SESSION(pSSLSession, nullptr);
+
+        if (length <= 0)
+            continue;
+
+        std::vector<unsigned char> der(length);
+        unsigned char* data = der.data();
+        i2d_SSL_SESSION(pSSLSession, &data);
+
+        std::ostringstream encoded;
+        Poco::Base64Encoder encoder(encoded);
+        encoder.write(reinterpret_cast<const char*>(der.data()), der.size());
+        encoder.close();
+
+        sessions[entry.first] = {
+            { "expires", entry.second.expires },
+            { "session", encoded.str() }
+        };
+    }
+
+    ofJson json = {
+        { "version", 1 },
+        { "sessions", sessions }
+    };
+
+    try
+    {
+        // Write to a temporary file first so a crash never leaves a
+        // truncated cache behind. The sessions hold their master secrets,
+        // so the file is only readable by its owner.
+        std::string temporary = _filename + ".tmp";
+
+        if (!writePrivateFile(temporary, json.dump()))
+        {
+            ofLogError("TLSSessionCache::save") << "Unable to write " << temporary;
+            return false;
+        }
+
+        Poco::File(temporary).renameTo(_filename);
+        return true;
+    }
+    catch (const Poco::Exception& exc)
+    {
+        ofLogError("TLSSessionCache::save") << exc.displayText();
+        return false;
+    }
+}
+
+
+} } // namespace ofx::SMTP
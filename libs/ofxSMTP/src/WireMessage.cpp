@@ -0,0 +1,402 @@
+//
+// Copyright (c) 2013 Christopher Baker <https://christopherbaker.net>
+//
+// SPDX-License-Identifier:	MIT
+//
+
+
+#include "ofx/SMTP/WireMessage.h"
+#include "ofx/SMTP/Base64.h"
+#include "ofx/SMTP/DataEncoder.h"
+#include "ofx/SMTP/MappedFilePartSource.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iomanip>
+#include <sstream>
+#include "Poco/Exception.h"
+#include "Poco/MemoryStream.h"
+#include "Poco/StreamCopier.h"
+
+
+namespace ofx {
+namespace SMTP {
+
+
+namespace {
+
+
+/// \brief A stand-in for a part source of a message being rendered.
+///
+/// It streams a placeholder instead of content that is encoded separately,
+/// and the content of the source otherwise, so that rendering never changes
+/// the message or its sources.
+class RenderPartSource: public Poco::Net::PartSource
+{
+public:
+    RenderPartSource(Poco::Net::PartSource& source,
+                     const std::string& placeholder):
+        Poco::Net::PartSource(source.mediaType()),
+        _source(source),
+        _placeholder(placeholder)
+    {
+        headers() = source.headers();
+    }
+
+    std::istream& stream() override
+    {
+        if (_placeholder.empty())
+            return _source.stream();
+
+        _pStream.reset(new Poco::MemoryInputStream(_placeholder.data(),
+                                                   std::streamsize(_placeholder.size())));
+        return *_pStream;
+    }
+
+    const std::string& filename() const override
+    {
+        return _source.filename();
+    }
+
+private:
+    Poco::Net::PartSource& _source;
+    std::string _placeholder;
+    std::unique_ptr<std::istream> _pStream;
+
+};
+
+
+} // namespace
+
+
+WireMessage::WireMessage()
+{
+}
+
+
+WireMessage::~WireMessage()
+{
+}
+
+
+const std::string& WireMessage::sender() const
+{
+    return _sender;
+}
+
+
+const std::vector<std::string>& WireMessage::recipients() const
+{
+    return _recipients;
+}
+
+
+void WireMessage::write(const Sink& sink) const
+{
+    static_assert(FILE_BLOCK_SIZE % Base64::LINE_INPUT_LENGTH == 0,
+                  "File blocks must hold whole base64 lines.");
+
+    std::string block;
+
+    for (const auto& segment: _segments)
+    {
+        if (segment.text)
+        {
+            sink(segment.text->data(), segment.text->size());
+            continue;
+        }
+
+        const char* data = segment.file ? segment.file->begin() : nullptr;
+
+        for (std::size_t offset = 0; offset < segment.fileSize; offset += FILE_BLOCK_SIZE)
+        {
+            block.clear();
+
+            // Blocks hold whole lines, so the line break between two blocks
+            // is added here.
+            if (offset > 0)
+                block.append("\r\n");
+
+            Base64::encode(data + offset,
+                           std::min(segment.fileSize - offset, std::size_t(FILE_BLOCK_SIZE)),
+                           block);
+
+            sink(block.data(), block.size());
+        }
+    }
+}
+
+
+std::size_t WireMessage::size() const
+{
+    return _size;
+}
+
+
+bool WireMessage::hasDotLines() const
+{
+    return _hasDotLines;
+}
+
+
+std::shared_ptr<const WireMessage> WireMessage::render(const Poco::Net::MailMessage& message)
+{
+    static std::atomic<uint64_t> placeholderCount(0);
+
+    std::shared_ptr<WireMessage> wire(new WireMessage());
+
+    wire->_sender = envelopeSender(message);
+    wire->_recipients = envelopeRecipients(message);
+
+    // The message is written as a copy whose parts stand in for the parts of
+    // the message. Base64 parts stream a unique placeholder instead, and are
+    // encoded with Base64::encode(). The encoded placeholders are then
+    // replaced by the encoded parts. Parts backed by a mapped file are
+    // replaced by file segments that are encoded when the message is
+    // written.
+    Poco::Net::MailMessage copy;
+    static_cast<Poco::Net::MessageHeader&>(copy) = message;
+    copy.setRecipients(message.recipients());
+
+    std::vector<std::string> placeholders;
+    std::vector<Segment> encodedParts;
+    std::vector<std::string> filenames;
+
+    for (const auto& part: message.parts())
+    {
+        std::string placeholder;
+
+        if (part.encoding == Poco::Net::MailMessage::ENCODING_BASE64)
+        {
+            // 48 bytes encode to a single line of 64 characters.
+            std::ostringstream stream;
+            stream << "ofxSMTP-placeholder-"
+                   << std::hex << std::setw(28) << std::setfill('0')
+                   << placeholderCount++;
+
+            placeholder = stream.str();
+
+            std::string encoded;
+            Base64::encode(placeholder.data(), placeholder.size(), encoded);
+            placeholders.push_back(encoded);
+
+            Segment encodedPart;
+
+            MappedFilePartSource* pSource = dynamic_cast<MappedFilePartSource*>(part.pSource);
+
+            if (pSource)
+            {
+                encodedPart.file = pSource->_pMemory;
+                encodedPart.fileSize = pSource->size();
+            }
+            else
+            {
+                std::string content;
+                Poco::StreamCopier::copyToString(part.pSource->stream(), content);
+
+                auto text = std::make_shared<std::string>();
+                Base64::encode(content.data(), content.size(), *text);
+                encodedPart.text = text;
+            }
+
+            encodedParts.push_back(encodedPart);
+            filenames.push_back(part.pSource->filename());
+        }
+
+        copy.addPart(part.name,
+                     new RenderPartSource(*part.pSource, placeholder),
+                     part.disposition,
+                     part.encoding);
+    }
+
+    std::string data;
+
+    DataEncoderStream stream(DataEncoder::CANONICAL,
+                             [&](const std::string& block, bool) {
+                                 data.append(block);
+                             });
+
+    if (message.parts().empty())
+        message.write(stream);
+    else
+        copy.write(stream);
+
+    stream.close();
+
+    wire->_hasDotLines = stream.encoder().hasDotLines();
+
+    // Parts are written in order, so each placeholder follows the last.
+    std::size_t offset = 0;
+
+    for (std::size_t i = 0; i < placeholders.size(); ++i)
+    {
+        std::size_t position = data.find(placeholders[i], offset);
+
+        if (position == std::string::npos)
+        {
+            throw Poco::IllegalStateException("Unable to locate attachment " + filenames[i]);
+        }
+
+        Segment text;
+        text.text = std::make_shared<const std::string>(data.substr(offset, position - offset));
+        wire->_segments.push_back(text);
+        wire->_segments.push_back(encodedParts[i]);
+
+        wire->_size += text.text->size();
+
+        if (encodedParts[i].text)
+            wire->_size += encodedParts[i].text->size();
+        else
+            wire->_size += Base64::encodedSize(encodedParts[i].fileSize);
+
+        offset = position + placeholders[i].size();
+    }
+
+    Segment text;
+    text.text = std::make_shared<const std::string>(offset == 0 ? std::move(data) : data.substr(offset));
+    wire->_segments.push_back(text);
+    wire->_size += text.text->size();
+
+    return wire;
+}
+
+
+std::shared_ptr<const WireMessage> WireMessage::withRecipients(const std::vector<std::string>& recipients) const
+{
+    std::shared_ptr<WireMessage> wire(new WireMessage(*this));
+    wire->_recipients = recipients;
+    return wire;
+}
+
+
+void WireMessage::serialize(std::ostream& stream) const
+{
+    stream << "ofxSMTP-wire 1\r\n";
+    stream << _sender << "\r\n";
+    stream << _recipients.size() << "\r\n";
+
+    for (const auto& recipient: _recipients)
+        stream << recipient << "\r\n";
+
+    stream << _size << "\r\n";
+
+    write([&](const char* data, std::size_t size) {
+        stream.write(data, std::streamsize(size));
+    });
+}
+
+
+std::shared_ptr<const WireMessage> WireMessage::deserialize(std::istream& stream)
+{
+    auto readLine = [&]() {
+        std::string line;
+
+        if (!std::getline(stream, line) || line.empty() || line.back() != '\r')
+            throw Poco::DataFormatException("Malformed message");
+
+        line.pop_back();
+        return line;
+    };
+
+    if (readLine() != "ofxSMTP-wire 1")
+        throw Poco::DataFormatException("Unknown message format");
+
+    std::shared_ptr<WireMessage> wire(new WireMessage());
+
+    wire->_sender = readLine();
+
+    std::size_t count = std::stoul(readLine());
+
+    for (std::size_t i = 0; i < count; ++i)
+        wire->_recipients.push_back(readLine());
+
+    std::size_t size = std::stoul(readLine());
+
+    auto data = std::make_shared<std::string>(size, '\0');
+
+    if (size > 0 && !stream.read(&(*data)[0], std::streamsize(size)))
+        throw Poco::DataFormatException("Truncated message");
+
+    wire->_hasDotLines = (data->compare(0, 1, ".") == 0) || data->find("\n.") != std::string::npos;
+    wire->_size = size;
+
+    Segment text;
+    text.text = data;
+    wire->_segments.push_back(text);
+
+    return wire;
+}
+
+
+std::shared_ptr<Poco::Net::MailMessage> WireMessage::headers() const
+{
+    auto message = std::make_shared<Poco::Net::MailMessage>();
+
+    // The headers are in the leading text segments, usually the first.
+    std::string header;
+
+    for (const auto& segment: _segments)
+    {
+        if (!segment.text)
+            break;
+
+        header.append(*segment.text);
+
+        if (header.find("\r\n\r\n") != std::string::npos)
+            break;
+    }
+
+    if (!header.empty())
+    {
+        std::istringstream stream(header);
+
+        // Read the header block only, not the content.
+        message->Poco::Net::MessageHeader::read(stream);
+    }
+
+    for (const auto& recipient: _recipients)
+        message->addRecipient(Poco::Net::MailRecipient(Poco::Net::MailRecipient::PRIMARY_RECIPIENT, recipient));
+
+    return message;
+}
+
+
+std::string WireMessage::envelopeSender(const Poco::Net::MailMessage& message)
+{
+    // Use the address part of "Name <address>" if present.
+    const std::string& from = message.getSender();
+    std::string::size_type pos = from.find('<');
+
+    if (pos == std::string::npos)
+    {
+        return "<" + from + ">";
+    }
+
+    return from.substr(pos);
+}
+
+
+std::vector<std::string> WireMessage::envelopeRecipients(const Poco::Net::MailMessage& message)
+{
+    std::vector<std::string> recipients;
+
+    for (const auto& recipient: message.recipients())
+        recipients.push_back(recipient.getAddress());
+
+    return recipients;
+}
+
+
+bool WireMessage::hasBase64Parts(const Poco::Net::MailMessage& message)
+{
+    for (const auto& part: message.parts())
+    {
+        if (part.encoding == Poco::Net::MailMessage::ENCODING_BASE64)
+            return true;
+    }
+
+    return false;
+}
+
+
+} } // namespace ofx::SMTP
@@ -16,7 +16,13 @@
 #include "ofx/SMTP/Events.h"
 #include "ofx/SMTP/Client.h"
 #include "ofx/SMTP/Credentials.h"
+#include "ofx/SMTP/Base64.h"
+#include "ofx/SMTP/DataEncoder.h"
+#include "ofx/SMTP/DeliveryTicket.h"
+#include "ofx/SMTP/EventQueue.h"
 #include "ofx/SMTP/GmailSettings.h"
+#include "ofx/SMTP/MappedFilePartSource.h"
+#include "ofx/SMTP/MessageTemplate.h"
 #include "ofx/SMTP/Settings.h"
 
 